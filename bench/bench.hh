@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+namespace bench {
+
+// Runs f reps times and returns the fastest run in seconds.
+template<typename F>
+static double time_best(F&& f, int reps = 5) {
+    double best = 1e300;
+    for (int r = 0; r < reps; r++) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+    }
+    return best;
+}
+
+static void report(const char* name, double items, double seconds) {
+    printf("%-40s %12.2f M/s %10.3f ms\n", name, items / seconds / 1e6, seconds * 1e3);
+}
+
+// Keeps results alive so the optimiser can't drop the work being measured.
+template<typename T>
+static void sink(const T& v) {
+    static volatile uint64_t s;
+    s = s + static_cast<uint64_t>(v);
+}
+
+// The problem size, optionally overridden by the first command line argument.
+static size_t size_arg(int argc, char** argv, size_t fallback) {
+    return argc > 1 ? std::strtoull(argv[1], nullptr, 10) : fallback;
+}
+
+} //::bench
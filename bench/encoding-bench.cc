@@ -0,0 +1,244 @@
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <vector>
+#include <string>
+
+#include <libzinc/zinc.hh>
+
+#include "bench.hh"
+
+int main(int argc, char** argv) {
+    const size_t n = bench::size_arg(argc, argv, 1 << 22);
+    std::mt19937 rng(42);
+    std::vector<uint32_t> xs(n), ys(n), dx(n), dy(n);
+    std::vector<uint64_t> codes(n), expected(n);
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = static_cast<uint32_t>(rng());
+        ys[i] = static_cast<uint32_t>(rng());
+        expected[i] = morton_code<2, 32>::encode({xs[i], ys[i]}).data;
+    }
+
+    printf("morton_code<2, 32>, %zu points\n", n);
+    double t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = morton_code<2, 32>::encode({xs[i], ys[i]}).data;
+        }
+    });
+    bench::report("encode loop", n, t);
+
+    for (auto isa : {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512}) {
+        if (!zinc::cpu::supports(isa)) {
+            printf("%s not supported on this machine\n", zinc::cpu::isa_name(isa));
+            continue;
+        }
+        std::string name = std::string("encode_batch ") + zinc::cpu::isa_name(isa);
+        t = bench::time_best([&] { morton_code<2, 32>::encode_batch(xs, ys, codes, isa); });
+        assert(codes == expected);
+        bench::report(name.c_str(), n, t);
+
+        name = std::string("decode_batch ") + zinc::cpu::isa_name(isa);
+        t = bench::time_best([&] { morton_code<2, 32>::decode_batch(codes, dx, dy, isa); });
+        assert(dx == xs && dy == ys);
+        bench::report(name.c_str(), n, t);
+    }
+    bench::sink(codes[n / 2]);
+
+    // one point at a time, 2D against 3D, with whichever encoder is compiled in and with magic bits
+    printf("morton_code<2, 32> and morton_code<3, 21>, %zu points\n", n);
+    std::vector<uint32_t> zs(n);
+    for (size_t i = 0; i < n; i++) {
+        xs[i] &= 0x1fffff;
+        ys[i] &= 0x1fffff;
+        zs[i] = static_cast<uint32_t>(rng()) & 0x1fffff;
+    }
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = morton_code<2, 32>::encode({xs[i], ys[i]}).data;
+        }
+    });
+    bench::report("encode 2D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = morton_code<3, 21>::encode({xs[i], ys[i], zs[i]}).data;
+        }
+    });
+    bench::report("encode 3D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            auto p = morton_code<3, 21>::decode(codes[i]);
+            dx[i] = p[0] ^ p[1] ^ p[2];
+        }
+    });
+    bench::sink(dx[n / 2]);
+    bench::report("decode 3D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = zinc::morton::expand_bits_2_magic(xs[i]) | zinc::morton::expand_bits_2_magic(ys[i]) << 1;
+        }
+    });
+    bench::report("encode 2D magic bits", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = zinc::morton::expand_bits_3_magic(xs[i]) | zinc::morton::expand_bits_3_magic(ys[i]) << 1 |
+                       zinc::morton::expand_bits_3_magic(zs[i]) << 2;
+        }
+    });
+    bench::report("encode 3D magic bits", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            dx[i] = static_cast<uint32_t>(zinc::morton::compact_bits_3_magic(codes[i]) ^ zinc::morton::compact_bits_3_magic(codes[i] >> 1) ^
+                                          zinc::morton::compact_bits_3_magic(codes[i] >> 2));
+        }
+    });
+    bench::sink(dx[n / 2]);
+    bench::report("decode 3D magic bits", n, t);
+
+    // the generated encoders for the shapes without hand written ones
+    printf("morton_code<1, 64>, <4, 16> and <5, 12>, %zu points\n", n);
+    std::vector<uint32_t> ws(n);
+    for (size_t i = 0; i < n; i++) {
+        ws[i] = static_cast<uint32_t>(rng());
+    }
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = morton_code<1, 64>::encode({uint64_t{xs[i]} << 32 | ys[i]}).data;
+        }
+    });
+    bench::report("encode 1D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = morton_code<4, 16>::encode({xs[i], ys[i], zs[i], ws[i]}).data;
+        }
+    });
+    bench::report("encode 4D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            auto p = morton_code<4, 16>::decode(codes[i]);
+            dx[i] = p[0] ^ p[1] ^ p[2] ^ p[3];
+        }
+    });
+    bench::sink(dx[n / 2]);
+    bench::report("decode 4D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = zinc::morton::expand_bits_magic<4, 16>(xs[i]) | zinc::morton::expand_bits_magic<4, 16>(ys[i]) << 1 |
+                       zinc::morton::expand_bits_magic<4, 16>(zs[i]) << 2 | zinc::morton::expand_bits_magic<4, 16>(ws[i]) << 3;
+        }
+    });
+    bench::report("encode 4D magic bits", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = morton_code<5, 12>::encode({xs[i], ys[i], zs[i], ws[i], dx[i]}).data;
+        }
+    });
+    bench::report("encode 5D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            auto c = morton_code<4, 16>{codes[i]};
+            c += morton_code<4, 16>{codes[n - 1 - i]};
+            codes[i] = c.data;
+        }
+    });
+    bench::report("add 4D", n, t);
+
+    // each way of interleaving, one point at a time
+    printf("interleaving, %s in use, pdep %s, %zu points\n", zinc::cpu::interleave_name(zinc::cpu::best_interleave()),
+        !zinc::cpu::supports(zinc::cpu::interleave::bmi2) ? "unsupported" : zinc::cpu::slow_pdep() ? "slow" : "fast", n);
+    for (auto how : {zinc::cpu::interleave::magic, zinc::cpu::interleave::lut, zinc::cpu::interleave::bmi2}) {
+        if (!zinc::cpu::supports(how)) {
+            printf("%s not supported on this machine\n", zinc::cpu::interleave_name(how));
+            continue;
+        }
+        const std::string name = zinc::cpu::interleave_name(how);
+        zinc::morton::with_interleave(how, [&](auto as) {
+            constexpr auto h = decltype(as)::value;
+            using zinc::morton::expand_bits_as;
+            using zinc::morton::compact_bits_as;
+            t = bench::time_best([&] {
+                for (size_t i = 0; i < n; i++) {
+                    codes[i] = expand_bits_as<h, 2, 32>(xs[i]) | expand_bits_as<h, 2, 32>(ys[i]) << 1;
+                }
+            });
+            bench::report(("encode 2D " + name).c_str(), n, t);
+            t = bench::time_best([&] {
+                for (size_t i = 0; i < n; i++) {
+                    dx[i] = static_cast<uint32_t>(compact_bits_as<h, 2, 32>(codes[i]) ^ compact_bits_as<h, 2, 32>(codes[i] >> 1));
+                }
+            });
+            bench::sink(dx[n / 2]);
+            bench::report(("decode 2D " + name).c_str(), n, t);
+            t = bench::time_best([&] {
+                for (size_t i = 0; i < n; i++) {
+                    codes[i] = expand_bits_as<h, 3, 21>(xs[i]) | expand_bits_as<h, 3, 21>(ys[i]) << 1 | expand_bits_as<h, 3, 21>(zs[i]) << 2;
+                }
+            });
+            bench::report(("encode 3D " + name).c_str(), n, t);
+            t = bench::time_best([&] {
+                for (size_t i = 0; i < n; i++) {
+                    dx[i] = static_cast<uint32_t>(compact_bits_as<h, 3, 21>(codes[i]) ^ compact_bits_as<h, 3, 21>(codes[i] >> 1) ^
+                                                  compact_bits_as<h, 3, 21>(codes[i] >> 2));
+                }
+            });
+            bench::sink(dx[n / 2]);
+            bench::report(("decode 3D " + name).c_str(), n, t);
+            t = bench::time_best([&] {
+                for (size_t i = 0; i < n; i++) {
+                    codes[i] = expand_bits_as<h, 4, 16>(xs[i]) | expand_bits_as<h, 4, 16>(ys[i]) << 1 |
+                               expand_bits_as<h, 4, 16>(zs[i]) << 2 | expand_bits_as<h, 4, 16>(ws[i]) << 3;
+                }
+            });
+            bench::report(("encode 4D " + name).c_str(), n, t);
+            return 0;
+        });
+    }
+    // the lookup table compact, which the lookup table interleave leaves to magic bits
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            dx[i] = static_cast<uint32_t>(zinc::morton::compact_bits_lut<2, 32>(codes[i]) ^ zinc::morton::compact_bits_lut<2, 32>(codes[i] >> 1));
+        }
+    });
+    bench::sink(dx[n / 2]);
+    bench::report("decode 2D byte tables", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            dx[i] = static_cast<uint32_t>(zinc::morton::compact_bits_lut<3, 21>(codes[i]) ^ zinc::morton::compact_bits_lut<3, 21>(codes[i] >> 1) ^
+                                          zinc::morton::compact_bits_lut<3, 21>(codes[i] >> 2));
+        }
+    });
+    bench::sink(dx[n / 2]);
+    bench::report("decode 3D byte tables", n, t);
+
+    // the hilbert curve on top of the morton interleave, against encode 2D and encode 3D above
+    printf("hilbert_code<2, 32> and hilbert_code<3, 21>, %zu points\n", n);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = hilbert_code<2, 32>::encode({xs[i], ys[i]}).data;
+        }
+    });
+    bench::report("hilbert encode 2D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            auto p = hilbert_code<2, 32>::decode(codes[i]);
+            dx[i] = p[0] ^ p[1];
+        }
+    });
+    bench::sink(dx[n / 2]);
+    bench::report("hilbert decode 2D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            codes[i] = hilbert_code<3, 21>::encode({xs[i], ys[i], zs[i]}).data;
+        }
+    });
+    bench::report("hilbert encode 3D", n, t);
+    t = bench::time_best([&] {
+        for (size_t i = 0; i < n; i++) {
+            auto p = hilbert_code<3, 21>::decode(codes[i]);
+            dx[i] = p[0] ^ p[1] ^ p[2];
+        }
+    });
+    bench::sink(dx[n / 2]);
+    bench::report("hilbert decode 3D", n, t);
+    bench::sink(codes[n / 2]);
+    return 0;
+}
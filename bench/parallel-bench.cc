@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include <libzinc/zinc.hh>
+
+#include "bench.hh"
+
+using region = zinc::morton::region<2, 32>;
+
+static region random_region(std::mt19937_64& rng, size_t n) {
+    region r;
+    r.intervals.reserve(n);
+    uint64_t s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s += 1 + rng() % 64;
+        uint64_t e = s + rng() % 64;
+        r.intervals.push_back({s, e});
+        s = e + 1;
+    }
+    return r;
+}
+
+int main(int argc, char** argv) {
+    const size_t n = bench::size_arg(argc, argv, 1 << 24);
+    std::mt19937_64 rng(42);
+    region a = random_region(rng, n), b = random_region(rng, n);
+    printf("parallel set operations, %zu intervals each\n", n);
+
+    region expected_union = a | b, expected_intersection = a & b, expected_difference = a - b;
+    region r;
+    double t = bench::time_best([&] { r = a; r |= b; }, 3);
+    bench::report("serial operator|=", 2.0 * n, t);
+    t = bench::time_best([&] { r = a; r &= b; }, 3);
+    bench::report("serial operator&=", 2.0 * n, t);
+    t = bench::time_best([&] { r = a; r -= b; }, 3);
+    bench::report("serial operator-=", 2.0 * n, t);
+
+    for (size_t threads = 1; threads <= 64; threads *= 2) {
+        zinc::thread_pool pool(threads);
+        std::string name = "parallel_union, " + std::to_string(threads) + " threads";
+        t = bench::time_best([&] { r = a; zinc::morton::parallel_union(r, b, pool); }, 3);
+        assert(r == expected_union);
+        bench::report(name.c_str(), 2.0 * n, t);
+        name = "parallel_intersection, " + std::to_string(threads) + " threads";
+        t = bench::time_best([&] { r = a; zinc::morton::parallel_intersection(r, b, pool); }, 3);
+        assert(r == expected_intersection);
+        bench::report(name.c_str(), 2.0 * n, t);
+        name = "parallel_difference, " + std::to_string(threads) + " threads";
+        t = bench::time_best([&] { r = a; zinc::morton::parallel_difference(r, b, pool); }, 3);
+        assert(r == expected_difference);
+        bench::report(name.c_str(), 2.0 * n, t);
+    }
+
+    // boxes spread over a world, so the intervals are many and mostly apart
+    std::vector<zinc::morton::AABB<2, 32>> boxes;
+    for (size_t i = 0; i < n / 64; i++) {
+        const uint32_t x = rng() % (1u << 16), y = rng() % (1u << 16);
+        boxes.push_back({morton_code<2, 32>::encode({x, y}), morton_code<2, 32>::encode({x + static_cast<uint32_t>(rng() % 64), y + static_cast<uint32_t>(rng() % 64)})});
+    }
+    printf("the union of %zu boxes\n", boxes.size());
+    region expected_boxes;
+    t = bench::time_best([&] { expected_boxes = zinc::morton::regions_from_aabbs<2, 32>(boxes); }, 3);
+    bench::report("regions_from_aabbs", boxes.size(), t);
+    for (size_t threads = 1; threads <= 64; threads *= 2) {
+        zinc::thread_pool pool(threads);
+        std::string name = "parallel_regions_from_aabbs, " + std::to_string(threads) + " threads";
+        t = bench::time_best([&] { r = zinc::morton::parallel_regions_from_aabbs<2, 32>(boxes, pool); }, 3);
+        assert(r == expected_boxes);
+        bench::report(name.c_str(), boxes.size(), t);
+    }
+    return 0;
+}
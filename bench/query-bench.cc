@@ -0,0 +1,117 @@
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <array>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <libzinc/zinc.hh>
+
+#include "bench.hh"
+
+// Radius and nearest neighbour queries over Morton-sorted points, against measuring every
+// point. The brute force runs far fewer queries, as each one reads all the points.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+static void bench_neighbours(std::mt19937_64& rng, size_t n, uint32_t side, double radius, size_t k) {
+    using code_type = morton_code<Dimension, BitsPerDimension>;
+    using coordinate_type = typename code_type::coordinate_type;
+    using point = std::array<coordinate_type, Dimension>;
+    printf("%uD, %zu points in a cube of side %u, radius %.0f and %zu nearest\n", Dimension, n, side, radius, k);
+    std::vector<uint64_t> codes(n);
+    std::vector<point> points(n);
+    for (size_t i = 0; i < n; i++) {
+        point p;
+        for (size_t d = 0; d < Dimension; d++) {
+            p[d] = static_cast<coordinate_type>(rng() % side);
+        }
+        codes[i] = code_type::encode(p);
+    }
+    std::sort(codes.begin(), codes.end());
+    for (size_t i = 0; i < n; i++) {
+        points[i] = code_type::decode(codes[i]);
+    }
+    std::vector<point> centres(1000);
+    for (auto& c : centres) {
+        for (size_t d = 0; d < Dimension; d++) {
+            c[d] = static_cast<coordinate_type>(rng() % side);
+        }
+    }
+    auto distance = [](const point& a, const point& b) {
+        double d2 = 0;
+        for (size_t d = 0; d < Dimension; d++) {
+            const double delta = static_cast<double>(a[d]) - static_cast<double>(b[d]);
+            d2 += delta * delta;
+        }
+        return d2;
+    };
+    const size_t brute = std::max<size_t>(1, std::min<size_t>(centres.size(), (size_t{1} << 26) / n));
+    printf("%zu queries, %zu of them by brute force\n", centres.size(), brute);
+
+    size_t expected = 0;
+    double t = bench::time_best([&] {
+        expected = 0;
+        for (size_t q = 0; q < brute; q++) {
+            for (auto& p : points) {
+                expected += distance(centres[q], p) <= radius * radius;
+            }
+        }
+    }, 3);
+    bench::report("brute force radius", brute, t);
+    bench::sink(expected);
+    std::vector<size_t> found;
+    size_t count = 0;
+    t = bench::time_best([&] {
+        count = 0;
+        for (auto& c : centres) {
+            found.clear();
+            zinc::morton::query_radius<Dimension, BitsPerDimension>(codes, c, radius, found);
+            count += found.size();
+        }
+    }, 3);
+    bench::report("query_radius", centres.size(), t);
+    size_t check = 0;
+    for (size_t q = 0; q < brute; q++) {
+        found.clear();
+        zinc::morton::query_radius<Dimension, BitsPerDimension>(codes, centres[q], radius, found);
+        check += found.size();
+    }
+    assert(check == expected);
+    printf("%.1f points a radius query\n", static_cast<double>(count) / centres.size());
+
+    double kth = 0;
+    t = bench::time_best([&] {
+        kth = 0;
+        std::vector<double> d2s(n);
+        for (size_t q = 0; q < brute; q++) {
+            for (size_t i = 0; i < n; i++) {
+                d2s[i] = distance(centres[q], points[i]);
+            }
+            std::nth_element(d2s.begin(), d2s.begin() + static_cast<ptrdiff_t>(k - 1), d2s.end());
+            kth += d2s[k - 1];
+        }
+    }, 3);
+    bench::report("brute force nearest", brute, t);
+    bench::sink(kth);
+    t = bench::time_best([&] {
+        for (auto& c : centres) {
+            zinc::morton::query_nearest<Dimension, BitsPerDimension>(codes, c, k, found);
+            bench::sink(found.size());
+        }
+    }, 3);
+    bench::report("query_nearest", centres.size(), t);
+    double kth_found = 0;
+    for (size_t q = 0; q < brute; q++) {
+        zinc::morton::query_nearest<Dimension, BitsPerDimension>(codes, centres[q], k, found);
+        kth_found += distance(centres[q], points[found.back()]);
+    }
+    assert(kth_found == kth);
+}
+
+int main(int argc, char** argv) {
+    const size_t n = bench::size_arg(argc, argv, 1000000);
+    std::mt19937_64 rng(42);
+    bench_neighbours<2, 32>(rng, n, 1u << 16, 100, 16);
+    bench_neighbours<3, 21>(rng, n, 1u << 12, 40, 16);
+    return 0;
+}
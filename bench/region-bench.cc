@@ -0,0 +1,724 @@
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <array>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <libzinc/zinc.hh>
+
+#include "bench.hh"
+
+using region = zinc::morton::region<2, 32>;
+
+// n sorted, disjoint, non adjacent intervals with random gaps and lengths
+static region random_region(std::mt19937_64& rng, size_t n, uint64_t max_gap = 64, uint64_t max_len = 64) {
+    region r;
+    r.intervals.reserve(n);
+    uint64_t s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s += 1 + rng() % max_gap;
+        uint64_t e = s + rng() % max_len;
+        r.intervals.push_back({s, e});
+        s = e + 1;
+    }
+    return r;
+}
+
+static void bench_lookup(std::mt19937_64& rng, size_t n) {
+    printf("point lookups, %zu intervals\n", n);
+    region r = random_region(rng, n);
+    std::vector<uint64_t> queries(1 << 20);
+    for (auto& q : queries) {
+        q = rng() % (r.intervals.back().end + 1);
+    }
+    size_t found = 0;
+    double t = bench::time_best([&] {
+        for (auto q : queries) {
+            found += r.contains(q);
+        }
+    });
+    bench::report("region::contains", queries.size(), t);
+    zinc::morton::region_index<2, 32> index(r);
+    t = bench::time_best([&] {
+        for (auto q : queries) {
+            found += index.contains(q);
+        }
+    });
+    bench::report("region_index::contains", queries.size(), t);
+
+    std::vector<morton_code<2, 32>> codes(queries.begin(), queries.end());
+    std::vector<const region::interval_type*> out(codes.size());
+    t = bench::time_best([&] { r.lookup(codes, out); });
+    bench::report("region::lookup (unsorted)", codes.size(), t);
+    std::sort(codes.begin(), codes.end(), [](auto a, auto b) { return a.data < b.data; });
+    t = bench::time_best([&] { r.lookup_sorted(codes, out); });
+    bench::report("region::lookup_sorted", codes.size(), t);
+    bench::sink(found + (out[0] != nullptr));
+}
+
+// operator|= as it was before the single pass merge, kept for comparison
+static void legacy_union(region& lhs, const region& rhs) {
+    size_t mid = lhs.intervals.size();
+    lhs.intervals.insert(lhs.intervals.end(), rhs.intervals.begin(), rhs.intervals.end());
+    std::inplace_merge(lhs.intervals.begin(), lhs.intervals.begin() + static_cast<ptrdiff_t>(mid), lhs.intervals.end());
+    std::vector<bool> to_delete(lhs.intervals.size());
+    for (size_t i = 0; i < lhs.intervals.size() - 1; i++) {
+        auto end = lhs.intervals[i].end;
+        size_t j;
+        for (j = i + 1; j < lhs.intervals.size() && lhs.intervals[j].start - 1 <= end; j++) {
+            end = std::max(end, lhs.intervals[j].end);
+        }
+        lhs.intervals[i].end = end;
+        for (size_t k = i + 1; k < j; k++) {
+            to_delete[k] = true;
+        }
+        i = j - 1;
+    }
+    auto it = to_delete.begin();
+    lhs.intervals.erase(std::remove_if(lhs.intervals.begin(), lhs.intervals.end(), [&it](const region::interval_type&) { return *it++; }), lhs.intervals.end());
+}
+
+static void bench_union(std::mt19937_64& rng, size_t n) {
+    printf("union of two regions, %zu intervals each\n", n);
+    region a = random_region(rng, n), b = random_region(rng, n);
+    region expected = a;
+    legacy_union(expected, b);
+    region r;
+    double t = bench::time_best([&] {
+        r = a;
+        legacy_union(r, b);
+    });
+    bench::report("legacy operator|=", 2.0 * n, t);
+    // keep the capacity between runs, as a caller reusing a region would
+    region reused;
+    reused.intervals.reserve(2 * n);
+    t = bench::time_best([&] {
+        reused.intervals.assign(a.intervals.begin(), a.intervals.end());
+        reused |= b;
+    });
+    assert(reused == expected);
+    bench::report("operator|=", 2.0 * n, t);
+    t = bench::time_best([&] {
+        r = a | b;
+    });
+    assert(r == expected);
+    bench::report("operator|", 2.0 * n, t);
+}
+
+static void bench_intersect_subtract(std::mt19937_64& rng, size_t n) {
+    printf("intersection, difference and xor of two regions, %zu intervals each\n", n);
+    region a = random_region(rng, n), b = random_region(rng, n);
+    region r;
+    double t = bench::time_best([&] {
+        r.intervals.assign(a.intervals.begin(), a.intervals.end());
+        r &= b;
+    });
+    bench::report("operator&=", 2.0 * n, t);
+    t = bench::time_best([&] {
+        r.intervals.assign(a.intervals.begin(), a.intervals.end());
+        r -= b;
+    });
+    bench::report("operator-=", 2.0 * n, t);
+    region c = random_region(rng, n);
+    t = bench::time_best([&] {
+        r = (a | b) & (c - b);
+    });
+    bench::report("(a | b) & (c - b)", 4.0 * n, t);
+    t = bench::time_best([&] {
+        r = (a - b) | (b - a);
+    });
+    bench::report("(a - b) | (b - a)", 2.0 * n, t);
+    t = bench::time_best([&] {
+        r = a ^ b;
+    });
+    bench::report("a ^ b", 2.0 * n, t);
+}
+
+static void bench_lazy(std::mt19937_64& rng, size_t n) {
+    printf("eager and lazy expressions over three regions, %zu intervals each\n", n);
+    using zinc::morton::lazy;
+    region a = random_region(rng, n), b = random_region(rng, n), c = random_region(rng, n);
+    region expected, r;
+    double t = bench::time_best([&] { expected = (a | b) & (c - b); });
+    bench::report("eager (a | b) & (c - b)", 4.0 * n, t);
+    t = bench::time_best([&] { r = (lazy(a) | b) & (lazy(c) - b); });
+    assert(r == expected);
+    bench::report("lazy (a | b) & (c - b)", 4.0 * n, t);
+    uint64_t area = 0;
+    t = bench::time_best([&] { area = ((a | b) & (c - b)).area(); });
+    bench::report("eager area", 4.0 * n, t);
+    t = bench::time_best([&] { bench::sink(area == ((lazy(a) | b) & (lazy(c) - b)).area()); });
+    bench::report("lazy area", 4.0 * n, t);
+}
+
+static void bench_cells(std::mt19937_64& rng, size_t n) {
+    printf("walking the cells of a region, %zu intervals\n", n);
+    region r = random_region(rng, n, 64, 1 << 12);
+    size_t cells = 0;
+    double t = bench::time_best([&] { cells = r.to_cells().size(); });
+    bench::report("region::to_cells", cells, t);
+    uint64_t sum = 0;
+    t = bench::time_best([&] {
+        for (const auto& c : r.cells()) {
+            sum += c.end - c.start;
+        }
+    });
+    bench::sink(sum);
+    bench::report("region::cells", cells, t);
+
+    std::vector<std::pair<uint64_t, uint64_t>> counts;
+    t = bench::time_best([&] {
+        std::array<uint64_t, 33> h {};
+        for (const auto& c : r.cells()) {
+            h[zinc::morton::fast_log2(c.end - c.start + 1) / 2]++;
+        }
+        bench::sink(h[0]);
+    });
+    bench::report("histogram by visiting cells", n, t);
+    t = bench::time_best([&] { counts = r.count_cells(); });
+    bench::report("region::count_cells", n, t);
+}
+
+static void bench_serialize(std::mt19937_64& rng, size_t n) {
+    printf("encoded regions, %zu intervals\n", n);
+    region r = random_region(rng, n);
+    std::vector<uint8_t> buffer;
+    double t = bench::time_best([&] { buffer = zinc::morton::serialize(r); });
+    bench::report("serialize", n, t);
+    printf("%.2f bytes per interval, against %zu in memory\n", static_cast<double>(buffer.size()) / n, sizeof(region::interval_type));
+    auto view = zinc::morton::encoded_region<2, 32>::open(buffer);
+    assert(view);
+    region decoded;
+    t = bench::time_best([&] { decoded = view->decode(); });
+    assert(decoded == r);
+    bench::report("encoded_region::decode", n, t);
+    std::vector<uint64_t> queries(1 << 20);
+    for (auto& q : queries) {
+        q = rng() % (r.intervals.back().end + 1);
+    }
+    size_t found = 0;
+    t = bench::time_best([&] {
+        for (auto q : queries) {
+            found += view->contains(q);
+        }
+    });
+    bench::report("encoded_region::contains", queries.size(), t);
+    bench::sink(found);
+}
+
+static void bench_mapped(std::mt19937_64& rng, size_t n) {
+    printf("mapped regions, %zu intervals\n", n);
+    region r = random_region(rng, n);
+    const char* path = "region-bench-mapped.bin";
+    bool written = false;
+    double t = bench::time_best([&] { written = zinc::morton::write_mapped_region(r, path); }, 1);
+    if (!written) {
+        printf("couldn't write %s\n", path);
+        return;
+    }
+    bench::report("write_mapped_region", n, t);
+    std::optional<zinc::morton::mapped_region<2, 32>> m;
+    t = bench::time_best([&] { m = zinc::morton::mapped_region<2, 32>::open(path); });
+    bench::report("mapped_region::open", n, t);
+    if (!m) {
+        printf("couldn't map %s\n", path);
+        return;
+    }
+    std::vector<uint64_t> queries(1 << 20);
+    for (auto& q : queries) {
+        q = rng() % (r.intervals.back().end + 1);
+    }
+    size_t found = 0;
+    t = bench::time_best([&] {
+        for (auto q : queries) {
+            found += m->contains(q);
+        }
+    });
+    bench::report("mapped_region::contains", queries.size(), t);
+    bench::sink(found);
+    std::remove(path);
+}
+
+static void bench_soa(std::mt19937_64& rng, size_t n) {
+    printf("struct of arrays regions, %zu intervals\n", n);
+    using soa = zinc::morton::soa_region<2, 32>;
+    region r = random_region(rng, n);
+    soa s(r);
+    // interleaved with r, so intersects has to merge all the way to the end
+    region gaps;
+    for (size_t i = 0; i + 1 < r.intervals.size(); i += 2) {
+        gaps.intervals.push_back({r.intervals[i].end + 1, r.intervals[i + 1].start - 1});
+    }
+    soa s_gaps(gaps);
+    uint64_t area = 0;
+    double t = bench::time_best([&] { area = r.area(); });
+    bench::report("region::area", n, t);
+    for (auto isa : {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512}) {
+        if (!zinc::cpu::supports(isa)) continue;
+        t = bench::time_best([&] { bench::sink(area == s.area(isa)); });
+        bench::report((std::string("soa_region::area ") + zinc::cpu::isa_name(isa)).c_str(), n, t);
+    }
+    bool hit = false;
+    t = bench::time_best([&] { hit = r.intersects(gaps); });
+    bench::sink(hit);
+    bench::report("region::intersects", 1.5 * n, t);
+    for (auto isa : {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512}) {
+        if (!zinc::cpu::supports(isa)) continue;
+        t = bench::time_best([&] { hit = s.intersects(s_gaps, isa); });
+        bench::sink(hit);
+        bench::report((std::string("soa_region::intersects ") + zinc::cpu::isa_name(isa)).c_str(), 1.5 * n, t);
+    }
+    // one gap in every 64, so most of r is skipped over
+    region sparse;
+    for (size_t i = 0; i + 1 < r.intervals.size(); i += 64) {
+        sparse.intervals.push_back({r.intervals[i].end + 1, r.intervals[i + 1].start - 1});
+    }
+    soa s_sparse(sparse);
+    t = bench::time_best([&] { hit = r.intersects(sparse); });
+    bench::sink(hit);
+    bench::report("region::intersects sparse", n, t);
+    for (auto isa : {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512}) {
+        if (!zinc::cpu::supports(isa)) continue;
+        t = bench::time_best([&] { hit = s.intersects(s_sparse, isa); });
+        bench::sink(hit);
+        bench::report((std::string("soa_region::intersects sparse ") + zinc::cpu::isa_name(isa)).c_str(), n, t);
+    }
+    std::vector<uint64_t> queries(1 << 20);
+    for (auto& q : queries) {
+        q = rng() % (r.intervals.back().end + 1);
+    }
+    for (auto isa : {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512}) {
+        if (!zinc::cpu::supports(isa)) continue;
+        size_t found = 0;
+        t = bench::time_best([&] {
+            for (auto q : queries) {
+                found += s.contains(q, isa);
+            }
+        });
+        bench::sink(found);
+        bench::report((std::string("soa_region::contains ") + zinc::cpu::isa_name(isa)).c_str(), queries.size(), t);
+    }
+}
+
+static void bench_region_simd(std::mt19937_64& rng, size_t n) {
+    printf("region::area and region::intersects, %zu intervals\n", n);
+    region r = random_region(rng, n);
+    zinc::morton::region<2, 32, uint64_t> with_data;
+    with_data.intervals.reserve(r.intervals.size());
+    for (auto& i : r.intervals) {
+        with_data.intervals.push_back({i.start, i.end, i.start});
+    }
+    const auto isas = {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512};
+    for (auto isa : isas) {
+        if (!zinc::cpu::supports(isa)) continue;
+        double t = bench::time_best([&] { bench::sink(r.area(isa)); });
+        bench::report((std::string("region::area ") + zinc::cpu::isa_name(isa)).c_str(), n, t);
+        t = bench::time_best([&] { bench::sink(with_data.area(isa)); });
+        bench::report((std::string("region::area with data ") + zinc::cpu::isa_name(isa)).c_str(), n, t);
+    }
+    // regions filling the gaps of r, one gap in every `every`, so nothing intersects and the
+    // merge runs to the end: 1 is the adversarial case, where the two sides alternate
+    auto gaps_of = [&r](size_t every) {
+        region gaps;
+        for (size_t i = 0; i + 1 < r.intervals.size(); i += every) {
+            gaps.intervals.push_back({r.intervals[i].end + 1, r.intervals[i + 1].start - 1});
+        }
+        return gaps;
+    };
+    const std::pair<const char*, size_t> cases[] = {{"sparse", 64}, {"dense", 4}, {"adversarial", 1}};
+    for (auto& c : cases) {
+        region gaps = gaps_of(c.second);
+        for (auto isa : isas) {
+            if (!zinc::cpu::supports(isa)) continue;
+            bool hit = false;
+            double t = bench::time_best([&] { hit = r.intersects(gaps, isa); });
+            bench::sink(hit);
+            bench::report((std::string("region::intersects ") + c.first + " " + zinc::cpu::isa_name(isa)).c_str(), n + gaps.intervals.size(), t);
+        }
+    }
+}
+
+// Boxes of about the same number of points in 2D and 3D, decomposed and combined.
+static void bench_dimensions(std::mt19937_64& rng) {
+    printf("2D against 3D and 4D boxes, in one and two word codes\n");
+    auto run = [&rng](auto tag, uint32_t side, const char* name) {
+        using code = decltype(tag);
+        constexpr uint32_t dimension = code::dimension, bits = code::max_level;
+        using box = zinc::morton::AABB<dimension, bits>;
+        using region_type = zinc::morton::region<dimension, bits>;
+        std::vector<box> boxes;
+        for (size_t i = 0; i < 64; i++) {
+            std::array<typename code::coordinate_type, dimension> lo, hi;
+            for (size_t d = 0; d < dimension; d++) {
+                lo[d] = static_cast<typename code::coordinate_type>(rng() % (1u << 16));
+                hi[d] = lo[d] + side - 1;
+            }
+            boxes.push_back({code::encode(lo), code::encode(hi)});
+        }
+        size_t intervals = 0;
+        std::vector<region_type> regions(boxes.size());
+        double t = bench::time_best([&] {
+            intervals = 0;
+            for (size_t i = 0; i < boxes.size(); i++) {
+                regions[i] = boxes[i].to_intervals();
+                intervals += regions[i].intervals.size();
+            }
+        });
+        bench::report((std::string("AABB::to_intervals ") + name).c_str(), intervals, t);
+        size_t cells = 0;
+        t = bench::time_best([&] {
+            cells = 0;
+            for (auto& b : boxes) {
+                for (auto& c : b.cells()) {
+                    cells += c.area() != 0;
+                }
+            }
+        });
+        bench::report((std::string("AABB::cells ") + name).c_str(), cells, t);
+        region_type all;
+        t = bench::time_best([&] { all = region_type::union_all(regions); });
+        bench::report((std::string("region::union_all ") + name).c_str(), intervals, t);
+        bench::sink(all.area());
+    };
+    // 1024^2, 101^3 and 32^4 are all about a million points
+    run(morton_code<2, 32>(0), 1024, "2D");
+    run(morton_code<3, 21>(0), 101, "3D");
+    run(morton_code<3, 42>(0), 101, "3D, two words");
+    run(morton_code<4, 32>(0), 32, "4D, two words");
+}
+
+// The same boxes on the morton and hilbert curves: how many intervals each takes, and
+// what that does to decomposing them and to the set operations between them.
+static void bench_curves(std::mt19937_64& rng) {
+    printf("morton against hilbert curves\n");
+    auto run = [&rng](auto tag, uint32_t side, const char* name) {
+        using code = decltype(tag);
+        constexpr uint32_t dimension = code::dimension, bits = code::max_level;
+        using box = zinc::morton::AABB<dimension, bits>;
+        std::vector<box> boxes;
+        for (size_t i = 0; i < 256; i++) {
+            std::array<typename code::coordinate_type, dimension> lo, hi;
+            for (size_t d = 0; d < dimension; d++) {
+                // boxes of random sizes up to side, overlapping their neighbours
+                lo[d] = static_cast<typename code::coordinate_type>(rng() % (4 * side));
+                hi[d] = static_cast<typename code::coordinate_type>(lo[d] + rng() % side);
+            }
+            boxes.push_back({code::encode(lo), code::encode(hi)});
+        }
+        auto measure = [&](const char* curve, auto decompose) {
+            using region_type = decltype(decompose(boxes[0]));
+            std::vector<region_type> regions(boxes.size());
+            size_t intervals = 0;
+            double t = bench::time_best([&] {
+                intervals = 0;
+                for (size_t i = 0; i < boxes.size(); i++) {
+                    regions[i] = decompose(boxes[i]);
+                    intervals += regions[i].intervals.size();
+                }
+            });
+            printf("%s %s: %.1f intervals a box\n", curve, name, static_cast<double>(intervals) / boxes.size());
+            const std::string suffix = std::string(" ") + curve + " " + name;
+            bench::report(("to_intervals" + suffix).c_str(), intervals, t);
+            uint64_t area = 0;
+            t = bench::time_best([&] {
+                area = 0;
+                for (size_t i = 1; i < regions.size(); i++) {
+                    area += (regions[i - 1] & regions[i]).area();
+                }
+            });
+            bench::report(("operator&" + suffix).c_str(), intervals, t);
+            region_type all;
+            t = bench::time_best([&] { all = region_type::union_all(regions); });
+            bench::report(("region::union_all" + suffix).c_str(), intervals, t);
+            bench::sink(area + all.area());
+        };
+        measure("morton", [](const box& b) { return b.to_intervals(); });
+        measure("hilbert", [](const box& b) { return b.to_hilbert_intervals(); });
+    };
+    run(morton_code<2, 32>(0), 1024, "2D");
+    run(morton_code<2, 32>(0), 64, "2D small");
+    run(morton_code<3, 21>(0), 101, "3D");
+    run(morton_code<3, 21>(0), 16, "3D small");
+}
+
+// to_intervals as it was, splitting boxes on a stack in a std::vector
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+static zinc::morton::region<Dimension, BitsPerDimension> legacy_to_intervals(zinc::morton::AABB<Dimension, BitsPerDimension> box) {
+    using aabb_type = zinc::morton::AABB<Dimension, BitsPerDimension>;
+    std::vector<aabb_type> inputs {box};
+    std::vector<zinc::morton::detail::interval<Dimension, BitsPerDimension>> outputs;
+    while (!inputs.empty()) {
+        aabb_type aabb = inputs.back();
+        inputs.pop_back();
+        if (aabb.is_morton_aligned()) {
+            if (!outputs.empty() && outputs.back().end + 1 == aabb.min) {
+                outputs.back().end = aabb.max;
+            } else {
+                outputs.push_back(aabb.to_cell());
+            }
+            continue;
+        }
+        auto [litmax, bigmin] = aabb.morton_get_next_address();
+        inputs.push_back({bigmin, aabb.max});
+        inputs.push_back({aabb.min, litmax});
+    }
+    return {outputs};
+}
+
+// Many small boxes decomposed one at a time, into a region each and appended into one
+// region that is reused, as a query loop would.
+static void bench_decompose(std::mt19937_64& rng, size_t n) {
+    printf("decomposing %zu small boxes\n", n);
+    using box = zinc::morton::AABB<2, 32>;
+    std::vector<box> boxes;
+    for (size_t i = 0; i < n; i++) {
+        const uint32_t x = rng() % (1u << 20), y = rng() % (1u << 20);
+        const uint32_t w = 1 + rng() % 32, h = 1 + rng() % 32;
+        boxes.push_back({morton_code<2, 32>::encode({x, y}), morton_code<2, 32>::encode({x + w - 1, y + h - 1})});
+    }
+    size_t intervals = 0;
+    double t = bench::time_best([&] {
+        intervals = 0;
+        for (auto& b : boxes) {
+            intervals += legacy_to_intervals(b).intervals.size();
+        }
+    });
+    bench::report("legacy AABB::to_intervals", intervals, t);
+    size_t check = 0;
+    t = bench::time_best([&] {
+        check = 0;
+        for (auto& b : boxes) {
+            check += b.to_intervals().intervals.size();
+        }
+    });
+    assert(check == intervals);
+    bench::report("AABB::to_intervals", intervals, t);
+    region r;
+    t = bench::time_best([&] {
+        check = 0;
+        for (auto& b : boxes) {
+            r.intervals.clear();
+            b.append_intervals(r);
+            check += r.intervals.size();
+        }
+    });
+    assert(check == intervals);
+    bench::report("AABB::append_intervals, reused region", intervals, t);
+    t = bench::time_best([&] {
+        check = 0;
+        for (auto& b : boxes) {
+            b.for_each_interval([&check](const zinc::morton::detail::interval<2, 32>& i) { check += i.start != i.end + 1; });
+        }
+    });
+    assert(check == intervals);
+    bench::report("AABB::for_each_interval", intervals, t);
+}
+
+// Long thin boxes, exact and within a budget of intervals, and what the budget costs in
+// codes covered outside the boxes.
+static void bench_budget(std::mt19937_64& rng) {
+    printf("thin boxes, exact and within a budget of intervals\n");
+    using box = zinc::morton::AABB<2, 32>;
+    std::vector<box> boxes;
+    uint64_t area = 0;
+    for (size_t i = 0; i < 256; i++) {
+        const uint32_t x = rng() % (1u << 20), y = rng() % (1u << 20);
+        boxes.push_back({morton_code<2, 32>::encode({x, y}), morton_code<2, 32>::encode({x + 4095, y + 1 + static_cast<uint32_t>(rng() % 4)})});
+        area += boxes.back().area();
+    }
+    size_t intervals = 0;
+    double t = bench::time_best([&] {
+        intervals = 0;
+        for (auto& b : boxes) {
+            intervals += b.to_intervals().intervals.size();
+        }
+    });
+    printf("exact: %.1f intervals a box\n", static_cast<double>(intervals) / boxes.size());
+    bench::report("AABB::to_intervals", boxes.size(), t);
+    for (size_t budget : {256, 64, 16}) {
+        uint64_t over = 0;
+        t = bench::time_best([&] {
+            intervals = 0;
+            over = 0;
+            for (auto& b : boxes) {
+                auto c = b.to_intervals(budget);
+                intervals += c.cover.intervals.size();
+                over += c.over_coverage;
+            }
+        });
+        printf("budget %zu: %.1f intervals a box, %.2fx the area\n", budget, static_cast<double>(intervals) / boxes.size(), static_cast<double>(area + over) / area);
+        bench::report(("AABB::to_intervals(" + std::to_string(budget) + ")").c_str(), boxes.size(), t);
+    }
+}
+
+// Boxes of views over one world, turned into a single region: a region for each box folded
+// together, or the intervals of every box sorted and coalesced at once.
+static void bench_from_aabbs(std::mt19937_64& rng, size_t n) {
+    printf("the union of %zu boxes\n", n);
+    using box = zinc::morton::AABB<2, 32>;
+    std::vector<box> boxes;
+    for (size_t i = 0; i < n; i++) {
+        const uint32_t x = rng() % 4096, y = rng() % 4096;
+        boxes.push_back({morton_code<2, 32>::encode({x, y}), morton_code<2, 32>::encode({x + static_cast<uint32_t>(rng() % 64), y + static_cast<uint32_t>(rng() % 64)})});
+    }
+    region expected;
+    double t = bench::time_best([&] {
+        expected = region();
+        for (auto& b : boxes) {
+            expected |= b.to_intervals();
+        }
+    }, 1);
+    bench::report("fold with operator|=", n, t);
+    region r;
+    t = bench::time_best([&] {
+        std::vector<region> regions;
+        regions.reserve(boxes.size());
+        for (auto& b : boxes) {
+            regions.push_back(b.to_intervals());
+        }
+        r = region::union_all(regions);
+    });
+    assert(r == expected);
+    bench::report("region::union_all", n, t);
+    t = bench::time_best([&] { r = zinc::morton::regions_from_aabbs<2, 32>(boxes); });
+    assert(r == expected);
+    bench::report("regions_from_aabbs", n, t);
+}
+
+// The index ranges of the sorted codes inside a box, from its intervals: every interval is
+// searched for, whether or not any code falls in it.
+static void decomposed_query(const std::vector<uint64_t>& codes, const zinc::morton::AABB<2, 32>& box, std::vector<std::pair<size_t, size_t>>& out) {
+    out.clear();
+    region r = box.to_intervals();
+    auto it = codes.begin();
+    for (auto& i : r.intervals) {
+        auto first = std::lower_bound(it, codes.end(), i.start);
+        it = std::upper_bound(first, codes.end(), i.end);
+        const size_t a = static_cast<size_t>(first - codes.begin()), b = static_cast<size_t>(it - codes.begin());
+        if (a == b) {
+            continue;
+        }
+        if (!out.empty() && out.back().second == a) {
+            out.back().second = b;
+        } else {
+            out.push_back({a, b});
+        }
+    }
+}
+
+// Box queries over sorted points, by decomposing each box and searching for its intervals,
+// and by scanning the points with BIGMIN skips.
+static void bench_query_sorted(std::mt19937_64& rng, size_t n) {
+    using box = zinc::morton::AABB<2, 32>;
+    auto run = [&rng, n](const char* name, bool clustered, uint32_t side) {
+        printf("box queries of up to %ux%u over %zu %s points\n", side, side, n, name);
+        std::vector<uint64_t> codes;
+        std::vector<std::array<uint32_t, 2>> centres(64);
+        for (auto& c : centres) {
+            c = {static_cast<uint32_t>(rng() % (1u << 16)), static_cast<uint32_t>(rng() % (1u << 16))};
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (clustered) {
+                // about normal, with a spread of a few hundred around a centre
+                auto& c = centres[rng() % centres.size()];
+                auto offset = [&rng]() { return static_cast<uint32_t>((rng() % 512 + rng() % 512 + rng() % 512 + rng() % 512) / 2); };
+                codes.push_back(morton_code<2, 32>::encode({c[0] + offset(), c[1] + offset()}));
+            } else {
+                codes.push_back(morton_code<2, 32>::encode({static_cast<uint32_t>(rng() % (1u << 17)), static_cast<uint32_t>(rng() % (1u << 17))}));
+            }
+        }
+        std::sort(codes.begin(), codes.end());
+        std::vector<box> boxes;
+        for (size_t i = 0; i < 1000; i++) {
+            // around a point, so the clustered queries land in the clusters
+            auto p = morton_code<2, 32>::decode({codes[rng() % codes.size()]});
+            const uint32_t x = p[0] - std::min<uint32_t>(p[0], side / 2), y = p[1] - std::min<uint32_t>(p[1], side / 2);
+            boxes.push_back({morton_code<2, 32>::encode({x, y}), morton_code<2, 32>::encode({x + static_cast<uint32_t>(rng() % side), y + static_cast<uint32_t>(rng() % side)})});
+        }
+        std::vector<std::pair<size_t, size_t>> ranges;
+        size_t expected = 0;
+        double t = bench::time_best([&] {
+            expected = 0;
+            for (auto& b : boxes) {
+                decomposed_query(codes, b, ranges);
+                for (auto& r : ranges) {
+                    expected += r.second - r.first;
+                }
+            }
+        });
+        bench::report("decompose and search", boxes.size(), t);
+        size_t found = 0;
+        t = bench::time_best([&] {
+            found = 0;
+            for (auto& b : boxes) {
+                for (auto r : zinc::morton::query_sorted(codes, b)) {
+                    found += r.second - r.first;
+                }
+            }
+        });
+        assert(found == expected);
+        bench::report("query_sorted", boxes.size(), t);
+        printf("%.1f points a query\n", static_cast<double>(found) / boxes.size());
+    };
+    run("uniform", false, 256);
+    run("uniform", false, 4096);
+    run("clustered", true, 256);
+    run("clustered", true, 4096);
+}
+
+static void bench_kway(std::mt19937_64& rng, size_t n, size_t k) {
+    printf("merging %zu regions, %zu intervals in total\n", k, n);
+    std::vector<region> regions;
+    for (size_t i = 0; i < k; i++) {
+        // spread each worker's intervals over the same range of the curve
+        regions.push_back(random_region(rng, n / k, 64 * k, 64));
+    }
+    region expected;
+    double t = bench::time_best([&] {
+        expected = regions[0];
+        for (size_t i = 1; i < k; i++) {
+            expected |= regions[i];
+        }
+    }, 1);
+    bench::report("fold with operator|=", n, t);
+    region r;
+    t = bench::time_best([&] { r = region::union_all(regions); });
+    assert(r == expected);
+    bench::report("region::union_all", n, t);
+
+    t = bench::time_best([&] {
+        expected = regions[0];
+        for (size_t i = 1; i < k; i++) {
+            expected &= regions[i];
+        }
+    }, 1);
+    bench::report("fold with operator&=", n, t);
+    t = bench::time_best([&] { r = region::intersect_all(regions); });
+    assert(r == expected);
+    bench::report("region::intersect_all", n, t);
+}
+
+int main(int argc, char** argv) {
+    const size_t n = bench::size_arg(argc, argv, 1 << 20);
+    std::mt19937_64 rng(42);
+    bench_lookup(rng, n);
+    bench_union(rng, n);
+    bench_intersect_subtract(rng, n);
+    bench_lazy(rng, n);
+    bench_cells(rng, n);
+    bench_serialize(rng, n);
+    bench_mapped(rng, n);
+    bench_soa(rng, n);
+    bench_region_simd(rng, n);
+    bench_dimensions(rng);
+    bench_curves(rng);
+    bench_decompose(rng, n / 8);
+    bench_budget(rng);
+    bench_from_aabbs(rng, 1024);
+    bench_query_sorted(rng, n);
+    bench_kway(rng, n, 64);
+    bench_kway(rng, n, 1024);
+    return 0;
+}
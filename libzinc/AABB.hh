@@ -4,27 +4,77 @@
 #include <cassert>
 
 #include <algorithm>
+#include <array>
+#include <limits>
+#include <optional>
 #include <vector>
 #include <tuple>
 #include <variant>
 #include <type_traits>
 
 #include "encoding.hh"
+#include "hilbert.hh"
 #include "region.hh"
+#include "sort.hh"
+#include "span.hh"
 #include <immintrin.h>
 
 namespace zinc {
 
 namespace morton {
 
+// A region holding a box, from the coarsened decompositions, and how many of its codes are
+// outside the box.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+struct covering {
+    region<Dimension, BitsPerDimension> cover;
+    typename morton_code<Dimension, BitsPerDimension>::word_type over_coverage;
+};
+
 template<uint32_t Dimension, uint32_t BitsPerDimension>
 struct AABB {
+    using word_type = typename morton_code<Dimension, BitsPerDimension>::word_type;
     // AABBs can have min = max represent a single interval.
     // That is min and max are inclusive values
     morton_code<Dimension, BitsPerDimension> min, max;
 
     AABB(morton_code<Dimension, BitsPerDimension> _min, morton_code<Dimension, BitsPerDimension> _max): min(_min), max(_max) {};
 
+    // The boxes still to be split, held in place rather than allocated. Each box on it was
+    // split off at a lower bit than the box below it, so there is never more than one for
+    // each bit of the code, as well as the first box.
+    class split_stack {
+        public:
+            split_stack() = default;
+            split_stack(const AABB& first) {
+                push_back(first);
+            }
+
+            bool empty() const {
+                return size == 0;
+            }
+
+            AABB back() const {
+                assert(size > 0);
+                return {boxes[size - 1][0], boxes[size - 1][1]};
+            }
+
+            void pop_back() {
+                assert(size > 0);
+                size--;
+            }
+
+            void push_back(const AABB& a) {
+                assert(size < capacity);
+                boxes[size++] = {a.min, a.max};
+            }
+
+        private:
+            static constexpr size_t capacity = Dimension * BitsPerDimension + 1;
+            std::array<std::array<word_type, 2>, capacity> boxes;
+            size_t size = 0;
+    };
+
     class iterator_intervals {
         public:
             typedef std::input_iterator_tag iterator_category;
@@ -39,7 +89,7 @@ struct AABB {
             value_type curr;
             const AABB &parent_aabb;
 
-            std::vector<AABB> inputs;
+            split_stack inputs;
 
             bool is_end() const {
                 return is_finished;
@@ -83,9 +133,8 @@ struct AABB {
         public:
             bool is_finished;
 
-            iterator_intervals(const AABB &_parent): value({0, 0}), curr({0, 0}), parent_aabb(_parent) {
+            iterator_intervals(const AABB &_parent): value({0, 0}), curr({0, 0}), parent_aabb(_parent), inputs(_parent) {
                 iterator_index = 0;
-                inputs = {_parent};
                 is_finished = false;
                 progress();
             }
@@ -118,6 +167,81 @@ struct AABB {
 
     typedef iterator_intervals iterator;
 
+    // The morton cells of the AABB in order, split off one at a time as they are visited.
+    class iterator_cells {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            typedef morton::detail::interval<Dimension, BitsPerDimension> value_type;
+            typedef ptrdiff_t difference_type;
+            typedef const value_type *pointer;
+            typedef const value_type &reference;
+
+            iterator_cells(): value({0, 0}), is_finished(true) {}
+
+            iterator_cells(const AABB &_parent): value({0, 0}), inputs {_parent}, is_finished(false) {
+                progress();
+            }
+
+            iterator_cells &operator++() {
+                progress();
+                return *this;
+            }
+
+            bool operator==(const iterator_cells &i) const {
+                return is_finished == i.is_finished && (is_finished || value == i.value);
+            }
+
+            bool operator!=(const iterator_cells &i) const {
+                return !(*this == i);
+            }
+
+            reference operator*() const {
+                return value;
+            }
+
+            pointer operator->() const {
+                return &value;
+            }
+
+        private:
+            value_type value;
+            // the boxes still to split, the next one in curve order at the back
+            split_stack inputs;
+            bool is_finished;
+
+            void progress() {
+                while (!inputs.empty()) {
+                    AABB aabb = inputs.back();
+                    inputs.pop_back();
+                    if (aabb.is_morton_aligned()) {
+                        value = aabb.to_cell();
+                        return;
+                    }
+                    auto [litmax, bigmin] = aabb.morton_get_next_address();
+                    AABB first = {aabb.min, litmax};
+                    AABB second = {bigmin, aabb.max};
+                    assert(first.max >= first.min);
+                    assert(second.max >= second.min);
+                    inputs.push_back(second);
+                    inputs.push_back(first);
+                }
+                is_finished = true;
+            }
+    };
+
+    // The box is held by value, so the range outlives a temporary box it came from.
+    struct cell_range {
+        morton_code<Dimension, BitsPerDimension> min, max;
+
+        iterator_cells begin() const {
+            return iterator_cells(AABB{min, max});
+        }
+
+        iterator_cells end() const {
+            return iterator_cells();
+        }
+    };
+
     iterator begin() const {
         return iterator(*this);
     }
@@ -136,19 +260,62 @@ struct AABB {
 
     morton::detail::interval<Dimension, BitsPerDimension> to_cell() const;
 
+    // The number of codes in the box.
+    word_type area() const;
+
     // This generates a list of all morton aligned intervals (morton cells)
     // that are within the AABB
     // it generates them in a sorted order, from lowest interval to highest.
     region<Dimension, BitsPerDimension> to_cells() const;
 
+    // The cells of to_cells, with each one smaller than min_level replaced by the cell of
+    // min_level holding it, so the cover has no cells finer than min_level.
+    covering<Dimension, BitsPerDimension> to_cells(uint32_t min_level) const;
+
+    // The same cells as to_cells, without building a region.
+    cell_range cells() const {
+        assert(max >= min);
+        return {min, max};
+    }
+
     // This generates a list of all contiguous morton intervals (these are not necessarily aligned)
     // that are within the AABB
     // it generates them in a sorted order, from lowest interval to highest.
     region<Dimension, BitsPerDimension> to_intervals() const;
 
+    // A cover of at most max_intervals intervals. The intervals of to_cells(min_level) at
+    // the lowest min_level where there are few enough of them would do; instead those of the
+    // level below are taken, and the smallest gaps between them filled until they fit, which
+    // never covers more.
+    covering<Dimension, BitsPerDimension> to_intervals(size_t max_intervals) const;
+
+    // Calls emit(cell) for each of the cells of to_cells(min_level) in order, and
+    // emit(interval) for each of the intervals they make up, without allocating anything.
+    template<typename Emit>
+    void for_each_cell(Emit&& emit, uint32_t min_level = 0) const;
+
+    template<typename Emit>
+    void for_each_interval(Emit&& emit, uint32_t min_level = 0) const;
+
+    // Adds the box to r, each interval carrying data. When the box comes after r's
+    // intervals, as it does when boxes are added in curve order, its intervals are written
+    // onto the end of r, joining r's last interval if they touch. Otherwise they are merged
+    // in through a per-thread buffer.
+    template<typename T>
+    void append_intervals(region<Dimension, BitsPerDimension, T>& r, const T& data = T{}) const;
+
+    // The same as to_intervals, on the hilbert curve, where a box takes fewer intervals.
+    hilbert_region<Dimension, BitsPerDimension> to_hilbert_intervals() const;
+
     uint64_t get_next_morton_outside(uint64_t m) const;
 
-    uint64_t get_next_morton_inside(uint64_t m) const;
+    // The first code at or after m inside the box, the BIGMIN of Tropf and Herzog, or
+    // std::nullopt if there isn't one.
+    std::optional<word_type> get_next_morton_inside(word_type m) const;
+
+    // The same, as the part from there of the box's cell that holds it, every code of
+    // which is inside the box.
+    std::optional<morton::detail::interval<Dimension, BitsPerDimension>> get_next_cell_inside(word_type m) const;
 
     //morton_get_next_address is complex, read these for more detail
     //https://en.wikipedia.org/wiki/Z-order_curve#Use_with_one-dimensional_data_structures_for_range_searching
@@ -156,17 +323,31 @@ struct AABB {
     //https://raima.com/wp-content/uploads/COTS_embedded_database_solving_dynamic_pois_2012.pdf
     //http://cppedinburgh.uk/slides/201603-zcurves.pdf
     std::pair<morton_code<Dimension, BitsPerDimension>, morton_code<Dimension, BitsPerDimension>> morton_get_next_address();
+
+private:
+    // The same as for_each_cell and for_each_interval, for as long as emit returns true.
+    // They return false if emit stopped them.
+    template<typename Emit>
+    bool walk_cells(Emit&& emit, uint32_t min_level) const;
+
+    template<typename Emit>
+    bool walk_intervals(Emit&& emit, uint32_t min_level) const;
 };
 
 template<uint32_t Dimension, uint32_t BitsPerDimension>
 bool AABB<Dimension, BitsPerDimension>::is_morton_aligned() const {
+    using word_type = typename morton_code<Dimension, BitsPerDimension>::word_type;
     assert(max >= min);
-    uint64_t align_max = min != 0 ? __builtin_ctzll(min) : std::numeric_limits<uint64_t>::max();
-    uint64_t diff = max - min + 1;
-    uint64_t align = __builtin_ctzll(diff);
+    const word_type diff = word_type{max} - min + 1;
+    if (diff == 0) {
+        // the box is every code in the word
+        return true;
+    }
+    uint64_t align_max = min != 0 ? count_trailing_zeros(word_type{min}) : std::numeric_limits<uint64_t>::max();
+    uint64_t align = count_trailing_zeros(diff);
     return
         align / Dimension <= align_max / Dimension &&
-        __builtin_popcountll(diff) == 1 &&
+        (diff & (diff - 1)) == 0 &&
         align % Dimension == 0;
 }
 
@@ -181,25 +362,9 @@ morton::detail::interval<Dimension, BitsPerDimension> AABB<Dimension, BitsPerDim
 // it generates them in a sorted order, from lowest interval to highest.
 template<uint32_t Dimension, uint32_t BitsPerDimension>
 region<Dimension, BitsPerDimension> AABB<Dimension, BitsPerDimension>::to_cells() const {
-    assert(max >= min);
-    std::vector<AABB> inputs {*this};
-    std::vector<morton::detail::interval<Dimension, BitsPerDimension>> outputs;
-    while (!inputs.empty()) {
-        AABB aabb = inputs.back();
-        inputs.pop_back();
-        if (aabb.is_morton_aligned()) {
-            outputs.push_back(aabb.to_cell());
-            continue;
-        }
-        auto [litmax, bigmin] = aabb.morton_get_next_address();
-        AABB first = {aabb.min, litmax};
-        AABB second = {bigmin, aabb.max};
-        assert(first.max >= first.min);
-        assert(second.max >= second.min);
-        inputs.push_back(second);
-        inputs.push_back(first);
-    }
-    return {outputs};
+    region<Dimension, BitsPerDimension> r;
+    for_each_cell([&r](const morton::detail::interval<Dimension, BitsPerDimension>& c) { r.intervals.push_back(c); });
+    return r;
 }
 
 // This generates a list of all contiguous morton intervals (these are not necessarily aligned)
@@ -207,58 +372,278 @@ region<Dimension, BitsPerDimension> AABB<Dimension, BitsPerDimension>::to_cells(
 // it generates them in a sorted order, from lowest interval to highest.
 template<uint32_t Dimension, uint32_t BitsPerDimension>
 region<Dimension, BitsPerDimension> AABB<Dimension, BitsPerDimension>::to_intervals() const {
-    assert(max >= min);
-    std::vector<AABB> inputs {*this};
-    std::vector<morton::detail::interval<Dimension, BitsPerDimension>> outputs;
-    while (!inputs.empty()) {
-        AABB aabb = inputs.back();
-        inputs.pop_back();
-        if (aabb.is_morton_aligned()) {
-            //if the cell generated connects to the previous cell, merge.
-            if (!outputs.empty() && outputs.back().end + 1 == aabb.min) {
-                outputs.back().end = aabb.max;
+    region<Dimension, BitsPerDimension> r;
+    for_each_interval([&r](const morton::detail::interval<Dimension, BitsPerDimension>& i) { r.intervals.push_back(i); });
+    return r;
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+typename AABB<Dimension, BitsPerDimension>::word_type AABB<Dimension, BitsPerDimension>::area() const {
+    const auto lo = morton_code<Dimension, BitsPerDimension>::decode(min);
+    const auto hi = morton_code<Dimension, BitsPerDimension>::decode(max);
+    word_type area = 1;
+    for (uint32_t d = 0; d < Dimension; d++) {
+        assert(hi[d] >= lo[d]);
+        area *= word_type{hi[d] - lo[d]} + 1;
+    }
+    return area;
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+covering<Dimension, BitsPerDimension> AABB<Dimension, BitsPerDimension>::to_cells(uint32_t min_level) const {
+    covering<Dimension, BitsPerDimension> c;
+    for_each_cell([&c](const morton::detail::interval<Dimension, BitsPerDimension>& i) { c.cover.intervals.push_back(i); }, min_level);
+    c.over_coverage = c.cover.area() - area();
+    return c;
+}
+
+// Growing every cell to the next level only widens intervals and joins them up, so the
+// number of intervals never rises with the level. The lowest level in the budget is then
+// binary searched, each try giving up as soon as it goes over. At the level where the two
+// corners share a cell the box is a single one.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+covering<Dimension, BitsPerDimension> AABB<Dimension, BitsPerDimension>::to_intervals(size_t max_intervals) const {
+    assert(max_intervals > 0);
+    auto fits = [this, max_intervals](uint32_t level) {
+        size_t n = 0;
+        return walk_intervals([&n, max_intervals](const morton::detail::interval<Dimension, BitsPerDimension>&) { return ++n <= max_intervals; }, level);
+    };
+    uint32_t lo = 0, hi = static_cast<uint32_t>(get_unifying_level<Dimension, word_type>(min, max));
+    while (lo < hi) {
+        const uint32_t mid = (lo + hi) / 2;
+        if (fits(mid)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    covering<Dimension, BitsPerDimension> c;
+    auto& intervals = c.cover.intervals;
+    for_each_interval([&intervals](const morton::detail::interval<Dimension, BitsPerDimension>& i) { intervals.push_back(i); }, lo == 0 ? 0 : lo - 1);
+    if (intervals.size() > max_intervals) {
+        // keep the max_intervals - 1 widest gaps, and fill the rest
+        std::vector<std::pair<word_type, size_t>> gaps;
+        gaps.reserve(intervals.size() - 1);
+        for (size_t i = 1; i < intervals.size(); i++) {
+            gaps.push_back({intervals[i].start - intervals[i - 1].end, i});
+        }
+        auto kept = gaps.end() - static_cast<ptrdiff_t>(max_intervals - 1);
+        std::nth_element(gaps.begin(), kept, gaps.end());
+        std::vector<bool> filled(intervals.size(), false);
+        for (auto it = gaps.begin(); it != kept; ++it) {
+            filled[it->second] = true;
+        }
+        size_t out = 0;
+        for (size_t i = 1; i < intervals.size(); i++) {
+            if (filled[i]) {
+                intervals[out].end = intervals[i].end;
             } else {
-                outputs.push_back(aabb.to_cell());
+                intervals[++out] = intervals[i];
             }
+        }
+        intervals.erase(intervals.begin() + static_cast<ptrdiff_t>(out + 1), intervals.end());
+    }
+    assert(intervals.size() <= max_intervals);
+    c.over_coverage = c.cover.area() - area();
+    return c;
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+template<typename Emit>
+void AABB<Dimension, BitsPerDimension>::for_each_cell(Emit&& emit, uint32_t min_level) const {
+    walk_cells([&emit](const morton::detail::interval<Dimension, BitsPerDimension>& c) {
+        emit(c);
+        return true;
+    }, min_level);
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+template<typename Emit>
+void AABB<Dimension, BitsPerDimension>::for_each_interval(Emit&& emit, uint32_t min_level) const {
+    walk_intervals([&emit](const morton::detail::interval<Dimension, BitsPerDimension>& i) {
+        emit(i);
+        return true;
+    }, min_level);
+}
+
+// The box is split until each piece is a cell, or fits in a cell of min_level. The first
+// half of each split is carried on with at once, and only the second half goes on the
+// stack. Each split separates cells of at least min_level, so no two pieces are grown into
+// the same cell.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+template<typename Emit>
+bool AABB<Dimension, BitsPerDimension>::walk_cells(Emit&& emit, uint32_t min_level) const {
+    assert(max >= min);
+    assert(min_level <= BitsPerDimension);
+    split_stack inputs;
+    AABB aabb = *this;
+    while (true) {
+        bool whole = aabb.is_morton_aligned();
+        if (min_level > 0 && get_unifying_level<Dimension, word_type>(aabb.min, aabb.max) <= min_level) {
+            aabb.min = get_parent_morton_aligned<Dimension, word_type>(aabb.min, min_level);
+            aabb.max = aabb.min | get_morton_code<Dimension, word_type>(min_level);
+            whole = true;
+        }
+        if (whole) {
+            if (!emit(aabb.to_cell())) {
+                return false;
+            }
+            if (inputs.empty()) {
+                return true;
+            }
+            aabb = inputs.back();
+            inputs.pop_back();
             continue;
         }
         auto [litmax, bigmin] = aabb.morton_get_next_address();
-        AABB first = {aabb.min, litmax};
-        AABB second = {bigmin, aabb.max};
-        assert(first.max >= first.min);
-        assert(second.max >= second.min);
-        inputs.push_back(second);
-        inputs.push_back(first);
+        assert(litmax >= aabb.min && aabb.max >= bigmin);
+        inputs.push_back({bigmin, aabb.max});
+        aabb.max = litmax;
+    }
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+template<typename Emit>
+bool AABB<Dimension, BitsPerDimension>::walk_intervals(Emit&& emit, uint32_t min_level) const {
+    // the cells so far that touch, which a cell that doesn't touch them ends
+    morton::detail::interval<Dimension, BitsPerDimension> pending = {min, min};
+    bool first = true;
+    const bool finished = walk_cells([&](const morton::detail::interval<Dimension, BitsPerDimension>& c) {
+        if (!first && pending.end + 1 == c.start) {
+            pending.end = c.end;
+            return true;
+        }
+        const bool more = first || emit(pending);
+        pending = c;
+        first = false;
+        return more;
+    }, min_level);
+    return finished && emit(pending);
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+template<typename T>
+void AABB<Dimension, BitsPerDimension>::append_intervals(region<Dimension, BitsPerDimension, T>& r, const T& data) const {
+    using interval_type = typename region<Dimension, BitsPerDimension, T>::interval_type;
+    if (r.intervals.empty() || r.intervals.back().end < min) {
+        for_each_interval([&r, &data](const morton::detail::interval<Dimension, BitsPerDimension>& i) {
+            interval_type x {i.start, i.end, data};
+            if (!r.intervals.empty() && morton::detail::can_coalesce(r.intervals.back(), x)) {
+                r.intervals.back().end = x.end;
+            } else {
+                r.intervals.push_back(x);
+            }
+        });
+        return;
     }
-    return {outputs};
+    static thread_local region<Dimension, BitsPerDimension, T> scratch;
+    scratch.intervals.clear();
+    for_each_interval([&data](const morton::detail::interval<Dimension, BitsPerDimension>& i) {
+        scratch.intervals.push_back({i.start, i.end, data});
+    });
+    r |= scratch;
+}
+
+// The smallest cell holding the whole box is found from the morton codes of its corners,
+// and the machine run down to it, then the cells below it are split in curve order.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+hilbert_region<Dimension, BitsPerDimension> AABB<Dimension, BitsPerDimension>::to_hilbert_intervals() const {
+    using word_type = typename hilbert_code<Dimension, BitsPerDimension>::word_type;
+    assert(max >= min);
+    hilbert_region<Dimension, BitsPerDimension> r;
+    auto emit = [&r](word_type start, word_type end) {
+        if (!r.intervals.empty() && r.intervals.back().end + 1 == start) {
+            r.intervals.back().end = end;
+        } else {
+            r.intervals.push_back({start, end});
+        }
+    };
+    if (is_morton_aligned()) {
+        // a single cell, on both curves, though the hilbert curve may enter it at any corner,
+        // so its first code is min's with the bits below the cell cleared
+        const word_type start = hilbert_code<Dimension, BitsPerDimension>::from_morton(min).data & ~word_type{max - min};
+        emit(start, start + (max - min));
+        return r;
+    }
+    const uint32_t level = static_cast<uint32_t>(fast_log2(word_type{min} ^ max) / Dimension) + 1;
+    morton::detail::hilbert_state s {0, 0};
+    word_type start = 0;
+    for (uint32_t l = BitsPerDimension; l-- > level;) {
+        const auto bits = static_cast<uint32_t>((word_type{min} >> (l * Dimension)) & ((word_type{1} << Dimension) - 1));
+        start |= word_type{morton::detail::hilbert_encode_level<Dimension>(s, bits)} << (l * Dimension);
+    }
+    auto lo = morton_code<Dimension, BitsPerDimension>::decode(min);
+    auto hi = morton_code<Dimension, BitsPerDimension>::decode(max);
+    auto corner = lo;
+    for (auto& c : corner) {
+        c = level < BitsPerDimension ? (c >> level) << level : 0;
+    }
+    morton::detail::hilbert_cover<Dimension>(lo, hi, corner, level, s, start, emit);
+    return r;
 }
 
 template<uint32_t Dimension, uint32_t BitsPerDimension>
 uint64_t AABB<Dimension, BitsPerDimension>::get_next_morton_outside(uint64_t m) const {
-    uint64_t min_x, min_y, max_x, max_y, x, y;
-    auto pack = morton_code<Dimension, BitsPerDimension>::decode({min});
-    min_x = pack[0];
-    min_y = pack[1];
-    pack = morton_code<Dimension, BitsPerDimension>::decode({max});
-    max_x = pack[0];
-    max_y = pack[1];
-    pack = morton_code<Dimension, BitsPerDimension>::decode({m});
-    x = pack[0];
-    y = pack[1];
-    assert(x == min_x || y == min_y);
-    max_x += 1;
-    max_y += 1;
-    min_x = std::min(min_x, (uint64_t)(1LLU << 63));
-    min_y = std::min(min_y, (uint64_t)(1LLU << 63));
-    uint64_t l = std::min({__builtin_ctzll(min_x), __builtin_ctzll(min_y), __builtin_ctzll(max_x), __builtin_ctzll(max_x)}) * Dimension;
+    auto lo = morton_code<Dimension, BitsPerDimension>::decode({min});
+    auto hi = morton_code<Dimension, BitsPerDimension>::decode({max});
+    auto p = morton_code<Dimension, BitsPerDimension>::decode({m});
+    // m is on one of the faces through min
+    assert(([&] {
+        for (size_t d = 0; d < Dimension; d++) {
+            if (p[d] == lo[d]) {
+                return true;
+            }
+        }
+        return false;
+    }()));
+    // the largest cells that the faces of the box are aligned to
+    uint64_t l = BitsPerDimension;
+    for (size_t d = 0; d < Dimension; d++) {
+        if (lo[d] != 0) {
+            l = std::min<uint64_t>(l, __builtin_ctzll(lo[d]));
+        }
+        l = std::min<uint64_t>(l, __builtin_ctzll(uint64_t{hi[d]} + 1));
+    }
+    l *= Dimension;
+    if (l >= 64) {
+        return 0;
+    }
     m = (m >> l) << l;
     m = m + (1LLU << l);
     return m;
 }
 
 template<uint32_t Dimension, uint32_t BitsPerDimension>
-uint64_t AABB<Dimension, BitsPerDimension>::get_next_morton_inside(uint64_t m) const {
-    return 0;
+std::optional<typename AABB<Dimension, BitsPerDimension>::word_type> AABB<Dimension, BitsPerDimension>::get_next_morton_inside(word_type m) const {
+    auto cell = get_next_cell_inside(m);
+    if (!cell) {
+        return std::nullopt;
+    }
+    return word_type{cell->start};
+}
+
+// The box is split as in to_cells, following the half that holds the first code inside
+// at or after m, until that half is a cell. m is never past the end of the half followed,
+// and when it falls in the gap between the halves it moves up to bigmin, so nothing needs
+// to be undone.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+std::optional<morton::detail::interval<Dimension, BitsPerDimension>> AABB<Dimension, BitsPerDimension>::get_next_cell_inside(word_type m) const {
+    if (m > max) {
+        return std::nullopt;
+    }
+    AABB box = *this;
+    while (true) {
+        m = std::max<word_type>(m, box.min);
+        if (box.is_morton_aligned()) {
+            return morton::detail::interval<Dimension, BitsPerDimension>{m, box.max};
+        }
+        auto [litmax, bigmin] = box.morton_get_next_address();
+        if (m <= litmax) {
+            box.max = litmax;
+        } else {
+            box.min = bigmin;
+        }
+    }
 }
 
 //morton_get_next_address is complex, read these for more detail
@@ -268,23 +653,44 @@ uint64_t AABB<Dimension, BitsPerDimension>::get_next_morton_inside(uint64_t m) c
 //http://cppedinburgh.uk/slides/201603-zcurves.pdf
 template<uint32_t Dimension, uint32_t BitsPerDimension>
 std::pair<morton_code<Dimension, BitsPerDimension>, morton_code<Dimension, BitsPerDimension>> AABB<Dimension, BitsPerDimension>::morton_get_next_address() {
-    static_assert(Dimension == 2, "this needs more care to convert to 3D");
-    uint64_t litmax = max;
-    uint64_t bigmin = min;
-    uint64_t index = 65 - __builtin_clzll(min ^ max);
-    uint64_t mask = ~((1LLU << (index / 2)) - 1);
-    uint64_t inc = 1LLU << ((index / 2) - 1);
-    index %= 2;
-
-    uint32_t part = (compact_bits_2(min >> index) & mask) + inc;
-    bigmin &= ~(__morton_2_x_mask << index);
-    bigmin |= expand_bits_2((uint64_t)part) << index;
-
-    part -= 1;
-    litmax &= ~(__morton_2_x_mask << index);
-    litmax |= expand_bits_2((uint64_t)part) << index;
-
-    return std::pair<morton_code<Dimension, BitsPerDimension>, morton_code<Dimension, BitsPerDimension>>({litmax}, {bigmin});
+    // the highest bit where min and max differ belongs to one coordinate, which is where
+    // the box is cut in two: litmax keeps that coordinate's bits above the cut and sets the
+    // ones below it, and bigmin sets the cut bit and clears the ones below it. The bits
+    // above the cut are the same in min and max.
+    using code_type = morton_code<Dimension, BitsPerDimension>;
+    using word_type = typename code_type::word_type;
+    const uint64_t highest = fast_log2(word_type{min} ^ max);
+    const word_type cut = word_type{1} << highest;
+    const word_type below = (morton_x_mask<Dimension, word_type>() << (highest % Dimension)) & (cut - 1);
+
+    word_type bigmin = (min & ~below) | cut;
+    word_type litmax = (max & ~cut) | below;
+
+    return std::pair<code_type, code_type>({litmax}, {bigmin});
+}
+
+// The union of many boxes, built in one go: the intervals of every box are gathered, radix
+// sorted on start and coalesced in a single pass, with no region for each box and no unions
+// between them. Each box's intervals are already in order, so boxes given in curve order
+// skip the sort.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+static region<Dimension, BitsPerDimension> regions_from_aabbs(zinc::span<const AABB<Dimension, BitsPerDimension>> boxes) {
+    using interval_type = morton::detail::interval<Dimension, BitsPerDimension>;
+    using word_type = typename interval_type::word_type;
+    region<Dimension, BitsPerDimension> r;
+    auto& v = r.intervals;
+    bool sorted = true;
+    for (auto& b : boxes) {
+        b.for_each_interval([&v, &sorted](const interval_type& i) {
+            sorted = sorted && (v.empty() || v.back().start <= i.start);
+            v.push_back(i);
+        });
+    }
+    if (!sorted) {
+        zinc::radix_sort(v, [](const interval_type& i) { return word_type{i.start}; }, detail::scratch_intervals<interval_type>());
+    }
+    v.erase(detail::merge_union(v.begin(), v.end(), v.end(), v.end(), v.begin()), v.end());
+    return r;
 }
 
 } //::morton
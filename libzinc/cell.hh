@@ -1,35 +1,42 @@
 #pragma once
 
 #include <cstdint>
+#include <cassert>
 
 #include "AABB.hh"
 
 //The coordinate of an octree cell.
+template<uint32_t Dimension = 2, uint32_t BitsPerDimension = 32>
 struct tree_cell {
-    uint64_t code;
+    using word_type = typename morton_code<Dimension, BitsPerDimension>::word_type;
+    word_type code;
     uint64_t level;
 
     void fix_code() {
-        uint64_t dimension = 2;
-        code = (code >> (dimension * level)) << (dimension * level);
+        code = zinc::morton::get_parent_morton_aligned<Dimension, word_type>(code, level);
     };
 
-    bool check_overlap(uint64_t dim, tree_cell y) const {
+    bool check_overlap(tree_cell y) const {
         uint64_t l = (level > y.level) ? level : y.level;
-        return (code >> (dim * l)) == (y.code >> (dim * l));
+        return zinc::morton::get_parent_morton_aligned<Dimension, word_type>(code, l) == zinc::morton::get_parent_morton_aligned<Dimension, word_type>(y.code, l);
+    }
+
+    // The form from before tree_cell knew its dimension, which dim must match.
+    bool check_overlap(uint64_t dim, tree_cell y) const {
+        assert(dim == Dimension);
+        return check_overlap(y);
     }
 
-    template<uint32_t Dimension, uint32_t BitsPerDimension>
     bool contains(const morton_code<Dimension, BitsPerDimension> c) const {
-        return (c.data >> (level * c.dimension)) == (c.data >> (level * c.dimension));
+        return zinc::morton::get_parent_morton_aligned<Dimension, word_type>(c.data, level) == code;
     }
 
-    zinc::morton::region<2,32> region() const {
-    	return {{{code, code + (1 << (level * 2)) - 1}}};
+    zinc::morton::region<Dimension, BitsPerDimension> region() const {
+        return zinc::morton::cell_to_region<Dimension, BitsPerDimension>(code, level, std::monostate{});
     }
 
     template<typename T>
-    zinc::morton::region<2,32, T> region(T data) const {
-        return {{{code, code + (1 << (level * 2)) - 1}, data}};
+    zinc::morton::region<Dimension, BitsPerDimension, T> region(T data) const {
+        return zinc::morton::cell_to_region<Dimension, BitsPerDimension>(code, level, data);
     }
 };
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cpuid.h>
+
+namespace zinc {
+
+namespace cpu {
+
+// The instruction set extensions that kernels can be specialised for.
+// Kernels are compiled with target attributes and picked at runtime,
+// so a single binary runs on every x86-64 machine.
+enum class isa {
+    scalar,
+    avx2,
+    avx512,
+};
+
+static inline const char* isa_name(isa i) {
+    switch (i) {
+        case isa::scalar: return "scalar";
+        case isa::avx2: return "avx2";
+        case isa::avx512: return "avx512";
+    }
+    return "unknown";
+}
+
+static inline bool supports(isa i) {
+    __builtin_cpu_init();
+    switch (i) {
+        case isa::scalar: return true;
+        case isa::avx2: return __builtin_cpu_supports("avx2");
+        case isa::avx512: return __builtin_cpu_supports("avx512f");
+    }
+    return false;
+}
+
+// The widest instruction set available on this machine, detected once.
+static inline isa best_isa() {
+    static const isa best =
+          supports(isa::avx512) ? isa::avx512
+        : supports(isa::avx2) ? isa::avx2
+        : isa::scalar;
+    return best;
+}
+
+// The ways of spreading the bits of a coordinate out into a Morton code and gathering
+// them back in, see expand_bits in util.hh: magic bits shifts and masks, lookup tables
+// to expand with magic bits to compact, or pdep and pext. magic is first so that it is
+// what a zero initialised choice means, as it runs everywhere.
+enum class interleave {
+    magic,
+    lut,
+    bmi2,
+};
+
+static inline const char* interleave_name(interleave i) {
+    switch (i) {
+        case interleave::magic: return "magic bits";
+        case interleave::lut: return "lookup table";
+        case interleave::bmi2: return "bmi2";
+    }
+    return "unknown";
+}
+
+static inline bool supports(interleave i) {
+    __builtin_cpu_init();
+    switch (i) {
+        case interleave::magic: return true;
+        case interleave::lut: return true;
+        case interleave::bmi2: return __builtin_cpu_supports("bmi2");
+    }
+    return false;
+}
+
+// Whether pdep and pext are microcoded, as they are on AMD processors before Zen 3
+// (family 0x19), where they take hundreds of cycles on some inputs. Hygon's processors
+// (family 0x18) are built on Zen 1, and microcode them too.
+static inline bool slow_pdep() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    // "AuthenticAMD" and "HygonGenuine", in the order cpuid gives them
+    const bool amd = ebx == 0x68747541 && edx == 0x69746e65 && ecx == 0x444d4163;
+    const bool hygon = ebx == 0x6f677948 && edx == 0x6e65476e && ecx == 0x656e6975;
+    if (!(amd || hygon) || !__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    unsigned int family = (eax >> 8) & 0xf;
+    if (family == 0xf) {
+        family += (eax >> 20) & 0xff;
+    }
+    return family < 0x19;
+}
+
+// The fastest way to interleave on this machine, detected once: pdep and pext where they
+// are fast, and otherwise lookup tables.
+static inline interleave best_interleave() {
+    static const interleave best = supports(interleave::bmi2) && !slow_pdep() ? interleave::bmi2 : interleave::lut;
+    return best;
+}
+
+} //::cpu
+
+} //::zinc
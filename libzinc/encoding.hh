@@ -5,27 +5,108 @@
 #include <immintrin.h>
 #include <array>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include "util.hh"
+#include "span.hh"
+#include "simd.hh"
 
+using zinc::morton::__morton_2_x_mask;
+using zinc::morton::__morton_2_y_mask;
+using zinc::morton::expand_bits_as;
+using zinc::morton::compact_bits_as;
+using zinc::morton::with_interleave;
+
+// Codes of any Dimension and BitsPerDimension, up to 64 bits per coordinate and 128 bits
+// in all. Codes of up to 64 bits are a uint64_t, and the rest 128 bits, with the low
+// 64 / Dimension bits of every coordinate interleaved into the low bits of the code and the
+// rest above them, so each part is a single word expand or compact. The masks and the
+// magic bits steps are all worked out at compile time from Dimension and BitsPerDimension,
+// and encode and decode are compiled for each way of interleaving, choosing one per call.
 template<uint32_t Dimension, uint32_t BitsPerDimension>
 struct morton_code {
-    static_assert((Dimension == 2 && BitsPerDimension == 32) || (Dimension == 3 && BitsPerDimension == 21),
-        "only 2D and 32 bits, or 3D and 21 bits are currently supported.");
-};
+    static_assert(Dimension >= 1 && BitsPerDimension >= 1 && BitsPerDimension <= 64 && Dimension * BitsPerDimension <= 128,
+        "a morton code holds at most 64 bits per dimension, and 128 bits in all");
+    static constexpr bool is_wide = Dimension * BitsPerDimension > 64;
+    using word_type = typename std::conditional<is_wide, zinc::morton::uint128_t, uint64_t>::type;
+    using coordinate_type = typename std::conditional<BitsPerDimension <= 32, uint32_t, uint64_t>::type;
+    word_type data;
+    static constexpr uint32_t dimension = Dimension;
+    static constexpr uint32_t max_level = BitsPerDimension;
+    // the bits of each coordinate in the low word of the code
+    static constexpr uint32_t low_bits = is_wide ? 64 / Dimension : BitsPerDimension;
+    static constexpr uint32_t high_bits = BitsPerDimension - low_bits;
+    operator word_type() const {
+        return data;
+    }
+    morton_code(word_type _data): data(_data) {};
+    static morton_code encode(std::array<coordinate_type, Dimension> p) {
+        return {with_interleave([&p](auto as) { return encode_each<decltype(as)::value>(p, std::make_index_sequence<Dimension>{}); })};
+    }
+    static std::array<coordinate_type, Dimension> decode(const morton_code code) {
+        return with_interleave([code](auto as) { return decode_each<decltype(as)::value>(code.data, std::make_index_sequence<Dimension>{}); });
+    }
+    // The bits of each coordinate in a code.
+    static constexpr std::array<word_type, Dimension> make_coordinate_masks() {
+        std::array<word_type, Dimension> masks {};
+        for (uint32_t d = 0; d < Dimension; d++) {
+            for (uint32_t bit = 0; bit < BitsPerDimension; bit++) {
+                masks[d] |= word_type{1} << (bit * Dimension + d);
+            }
+        }
+        return masks;
+    }
+    static constexpr std::array<word_type, Dimension> coordinate_masks = make_coordinate_masks();
+    // Adds or subtracts each coordinate on its own, wrapping within its bits: the bits of the
+    // other coordinates are set to carry across them, or cleared to borrow across them.
+    friend void operator+=(morton_code& lhs, const morton_code& rhs) {
+        lhs.data = add_each(lhs.data, rhs.data, std::make_index_sequence<Dimension>{});
+    }
 
-using zinc::morton::__morton_2_x_mask;
-using zinc::morton::__morton_2_y_mask;
-using zinc::morton::__morton_3_x_mask;
-using zinc::morton::__morton_3_y_mask;
-using zinc::morton::__morton_3_z_mask;
-using zinc::morton::expand_bits_2;
-using zinc::morton::compact_bits_2;
-using zinc::morton::expand_bits_3;
-using zinc::morton::compact_bits_3;
+    friend void operator-=(morton_code& lhs, const morton_code& rhs) {
+        lhs.data = subtract_each(lhs.data, rhs.data, std::make_index_sequence<Dimension>{});
+    }
+
+private:
+    // each of these works on every coordinate with a fold, so the coordinates are unrolled
+    template<zinc::cpu::interleave How, size_t... D>
+    static word_type encode_each(const std::array<coordinate_type, Dimension>& p, std::index_sequence<D...>) {
+        const uint64_t low = (... | (expand_bits_as<How, Dimension, low_bits>(p[D]) << D));
+        if constexpr (is_wide) {
+            const uint64_t high = (... | (expand_bits_as<How, Dimension, high_bits>(p[D] >> low_bits) << D));
+            return (word_type{high} << (low_bits * Dimension)) | low;
+        } else {
+            return low;
+        }
+    }
+
+    template<zinc::cpu::interleave How, size_t... D>
+    static std::array<coordinate_type, Dimension> decode_each(const word_type data, std::index_sequence<D...>) {
+        if constexpr (is_wide) {
+            const uint64_t low = static_cast<uint64_t>(data & ((word_type{1} << (low_bits * Dimension)) - 1));
+            const uint64_t high = static_cast<uint64_t>(data >> (low_bits * Dimension));
+            return {static_cast<coordinate_type>(compact_bits_as<How, Dimension, low_bits>(low >> D) | (compact_bits_as<How, Dimension, high_bits>(high >> D) << low_bits))...};
+        } else {
+            return {static_cast<coordinate_type>(compact_bits_as<How, Dimension, low_bits>(data >> D))...};
+        }
+    }
+
+    template<size_t... D>
+    static word_type add_each(const word_type lhs, const word_type rhs, std::index_sequence<D...>) {
+        return (... | (((lhs | ~coordinate_masks[D]) + (rhs & coordinate_masks[D])) & coordinate_masks[D]));
+    }
+
+    template<size_t... D>
+    static word_type subtract_each(const word_type lhs, const word_type rhs, std::index_sequence<D...>) {
+        return (... | (((lhs & coordinate_masks[D]) - (rhs & coordinate_masks[D])) & coordinate_masks[D]));
+    }
+};
 
 template<>
 struct morton_code<2, 32> {
+    using word_type = uint64_t;
+    using coordinate_type = uint32_t;
     uint64_t data;
     static constexpr uint32_t dimension = 2;
     static constexpr uint32_t max_level = 32;
@@ -34,16 +115,53 @@ struct morton_code<2, 32> {
     }
     morton_code<2, 32>(uint64_t _data): data(_data) {};
     static morton_code<2, 32> encode(std::array<uint32_t, 2> p) {
-        return {
-            (expand_bits_2<uint64_t>(std::get<0>(p)) << 0) |
-            (expand_bits_2<uint64_t>(std::get<1>(p)) << 1)
-        };
+        return {with_interleave([&p](auto as) {
+            constexpr auto how = decltype(as)::value;
+            return
+                (expand_bits_as<how, 2, 32>(std::get<0>(p)) << 0) |
+                (expand_bits_as<how, 2, 32>(std::get<1>(p)) << 1);
+        })};
     }
     static std::array<uint32_t, 2> decode(const struct morton_code<2, 32> code) {
-        return {
-            static_cast<uint32_t>(compact_bits_2<uint64_t>(code.data >> 0)),
-            static_cast<uint32_t>(compact_bits_2<uint64_t>(code.data >> 1)),
-        };
+        return with_interleave([code](auto as) {
+            constexpr auto how = decltype(as)::value;
+            return std::array<uint32_t, 2> {
+                static_cast<uint32_t>(compact_bits_as<how, 2, 32>(code.data >> 0)),
+                static_cast<uint32_t>(compact_bits_as<how, 2, 32>(code.data >> 1)),
+            };
+        });
+    }
+    // Encodes xs[i], ys[i] into out[i] for every point, using the widest SIMD kernel
+    // available unless one is given. The scalar encode above handles any tail.
+    static void encode_batch(zinc::span<const uint32_t> xs, zinc::span<const uint32_t> ys, zinc::span<uint64_t> out,
+                             zinc::cpu::isa isa = zinc::cpu::best_isa()) {
+        assert(xs.size() == ys.size() && xs.size() == out.size());
+        assert(zinc::cpu::supports(isa));
+        size_t i = 0;
+        switch (isa) {
+            case zinc::cpu::isa::avx512: i = zinc::morton::simd::encode_2_avx512(xs.data(), ys.data(), out.data(), out.size()); break;
+            case zinc::cpu::isa::avx2: i = zinc::morton::simd::encode_2_avx2(xs.data(), ys.data(), out.data(), out.size()); break;
+            case zinc::cpu::isa::scalar: break;
+        }
+        for (; i < out.size(); i++) {
+            out[i] = encode({xs[i], ys[i]}).data;
+        }
+    }
+    static void decode_batch(zinc::span<const uint64_t> codes, zinc::span<uint32_t> xs, zinc::span<uint32_t> ys,
+                             zinc::cpu::isa isa = zinc::cpu::best_isa()) {
+        assert(xs.size() == ys.size() && xs.size() == codes.size());
+        assert(zinc::cpu::supports(isa));
+        size_t i = 0;
+        switch (isa) {
+            case zinc::cpu::isa::avx512: i = zinc::morton::simd::decode_2_avx512(codes.data(), xs.data(), ys.data(), codes.size()); break;
+            case zinc::cpu::isa::avx2: i = zinc::morton::simd::decode_2_avx2(codes.data(), xs.data(), ys.data(), codes.size()); break;
+            case zinc::cpu::isa::scalar: break;
+        }
+        for (; i < codes.size(); i++) {
+            auto p = decode({codes[i]});
+            xs[i] = p[0];
+            ys[i] = p[1];
+        }
     }
     friend void operator-=(morton_code<2, 32>& lhs, const morton_code<2, 32>& rhs) {
         uint64_t x = (lhs.data & __morton_2_x_mask) - (rhs.data & __morton_2_x_mask);
@@ -58,37 +176,17 @@ struct morton_code<2, 32> {
     }
 };
 
-template<>
-struct morton_code<3, 21> {
-    uint64_t data;
-    static constexpr uint32_t dimension = 3;
-    static constexpr uint32_t max_level = 21;
-
-    static morton_code<3, 21> encode(std::array<uint32_t, 3> p) {
-        return {
-            (expand_bits_2<uint64_t>(std::get<0>(p)) << 0) |
-            (expand_bits_2<uint64_t>(std::get<1>(p)) << 1) |
-            (expand_bits_2<uint64_t>(std::get<2>(p)) << 2)
-        };
-    }
-    static std::array<uint32_t, 3> decode(const struct morton_code<3, 21> code) {
-        return {
-            static_cast<uint32_t>(compact_bits_2<uint64_t>(code.data >> 0)),
-            static_cast<uint32_t>(compact_bits_2<uint64_t>(code.data >> 1)),
-            static_cast<uint32_t>(compact_bits_2<uint64_t>(code.data >> 2)),
-        };
-    }
-    friend void operator+=(morton_code<3, 21>& lhs, const morton_code<3, 21>& rhs) {
-        uint64_t x = (lhs.data | ~__morton_3_x_mask) + (rhs.data & __morton_3_x_mask);
-        uint64_t y = (lhs.data | ~__morton_3_y_mask) + (rhs.data & __morton_3_y_mask);
-        uint64_t z = (lhs.data | ~__morton_3_z_mask) + (rhs.data & __morton_3_z_mask);
-        lhs.data = (x & __morton_3_x_mask) | (y & __morton_3_y_mask) | (z & __morton_3_z_mask);
-    }
-
-    friend void operator-=(morton_code<3, 21>& lhs, const morton_code<3, 21>& rhs) {
-        uint64_t x = (lhs.data & __morton_3_x_mask) - (rhs.data & __morton_3_x_mask);
-        uint64_t y = (lhs.data & __morton_3_y_mask) - (rhs.data & __morton_3_y_mask);
-        uint64_t z = (lhs.data & __morton_3_z_mask) - (rhs.data & __morton_3_z_mask);
-        lhs.data = (x & __morton_3_x_mask) | (y & __morton_3_y_mask) | (z & __morton_3_z_mask);
-    }
+namespace zinc {
+
+namespace morton {
+
+// The curves that intervals and regions are ordered on, each naming its code type.
+// hilbert_curve is in hilbert.hh.
+struct morton_curve {
+    template<uint32_t Dimension, uint32_t BitsPerDimension>
+    using code = morton_code<Dimension, BitsPerDimension>;
 };
+
+} //::morton
+
+} //::zinc
@@ -0,0 +1,504 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "region.hh"
+
+namespace zinc {
+
+namespace morton {
+
+// Lazy set operations on regions.
+//
+// lazy(r) wraps a region so that |, &, - and ^ build an expression instead of a region.
+// Evaluating the expression streams every operand through one fused merge, so
+// (lazy(a) | b) & (c - d) makes no intermediate regions. An expression is evaluated
+// when it is converted to a region, or consumed directly by area(), empty(),
+// intersects() or iteration.
+//
+// Operands that are regions are held by reference, unless they are temporaries, which
+// are moved into the expression. The referenced regions must outlive the expression.
+
+namespace lazy_detail {
+
+struct expression_tag {};
+
+template<typename X>
+using is_expression = std::is_base_of<expression_tag, typename std::decay<X>::type>;
+
+template<typename X>
+struct is_region : std::false_type {};
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+struct is_region<region<Dimension, BitsPerDimension, T>> : std::true_type {};
+
+template<typename Interval>
+struct region_of;
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+struct region_of<detail::interval<Dimension, BitsPerDimension, T>> {
+    using type = region<Dimension, BitsPerDimension, T>;
+};
+
+// The operations common to every expression, which provides cursor(): an object whose
+// next(interval&) yields the result's intervals in order, then returns false.
+template<typename Derived, typename Interval>
+struct expression : expression_tag {
+    using interval_type = Interval;
+    using region_type = typename region_of<Interval>::type;
+
+    region_type eval() const {
+        region_type r;
+        auto c = self().cursor();
+        interval_type x {0, 0};
+        while (c.next(x)) {
+            r.intervals.push_back(x);
+        }
+        return r;
+    }
+
+    operator region_type() const {
+        return eval();
+    }
+
+    typename interval_type::word_type area() const {
+        typename interval_type::word_type a = 0;
+        auto c = self().cursor();
+        interval_type x {0, 0};
+        while (c.next(x)) {
+            a += x.area();
+        }
+        return a;
+    }
+
+    // this stops at the first interval of the result
+    bool empty() const {
+        interval_type x {0, 0};
+        return !self().cursor().next(x);
+    }
+
+    class iterator {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            typedef interval_type value_type;
+            typedef ptrdiff_t difference_type;
+            typedef const value_type *pointer;
+            typedef const value_type &reference;
+
+            iterator(): value({0, 0}) {}
+            iterator(const Derived& e): c(e.cursor()), value({0, 0}) {
+                ++*this;
+            }
+
+            iterator &operator++() {
+                if (!c->next(value)) {
+                    c.reset();
+                }
+                return *this;
+            }
+
+            // only an exhausted iterator compares equal to end()
+            bool operator==(const iterator &i) const {
+                return !c && !i.c;
+            }
+
+            bool operator!=(const iterator &i) const {
+                return !(*this == i);
+            }
+
+            reference operator*() const {
+                return value;
+            }
+
+            pointer operator->() const {
+                return &value;
+            }
+
+        private:
+            std::optional<decltype(std::declval<const Derived&>().cursor())> c;
+            value_type value;
+    };
+
+    iterator begin() const {
+        return iterator(self());
+    }
+
+    iterator end() const {
+        return iterator();
+    }
+
+    template<typename R>
+    bool intersects(R&& rhs) const;
+
+private:
+    const Derived& self() const {
+        return static_cast<const Derived&>(*this);
+    }
+};
+
+// A region as an operand, either referenced or owned.
+template<typename Region, bool Owned>
+struct leaf : expression<leaf<Region, Owned>, typename Region::interval_type> {
+    using interval_type = typename Region::interval_type;
+    typename std::conditional<Owned, Region, const Region&>::type r;
+
+    struct cursor_type {
+        const interval_type* it;
+        const interval_type* end;
+        bool next(interval_type& out) {
+            if (it == end) {
+                return false;
+            }
+            out = *it++;
+            return true;
+        }
+    };
+
+    cursor_type cursor() const {
+        assert(std::is_sorted(r.intervals.begin(), r.intervals.end()));
+        return {r.intervals.data(), r.intervals.data() + r.intervals.size()};
+    }
+};
+
+// Turns an operand into an expression: expressions are kept, regions become leaves.
+template<typename X>
+static auto operand(X&& x) {
+    using D = typename std::decay<X>::type;
+    if constexpr (is_expression<D>::value) {
+        return D(std::forward<X>(x));
+    } else if constexpr (std::is_lvalue_reference<X>::value) {
+        return leaf<D, false>{{}, x};
+    } else {
+        return leaf<D, true>{{}, std::move(x)};
+    }
+}
+
+// A cursor with one interval of lookahead.
+template<typename Cursor, typename Interval>
+struct peeking {
+    Cursor c;
+    std::optional<Interval> v;
+    peeking(Cursor _c): c(std::move(_c)) {
+        pop();
+    }
+    void pop() {
+        Interval x {0, 0};
+        if (c.next(x)) {
+            v = x;
+        } else {
+            v.reset();
+        }
+    }
+};
+
+// Folds pieces arriving in start order into runs as |= does,
+// returning each run once the next piece can't join it.
+template<typename Interval>
+struct coalescing {
+    std::optional<Interval> pending;
+
+    // returns true and sets out when x completes a run
+    bool push(const Interval& x, Interval& out) {
+        if (pending && detail::can_coalesce(*pending, x)) {
+            pending->end = std::max(pending->end, x.end);
+            return false;
+        }
+        bool flushed = pending.has_value();
+        if (flushed) {
+            out = *pending;
+        }
+        pending = x;
+        return flushed;
+    }
+
+    bool flush(Interval& out) {
+        if (!pending) {
+            return false;
+        }
+        out = *pending;
+        pending.reset();
+        return true;
+    }
+};
+
+template<typename L, typename R>
+struct union_expression : expression<union_expression<L, R>, typename L::interval_type> {
+    using interval_type = typename L::interval_type;
+    static_assert(std::is_same<interval_type, typename R::interval_type>::value, "a union needs the same data type on both sides");
+    L l;
+    R r;
+
+    struct cursor_type {
+        peeking<decltype(std::declval<const L&>().cursor()), interval_type> l;
+        peeking<decltype(std::declval<const R&>().cursor()), interval_type> r;
+        coalescing<interval_type> runs;
+
+        bool next(interval_type& out) {
+            while (l.v || r.v) {
+                bool from_l = !r.v || (l.v && !(*r.v < *l.v));
+                auto& side_v = from_l ? l.v : r.v;
+                interval_type x = *side_v;
+                if (from_l) {
+                    l.pop();
+                } else {
+                    r.pop();
+                }
+                if (runs.push(x, out)) {
+                    return true;
+                }
+            }
+            return runs.flush(out);
+        }
+    };
+
+    cursor_type cursor() const {
+        return {l.cursor(), r.cursor(), {}};
+    }
+};
+
+template<typename L, typename R>
+struct intersection_expression : expression<intersection_expression<L, R>, typename L::interval_type> {
+    using interval_type = typename L::interval_type;
+    L l;
+    R r;
+
+    struct cursor_type {
+        peeking<decltype(std::declval<const L&>().cursor()), interval_type> l;
+        peeking<decltype(std::declval<const R&>().cursor()), typename R::interval_type> r;
+
+        bool next(interval_type& out) {
+            while (l.v && r.v) {
+                if (l.v->end < r.v->start) {
+                    l.pop();
+                    continue;
+                } else if (r.v->end < l.v->start) {
+                    r.pop();
+                    continue;
+                }
+                using word_type = typename interval_type::word_type;
+                out = interval_type{std::max<word_type>(l.v->start, r.v->start), std::min<word_type>(l.v->end, r.v->end), l.v->data};
+                if (l.v->end < r.v->end) {
+                    l.pop();
+                } else if (r.v->end < l.v->end) {
+                    r.pop();
+                } else {
+                    l.pop();
+                    r.pop();
+                }
+                return true;
+            }
+            return false;
+        }
+    };
+
+    cursor_type cursor() const {
+        return {l.cursor(), r.cursor()};
+    }
+};
+
+// The pieces of l not covered by r, as detail::merge_difference produces them.
+template<typename LCursor, typename RCursor, typename Interval, typename RInterval>
+struct difference_cursor {
+    peeking<LCursor, Interval> l;
+    peeking<RCursor, RInterval> r;
+    using word_type = typename Interval::word_type;
+    // the start of what is left of l's current interval
+    word_type s;
+
+    difference_cursor(LCursor lc, RCursor rc): l(std::move(lc)), r(std::move(rc)), s(l.v ? static_cast<word_type>(l.v->start) : 0) {}
+
+    void pop_l() {
+        l.pop();
+        if (l.v) {
+            s = l.v->start;
+        }
+    }
+
+    bool next(Interval& out) {
+        while (l.v) {
+            if (!r.v || l.v->end < r.v->start) {
+                out = Interval{s, l.v->end, l.v->data};
+                pop_l();
+                return true;
+            }
+            if (s > r.v->end) {
+                r.pop();
+                continue;
+            }
+            if (s >= r.v->start) {
+                if (l.v->end <= r.v->end) {
+                    pop_l();
+                } else {
+                    s = r.v->end + 1;
+                    r.pop();
+                }
+                continue;
+            }
+            out = Interval{s, r.v->start - 1, l.v->data};
+            if (r.v->end < l.v->end) {
+                s = r.v->end + 1;
+                r.pop();
+            } else {
+                pop_l();
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+template<typename L, typename R>
+struct difference_expression : expression<difference_expression<L, R>, typename L::interval_type> {
+    using interval_type = typename L::interval_type;
+    L l;
+    R r;
+
+    using cursor_type = difference_cursor<decltype(std::declval<const L&>().cursor()), decltype(std::declval<const R&>().cursor()), interval_type, typename R::interval_type>;
+
+    cursor_type cursor() const {
+        return cursor_type(l.cursor(), r.cursor());
+    }
+};
+
+template<typename L, typename R>
+struct xor_expression : expression<xor_expression<L, R>, typename L::interval_type> {
+    using interval_type = typename L::interval_type;
+    static_assert(std::is_same<interval_type, typename R::interval_type>::value, "a xor needs the same data type on both sides");
+    L l;
+    R r;
+
+    // one pass over both sides, as detail::merge_symmetric_difference makes it,
+    // so each side is only evaluated once
+    struct cursor_type {
+        using word_type = typename interval_type::word_type;
+        peeking<decltype(std::declval<const L&>().cursor()), interval_type> l;
+        peeking<decltype(std::declval<const R&>().cursor()), interval_type> r;
+        // the start of what is left of the current interval on each side
+        word_type ls, rs;
+        coalescing<interval_type> runs;
+
+        cursor_type(decltype(std::declval<const L&>().cursor()) lc, decltype(std::declval<const R&>().cursor()) rc):
+            l(std::move(lc)), r(std::move(rc)), ls(l.v ? static_cast<word_type>(l.v->start) : 0), rs(r.v ? static_cast<word_type>(r.v->start) : 0) {}
+
+        void pop_l() {
+            l.pop();
+            if (l.v) {
+                ls = l.v->start;
+            }
+        }
+
+        void pop_r() {
+            r.pop();
+            if (r.v) {
+                rs = r.v->start;
+            }
+        }
+
+        bool next(interval_type& out) {
+            while (l.v || r.v) {
+                interval_type x {0, 0};
+                if (!r.v || (l.v && l.v->end < rs)) { // lhs: |--|  rhs:     |--|
+                    x = interval_type{ls, l.v->end, l.v->data};
+                    pop_l();
+                } else if (!l.v || r.v->end < ls) { // lhs:     |--|  rhs: |--|
+                    x = interval_type{rs, r.v->end, r.v->data};
+                    pop_r();
+                } else if (ls < rs) { // they overlap, the part of lhs in front
+                    x = interval_type{ls, rs - 1, l.v->data};
+                    ls = rs;
+                } else if (rs < ls) {
+                    x = interval_type{rs, ls - 1, r.v->data};
+                    rs = ls;
+                } else { // both start together, drop the common part
+                    const word_type e = std::min<word_type>(l.v->end, r.v->end);
+                    const bool l_done = l.v->end == e, r_done = r.v->end == e;
+                    if (l_done) {
+                        pop_l();
+                    } else {
+                        ls = e + 1;
+                    }
+                    if (r_done) {
+                        pop_r();
+                    } else {
+                        rs = e + 1;
+                    }
+                    continue;
+                }
+                if (runs.push(x, out)) {
+                    return true;
+                }
+            }
+            return runs.flush(out);
+        }
+    };
+
+    cursor_type cursor() const {
+        return cursor_type(l.cursor(), r.cursor());
+    }
+};
+
+template<typename L, typename R>
+using enable_if_lazy = typename std::enable_if<
+    (is_expression<L>::value || is_expression<R>::value) &&
+    (is_expression<L>::value || is_region<typename std::decay<L>::type>::value) &&
+    (is_expression<R>::value || is_region<typename std::decay<R>::type>::value)>::type;
+
+template<typename Derived, typename Interval>
+template<typename R>
+bool expression<Derived, Interval>::intersects(R&& rhs) const {
+    using RO = decltype(operand(std::forward<R>(rhs)));
+    return !intersection_expression<Derived, RO>{{}, self(), operand(std::forward<R>(rhs))}.empty();
+}
+
+} //::lazy_detail
+
+// Starts a lazy expression from a region, see above.
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+static lazy_detail::leaf<region<Dimension, BitsPerDimension, T>, false> lazy(const region<Dimension, BitsPerDimension, T>& r) {
+    return {{}, r};
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+static lazy_detail::leaf<region<Dimension, BitsPerDimension, T>, true> lazy(region<Dimension, BitsPerDimension, T>&& r) {
+    return {{}, std::move(r)};
+}
+
+template<typename L, typename R, typename = lazy_detail::enable_if_lazy<L, R>>
+static auto operator|(L&& l, R&& r) {
+    using LO = decltype(lazy_detail::operand(std::forward<L>(l)));
+    using RO = decltype(lazy_detail::operand(std::forward<R>(r)));
+    return lazy_detail::union_expression<LO, RO>{{}, lazy_detail::operand(std::forward<L>(l)), lazy_detail::operand(std::forward<R>(r))};
+}
+
+template<typename L, typename R, typename = lazy_detail::enable_if_lazy<L, R>>
+static auto operator&(L&& l, R&& r) {
+    using LO = decltype(lazy_detail::operand(std::forward<L>(l)));
+    using RO = decltype(lazy_detail::operand(std::forward<R>(r)));
+    return lazy_detail::intersection_expression<LO, RO>{{}, lazy_detail::operand(std::forward<L>(l)), lazy_detail::operand(std::forward<R>(r))};
+}
+
+template<typename L, typename R, typename = lazy_detail::enable_if_lazy<L, R>>
+static auto operator-(L&& l, R&& r) {
+    using LO = decltype(lazy_detail::operand(std::forward<L>(l)));
+    using RO = decltype(lazy_detail::operand(std::forward<R>(r)));
+    return lazy_detail::difference_expression<LO, RO>{{}, lazy_detail::operand(std::forward<L>(l)), lazy_detail::operand(std::forward<R>(r))};
+}
+
+template<typename L, typename R, typename = lazy_detail::enable_if_lazy<L, R>>
+static auto operator^(L&& l, R&& r) {
+    using LO = decltype(lazy_detail::operand(std::forward<L>(l)));
+    using RO = decltype(lazy_detail::operand(std::forward<R>(r)));
+    return lazy_detail::xor_expression<LO, RO>{{}, lazy_detail::operand(std::forward<L>(l)), lazy_detail::operand(std::forward<R>(r))};
+}
+
+} //::morton
+
+} //::zinc
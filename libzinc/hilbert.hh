@@ -0,0 +1,235 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+#include <array>
+#include <variant>
+
+#include "encoding.hh"
+#include "region.hh"
+#include "util.hh"
+
+namespace zinc {
+
+namespace morton {
+
+namespace detail {
+
+// The hilbert curve as a machine run over the levels of a morton code from the top, as in
+// C. Hamilton, Compact Hilbert Indices, Dalhousie University CS-2006-07. The state is the
+// orientation of the current sub-cube: the corner the curve enters it by, and the axis it
+// leaves along. Each level's bits, one for each coordinate as in a morton code, are put in
+// that frame and gray decoded into the level's digit along the curve, which picks the sub-cube
+// the point is in and so the next state. Every bit here is of a single level, so a level
+// fits in 32 bits.
+struct hilbert_state {
+    uint32_t entry;
+    uint32_t direction;
+};
+
+// the low n bits of x rotated
+static constexpr uint32_t rotate_left_bits(uint32_t x, uint32_t r, uint32_t n) {
+    r %= n;
+    return r == 0 ? x : ((x << r) | (x >> (n - r))) & ((1u << n) - 1);
+}
+
+static constexpr uint32_t rotate_right_bits(uint32_t x, uint32_t r, uint32_t n) {
+    return rotate_left_bits(x, n - r % n, n);
+}
+
+static constexpr uint32_t gray_code(uint32_t i) {
+    return i ^ (i >> 1);
+}
+
+static constexpr uint32_t gray_code_inverse(uint32_t g) {
+    for (uint32_t shift = 1; shift < 32; shift *= 2) {
+        g ^= g >> shift;
+    }
+    return g;
+}
+
+// the state of sub-cube w, relative to its parent's
+template<uint32_t Dimension>
+static constexpr void hilbert_advance(hilbert_state& s, uint32_t w) {
+    const uint32_t entry = w == 0 ? 0 : gray_code((w - 1) & ~1u);
+    // the trailing ones of w, or of w - 1 when w is even
+    uint32_t v = w == 0 ? 0 : (w % 2 == 0 ? w - 1 : w), ones = 0;
+    for (; v & 1; v >>= 1) {
+        ones++;
+    }
+    s.entry ^= rotate_left_bits(entry, s.direction + 1, Dimension);
+    s.direction = (s.direction + ones % Dimension + 1) % Dimension;
+}
+
+// The digit along the curve of the level with morton bits l, and back.
+template<uint32_t Dimension>
+static constexpr uint32_t hilbert_encode_level(hilbert_state& s, uint32_t l) {
+    const uint32_t w = gray_code_inverse(rotate_right_bits(l ^ s.entry, s.direction + 1, Dimension));
+    hilbert_advance<Dimension>(s, w);
+    return w;
+}
+
+template<uint32_t Dimension>
+static constexpr uint32_t hilbert_decode_level(hilbert_state& s, uint32_t w) {
+    const uint32_t l = rotate_left_bits(gray_code(w), s.direction + 1, Dimension) ^ s.entry;
+    hilbert_advance<Dimension>(s, w);
+    return l;
+}
+
+// The machine run over as many levels as fit in a byte for each lookup, for the dimensions
+// where the tables stay small. The states are entry * Dimension + direction.
+// encode[state][morton bits] is the hilbert bits with the next state above them, and
+// decode[state][hilbert bits] is the morton bits with the next state above them.
+template<uint32_t Dimension>
+struct hilbert_tables {
+    static constexpr uint32_t states = Dimension <= 8 ? Dimension << Dimension : 0;
+
+    // the levels of each lookup, or 0 where even one level would make the tables too big
+    static constexpr uint32_t make_levels() {
+        for (uint32_t levels = 8 / Dimension; levels > 0; levels--) {
+            if ((uint64_t{states} << (Dimension * levels)) <= 8192) {
+                return levels;
+            }
+        }
+        return 0;
+    }
+
+    static constexpr uint32_t levels = make_levels();
+    using table_type = std::array<std::array<uint16_t, size_t{1} << (Dimension * levels)>, states>;
+
+    static constexpr table_type make(bool to_hilbert) {
+        table_type table {};
+        for (uint32_t state = 0; state < states; state++) {
+            for (uint32_t bits = 0; bits < (1u << (Dimension * levels)); bits++) {
+                hilbert_state s {state / Dimension, state % Dimension};
+                uint32_t out = 0;
+                for (uint32_t level = levels; level-- > 0;) {
+                    const uint32_t in = (bits >> (level * Dimension)) & ((1u << Dimension) - 1);
+                    out |= (to_hilbert ? hilbert_encode_level<Dimension>(s, in) : hilbert_decode_level<Dimension>(s, in)) << (level * Dimension);
+                }
+                table[state][bits] = static_cast<uint16_t>(out | (s.entry * Dimension + s.direction) << 8);
+            }
+        }
+        return table;
+    }
+
+    static constexpr table_type encode = make(true);
+    static constexpr table_type decode = make(false);
+};
+
+// Turns a morton code of Levels levels into the hilbert code of the same point, or back.
+// The levels above a whole number of lookups, or all of them where there are no tables,
+// are worked out one at a time.
+template<uint32_t Dimension, uint32_t Levels, bool ToHilbert, typename Word>
+static inline Word hilbert_translate(Word code) {
+    using tables = hilbert_tables<Dimension>;
+    constexpr uint32_t lookup = tables::levels;
+    constexpr uint32_t single = lookup == 0 ? Levels : Levels % lookup;
+    hilbert_state s {0, 0};
+    Word result = 0;
+    uint32_t level = Levels;
+    for (; level > Levels - single;) {
+        level--;
+        const auto in = static_cast<uint32_t>((code >> (level * Dimension)) & ((Word{1} << Dimension) - 1));
+        const uint32_t out = ToHilbert ? hilbert_encode_level<Dimension>(s, in) : hilbert_decode_level<Dimension>(s, in);
+        result |= Word{out} << (level * Dimension);
+    }
+    if constexpr (lookup != 0) {
+        const auto& table = ToHilbert ? tables::encode : tables::decode;
+        uint32_t state = s.entry * Dimension + s.direction;
+        for (uint32_t i = (Levels - single) / lookup; i-- > 0;) {
+            const uint32_t shift = i * lookup * Dimension;
+            const uint16_t e = table[state][static_cast<size_t>((code >> shift) & ((Word{1} << (Dimension * lookup)) - 1))];
+            result |= Word{static_cast<uint8_t>(e)} << shift;
+            state = e >> 8;
+        }
+    }
+    return result;
+}
+
+// Calls emit(start, end) for the hilbert cells of the cell at corner, of side 2^level and
+// in state s with codes from start, that are inside the box [lo, hi], in curve order. The
+// children of each cell are visited in curve order, so nothing needs sorting afterwards.
+template<uint32_t Dimension, typename Coordinate, typename Word, typename Emit>
+static void hilbert_cover(const std::array<Coordinate, Dimension>& lo, const std::array<Coordinate, Dimension>& hi,
+                          const std::array<Coordinate, Dimension>& corner, uint32_t level, hilbert_state s, Word start, Emit& emit) {
+    assert(level > 0);
+    const uint32_t shift = (level - 1) * Dimension;
+    const Coordinate side = Coordinate{1} << (level - 1);
+    for (uint32_t w = 0; w < (1u << Dimension); w++) {
+        hilbert_state child_state = s;
+        const uint32_t l = hilbert_decode_level<Dimension>(child_state, w);
+        std::array<Coordinate, Dimension> child;
+        bool inside = true, outside = false;
+        for (uint32_t d = 0; d < Dimension; d++) {
+            child[d] = corner[d] | (((l >> d) & 1) ? side : 0);
+            const Coordinate last = child[d] + (side - 1);
+            inside &= lo[d] <= child[d] && last <= hi[d];
+            outside |= hi[d] < child[d] || last < lo[d];
+        }
+        const Word child_start = start | Word{w} << shift;
+        if (inside) {
+            emit(child_start, child_start | ((Word{1} << shift) - 1));
+        } else if (!outside) {
+            hilbert_cover<Dimension>(lo, hi, child, level - 1, child_state, child_start, emit);
+        }
+    }
+}
+
+} //::detail
+
+} //::morton
+
+} //::zinc
+
+// Codes on the hilbert curve, in the same words and with the same interface as morton_code.
+// Consecutive codes are always neighbouring points, so a box breaks into fewer, longer
+// intervals than on the morton curve. Each code is translated from the morton code of the
+// same point, so it gets the interleaving picked for morton_code, and the translation takes
+// a table lookup for every byte or so of code, see detail::hilbert_tables.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+struct hilbert_code {
+    static_assert(Dimension >= 2 && Dimension <= 16, "a hilbert curve needs at least two dimensions, and at most 16 here");
+    using morton_type = morton_code<Dimension, BitsPerDimension>;
+    using word_type = typename morton_type::word_type;
+    using coordinate_type = typename morton_type::coordinate_type;
+    word_type data;
+    static constexpr uint32_t dimension = Dimension;
+    static constexpr uint32_t max_level = BitsPerDimension;
+    operator word_type() const {
+        return data;
+    }
+    hilbert_code(word_type _data): data(_data) {};
+    static hilbert_code encode(std::array<coordinate_type, Dimension> p) {
+        return from_morton(morton_type::encode(p));
+    }
+    static std::array<coordinate_type, Dimension> decode(const hilbert_code code) {
+        return morton_type::decode(to_morton(code));
+    }
+    // The hilbert code of the point with morton code m, and back.
+    static hilbert_code from_morton(const morton_type m) {
+        return {zinc::morton::detail::hilbert_translate<Dimension, BitsPerDimension, true>(m.data)};
+    }
+    static morton_type to_morton(const hilbert_code code) {
+        return {zinc::morton::detail::hilbert_translate<Dimension, BitsPerDimension, false>(code.data)};
+    }
+};
+
+namespace zinc {
+
+namespace morton {
+
+struct hilbert_curve {
+    template<uint32_t Dimension, uint32_t BitsPerDimension>
+    using code = hilbert_code<Dimension, BitsPerDimension>;
+};
+
+// A region of intervals on the hilbert curve. Its cells are the same cubes as a morton
+// region's, they are just visited in a different order.
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T = std::monostate>
+using hilbert_region = region<Dimension, BitsPerDimension, T, hilbert_curve>;
+
+} //::morton
+
+} //::zinc
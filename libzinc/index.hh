@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+#include <algorithm>
+#include <vector>
+#include <variant>
+
+#include "encoding.hh"
+#include "region.hh"
+
+namespace zinc {
+
+namespace morton {
+
+// A read-only accelerator for point lookups on a region that changes rarely.
+// It keeps a copy of the interval starts in Eytzinger (breadth first) order,
+// so the first few levels of every search share cache lines and the next
+// levels can be prefetched, see https://arxiv.org/abs/1509.05053
+//
+// The index refers to the region it was built from, which must outlive it
+// and must not be modified while the index is in use.
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T = std::monostate>
+struct region_index {
+    using region_type = region<Dimension, BitsPerDimension, T>;
+    using interval_type = typename region_type::interval_type;
+
+    region_index(const region_type& _source): source(&_source), keys(_source.intervals.size() + 1), ranks(_source.intervals.size() + 1) {
+        assert(std::is_sorted(source->intervals.begin(), source->intervals.end()));
+        build(0, 1);
+    };
+
+    // Returns the interval containing c, or nullptr if there isn't one.
+    const interval_type* find(const morton_code<Dimension, BitsPerDimension> c) const;
+
+    bool contains(const morton_code<Dimension, BitsPerDimension> c) const {
+        return find(c) != nullptr;
+    }
+
+private:
+    const region_type* source;
+    // keys[k] is the start of the interval ranks[k], slot 0 is unused so that
+    // the children of slot k are 2k and 2k+1
+    std::vector<typename interval_type::word_type> keys;
+    std::vector<size_t> ranks;
+
+    // fills the subtree rooted at slot k with the intervals from rank i onwards, in order
+    size_t build(size_t i, size_t k) {
+        if (k < keys.size()) {
+            i = build(i, 2 * k);
+            keys[k] = source->intervals[i].start;
+            ranks[k] = i;
+            i = build(i + 1, 2 * k + 1);
+        }
+        return i;
+    }
+};
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+const typename region_index<Dimension, BitsPerDimension, T>::interval_type* region_index<Dimension, BitsPerDimension, T>::find(const morton_code<Dimension, BitsPerDimension> c) const {
+    const size_t n = keys.size() - 1;
+    size_t k = 1;
+    while (k <= n) {
+        // a cache line holds 8 keys, so this is the line 4 levels below k
+        if (16 * k < keys.size()) {
+            __builtin_prefetch(keys.data() + 16 * k);
+        }
+        k = 2 * k + (keys[k] <= c.data);
+    }
+    // undo the right turns taken after the last left turn, which leaves the
+    // slot of the first start greater than c, or 0 if there isn't one
+    k >>= __builtin_ffsll(static_cast<long long>(~k));
+    size_t upper = k == 0 ? n : ranks[k];
+    if (upper == 0) {
+        return nullptr;
+    }
+    const interval_type& i = source->intervals[upper - 1];
+    return c.data <= i.end ? &i : nullptr;
+}
+
+} //::morton
+
+} //::zinc
@@ -3,6 +3,9 @@
 #include <cstdint>
 #include <cassert>
 
+#include <array>
+#include <iterator>
+#include <limits>
 #include <vector>
 #include <tuple>
 #include <optional>
@@ -17,15 +20,36 @@ namespace morton {
 
 namespace detail {
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T = std::monostate>
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+struct cell_range;
+
+// The non-zero levels of a cell histogram as (level, count) pairs in level order.
+template<size_t Levels>
+static std::vector<std::pair<uint64_t,uint64_t>> histogram_to_counts(const std::array<uint64_t, Levels>& histogram) {
+    std::vector<std::pair<uint64_t,uint64_t>> v = {};
+    for (size_t level = 0; level < Levels; level++) {
+        if (histogram[level] != 0) {
+            v.push_back({level, histogram[level]});
+        }
+    }
+    return v;
+}
+
+// An interval of codes on Curve, morton_curve or hilbert_curve. Everything here works on
+// the codes alone, so it holds for either curve: on both, the aligned runs of
+// 2^(Dimension * level) codes are the cubes of side 2^level.
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T = std::monostate, typename Curve = morton_curve>
 struct interval {
-    morton_code<2, 32> start, end;
+    using code_type = typename Curve::template code<Dimension, BitsPerDimension>;
+    // uint64_t, or a 128 bit integer for codes wider than a word
+    using word_type = typename code_type::word_type;
+    code_type start, end;
     T data {};
-    interval(morton_code<2, 32> _start, morton_code<2, 32> _end): start(_start), end(_end) {};
-    interval(morton_code<2, 32> _start, morton_code<2, 32> _end, T _t): start(_start), end(_end), data(_t) {};
+    interval(code_type _start, code_type _end): start(_start), end(_end) {};
+    interval(code_type _start, code_type _end, T _t): start(_start), end(_end), data(_t) {};
 
     template<typename M>
-    friend bool operator==(const interval& lhs, const interval<Dimension, BitsPerDimension, M>& rhs) {
+    friend bool operator==(const interval& lhs, const interval<Dimension, BitsPerDimension, M, Curve>& rhs) {
         if constexpr (std::is_same<T, std::monostate>::value || std::is_same<M, std::monostate>::value) {
             return std::tie(lhs.start, lhs.end) == std::tie(rhs.start, rhs.end);
         } else if constexpr (std::is_same<T, M>::value) {
@@ -40,7 +64,7 @@ struct interval {
     }
 
     template<typename M>
-    friend bool operator<(const interval& lhs, const interval<Dimension, BitsPerDimension, M>& rhs) {
+    friend bool operator<(const interval& lhs, const interval<Dimension, BitsPerDimension, M, Curve>& rhs) {
         if constexpr (std::is_same<T, std::monostate>::value || std::is_same<M, std::monostate>::value) {
             return std::tie(lhs.start, lhs.end) < std::tie(rhs.start, rhs.end);
         } else if constexpr (std::is_same<T, M>::value) {
@@ -66,16 +90,21 @@ struct interval {
 
     std::optional<interval> intersect(const interval& rhs) const;
 
-    bool contains(const morton_code<Dimension, BitsPerDimension> c) const {
+    bool contains(const code_type c) const {
         return c >= start && c <= end;
     }
 
-    uint64_t area() const;
+    word_type area() const;
 
     uint64_t start_alignment() const;
 
     uint64_t end_alignment() const;
 
+    // The same cells as to_cells, computed as they are visited instead of stored.
+    cell_range<Dimension, BitsPerDimension, T, Curve> cells() const;
+
+    cell_range<Dimension, BitsPerDimension, T, Curve> cells(size_t max_level) const;
+
     std::vector<interval> to_cells() const;
 
     std::vector<interval> to_cells(size_t max_level) const;
@@ -83,10 +112,14 @@ struct interval {
     // e.g. 3 cells of size 1, 2 cells of size 2, and one cell of size 3.
     // where size 1 = 1 on each side, size 2 = 2, size 3  = 4
     std::vector<std::pair<uint64_t,uint64_t>> count_cells() const;
+
+    // The number of cells of each level that to_cells would give, worked out from the
+    // digits of start and end + 1 in O(BitsPerDimension) rather than by visiting the cells.
+    std::array<uint64_t, BitsPerDimension + 1> cell_histogram() const;
 };
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-bool interval<Dimension, BitsPerDimension, T>::data_equals(const detail::interval<Dimension,BitsPerDimension,T>& rhs) const {
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+bool interval<Dimension, BitsPerDimension, T, Curve>::data_equals(const detail::interval<Dimension,BitsPerDimension,T,Curve>& rhs) const {
     if constexpr (std::is_same<T, std::monostate>::value) {
         return true;
     } else {
@@ -94,93 +127,194 @@ bool interval<Dimension, BitsPerDimension, T>::data_equals(const detail::interva
     }
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-std::optional< interval<Dimension,BitsPerDimension,T> > interval<Dimension, BitsPerDimension, T>::intersect(const interval<Dimension,BitsPerDimension,T>& rhs) const {
-    uint64_t i_start = std::max(start, rhs.start);
-    uint64_t i_end = std::min(end, rhs.end);
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+std::optional< interval<Dimension,BitsPerDimension,T,Curve> > interval<Dimension, BitsPerDimension, T, Curve>::intersect(const interval<Dimension,BitsPerDimension,T,Curve>& rhs) const {
+    word_type i_start = std::max<word_type>(start, rhs.start);
+    word_type i_end = std::min<word_type>(end, rhs.end);
     if (i_start > i_end) {
       return std::nullopt;
     }
-    return std::optional{interval<Dimension, BitsPerDimension>{i_start,i_end,data}};
+    return std::optional{interval{i_start,i_end,data}};
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-uint64_t interval<Dimension, BitsPerDimension, T>::area() const {
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+typename interval<Dimension, BitsPerDimension, T, Curve>::word_type interval<Dimension, BitsPerDimension, T, Curve>::area() const {
     assert(start <= end);
     return end + 1 - start;
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-uint64_t interval<Dimension, BitsPerDimension, T>::start_alignment() const {
-    return start != 0 ? __builtin_ctzll(start) / Dimension : std::numeric_limits<uint64_t>::max();
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+uint64_t interval<Dimension, BitsPerDimension, T, Curve>::start_alignment() const {
+    return start != 0 ? count_trailing_zeros(word_type{start}) / Dimension : std::numeric_limits<uint64_t>::max();
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-uint64_t interval<Dimension, BitsPerDimension, T>::end_alignment() const {
-    return end != 0 ? __builtin_ctzll(end) / Dimension : std::numeric_limits<uint64_t>::max();
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+uint64_t interval<Dimension, BitsPerDimension, T, Curve>::end_alignment() const {
+    return end != 0 ? count_trailing_zeros(word_type{end}) / Dimension : std::numeric_limits<uint64_t>::max();
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-std::vector<interval<Dimension,BitsPerDimension,T>> interval<Dimension, BitsPerDimension, T>::to_cells() const {
-    uint64_t s = start;
-    std::vector<interval<Dimension,BitsPerDimension,T>> v = {};
-    while(s <= end){
-        auto amax = get_align_max<Dimension, BitsPerDimension>(s,end);
-        v.push_back({s,amax,data});
-        s = amax+1;
+// The morton aligned cells of an interval, no larger than max_level, in order.
+// Each cell is worked out from the end of the previous one, so iterating takes no memory.
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+struct cell_range {
+    using interval_type = interval<Dimension, BitsPerDimension, T, Curve>;
+    using word_type = typename interval_type::word_type;
+    interval_type source;
+    size_t max_level;
+
+    class iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef interval_type value_type;
+            typedef ptrdiff_t difference_type;
+            typedef const value_type *pointer;
+            typedef const value_type &reference;
+
+            iterator(): cell({0, 0}), end(0), level_mask(0), is_finished(true) {}
+
+            iterator(const interval_type& i, size_t max_level): cell(i), end(i.end), is_finished(false) {
+                assert(i.start <= i.end);
+                level_mask = max_level >= BitsPerDimension ? ~word_type{0} : get_morton_code<Dimension, word_type>(max_level);
+                fit(i.start);
+            }
+
+            iterator &operator++() {
+                if (cell.end == end) {
+                    is_finished = true;
+                } else {
+                    fit(cell.end + 1);
+                }
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator i = *this;
+                ++*this;
+                return i;
+            }
+
+            bool operator==(const iterator &i) const {
+                return is_finished == i.is_finished && (is_finished || cell.start == i.cell.start);
+            }
+
+            bool operator!=(const iterator &i) const {
+                return !(*this == i);
+            }
+
+            reference operator*() const {
+                return cell;
+            }
+
+            pointer operator->() const {
+                return &cell;
+            }
+
+        private:
+            value_type cell;
+            word_type end;
+            word_type level_mask;
+            bool is_finished;
+
+            // sets cell to the largest allowed cell starting at s
+            void fit(word_type s) {
+                word_type e = get_align_max<Dimension, BitsPerDimension, word_type>(s, end);
+                cell.start = s;
+                cell.end = e - s > level_mask ? s + level_mask : e;
+            }
+    };
+
+    iterator begin() const {
+        return iterator(source, max_level);
     }
-    return v;
+
+    iterator end() const {
+        return iterator();
+    }
+};
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+cell_range<Dimension, BitsPerDimension, T, Curve> interval<Dimension, BitsPerDimension, T, Curve>::cells() const {
+    return {*this, BitsPerDimension};
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-std::vector<interval<Dimension,BitsPerDimension,T>> interval<Dimension, BitsPerDimension, T>::to_cells(size_t max_level) const {
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+cell_range<Dimension, BitsPerDimension, T, Curve> interval<Dimension, BitsPerDimension, T, Curve>::cells(size_t max_level) const {
+    return {*this, max_level};
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+std::vector<interval<Dimension,BitsPerDimension,T,Curve>> interval<Dimension, BitsPerDimension, T, Curve>::to_cells() const {
+    auto c = cells();
+    return {c.begin(), c.end()};
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+std::vector<interval<Dimension,BitsPerDimension,T,Curve>> interval<Dimension, BitsPerDimension, T, Curve>::to_cells(size_t max_level) const {
+    auto c = cells(max_level);
+    return {c.begin(), c.end()};
+}
+// The cells run up from start in increasing sizes until they reach a boundary of the
+// largest cell that fits, then down in decreasing sizes to end. On the way up, the
+// cells of each level fill in start's base 2^Dimension digit of that level, and on the
+// way down, each level takes the same digit of end + 1.
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+std::array<uint64_t, BitsPerDimension + 1> interval<Dimension, BitsPerDimension, T, Curve>::cell_histogram() const {
+    static_assert(std::is_same<word_type, uint64_t>::value, "cell counts are only worked out for codes of one word");
+    assert(start <= end);
+    constexpr uint64_t base = 1ULL << Dimension;
+    std::array<uint64_t, BitsPerDimension + 1> counts {};
+    // no cell is bigger than the interval, which also keeps the shifts below in range
+    const uint64_t span = end - start;
+    if (span == std::numeric_limits<uint64_t>::max()) {
+        // the whole 64 bit range
+        const uint64_t level = std::min<uint64_t>(BitsPerDimension, 64 / Dimension);
+        counts[level] = 1ULL << (64 - Dimension * level);
+        return counts;
+    }
+    const uint32_t top = static_cast<uint32_t>(std::min<uint64_t>(BitsPerDimension, fast_log2(span + 1) / Dimension));
     uint64_t s = start;
-    std::vector<interval<Dimension,BitsPerDimension,T>> v = {};
-    while(s <= end){
-        auto amax = std::min(s + (1 << max_level), get_align_max<Dimension, BitsPerDimension>(s,end));
-        v.push_back({s,amax,data});
-        s = amax+1;
+    // the codes still to cover, which can't overflow as span + 1 doesn't
+    uint64_t left = span + 1;
+    uint32_t level = 0;
+    for (; level < top; level++) {
+        const uint32_t shift = level * Dimension;
+        uint64_t up = (base - (s >> shift) % base) % base;
+        uint64_t fit = left >> shift;
+        uint64_t n = std::min(up, fit);
+        counts[level] = n;
+        s += n << shift;
+        left -= n << shift;
+        if (up > fit) {
+            break;
+        }
     }
-    return v;
+    for (level = std::min(level, top) + 1; level-- > 0;) {
+        const uint32_t shift = level * Dimension;
+        uint64_t n = left >> shift;
+        counts[level] += n;
+        left -= n << shift;
+    }
+    assert(left == 0);
+    return counts;
 }
+
 // this returns an sorted map of the cells and size.
 // e.g. 3 cells of size 1, 2 cells of size 2, and one cell of size 3.
 // where size 1 = 1 on each side, size 2 = 2, size 3  = 4
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-std::vector<std::pair<uint64_t,uint64_t>> interval<Dimension, BitsPerDimension, T>::count_cells() const {
-    uint64_t s = start;
-    std::vector<std::pair<uint64_t,uint64_t>> v = {};
-    while(s <= end){
-        auto amax = get_align_max<Dimension, BitsPerDimension>(s,end);
-        auto diff = fast_log2(1 + amax - s)/Dimension;
-        size_t i = 0;
-        bool found = false;
-        for(; i < v.size(); i++){
-            if (v[i].first == diff) {
-                found = true;
-                break;
-            }
-        }
-        if (found) {
-            v[i].second += 1;
-        } else {
-            v.push_back({diff,1});
-        }
-        s = amax+1;
-    }
-    std::sort(v.begin(), v.end());
-    return v;
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+std::vector<std::pair<uint64_t,uint64_t>> interval<Dimension, BitsPerDimension, T, Curve>::count_cells() const {
+    return histogram_to_counts(cell_histogram());
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-static std::pair<uint64_t,uint64_t> get_parent_cell(interval<Dimension, BitsPerDimension, T> interval){
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+static std::pair<uint64_t,uint64_t> get_parent_cell(interval<Dimension, BitsPerDimension, T, Curve> interval){
     auto level = get_unifying_level<Dimension>(interval.start, interval.end);
     auto parent = get_parent_morton_aligned<Dimension>(interval.start, level);
     return {parent, level};
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-static interval<Dimension, BitsPerDimension, T> get_parent_cell(const interval<Dimension, BitsPerDimension, T> interval){
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+static interval<Dimension, BitsPerDimension, T, Curve> get_parent_cell(const interval<Dimension, BitsPerDimension, T, Curve> interval){
     std::pair<uint64_t,uint64_t> pair = get_parent_cell<Dimension>(interval);
     if (std::is_same<T, std::monostate>::value){
         return {pair.first, pair.first + get_morton_code<Dimension>(pair.second)};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cpu.hh"
+#include "encoding.hh"
+#include "region.hh"
+#include "span.hh"
+
+namespace zinc {
+
+namespace morton {
+
+// An on-disk form of a region that is used in place through mmap, for large regions that
+// never change. Opening one is a single mmap, whatever the size of the region.
+//
+//   header         mapped_region_header, 64 bytes
+//   intervals      the region's intervals exactly as they are laid out in memory, at intervals_offset
+//   index          every index_stride'th interval start, at index_offset
+//
+// The intervals are the in-memory interval type, so a file can only be read by a build
+// with the same interval layout and endianness, which open checks as far as it can. open
+// also checks the index against the intervals, but trusts the intervals to be sorted.
+// The index is small enough to stay in cache, and narrows each binary search of the
+// intervals to index_stride entries.
+
+namespace detail {
+
+struct mapped_region_header {
+    char magic[8];
+    uint32_t dimension;
+    uint32_t bits_per_dimension;
+    uint32_t interval_size;
+    uint32_t data_size;
+    uint64_t count;
+    uint64_t index_stride;
+    uint64_t index_count;
+    uint64_t intervals_offset;
+    uint64_t index_offset;
+};
+
+static_assert(sizeof(mapped_region_header) == 64, "the header is padded to a cache line");
+
+static const char mapped_region_magic[8] = {'Z', 'I', 'N', 'C', 'M', 'A', 'P', 1};
+
+// where each section starts, rounded up so the intervals can be used in place
+static uint64_t mapped_region_align(uint64_t offset) {
+    return (offset + 63) & ~uint64_t{63};
+}
+
+} //::detail
+
+// Writes r to path in the layout above, returning false if the file couldn't be written.
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+static bool write_mapped_region(const region<Dimension, BitsPerDimension, T>& r, const char* path, uint64_t index_stride = 256) {
+    using interval_type = typename region<Dimension, BitsPerDimension, T>::interval_type;
+    static_assert(std::is_trivially_copyable<interval_type>::value, "only regions of trivially copyable data can be mapped");
+    static_assert(std::is_same<typename interval_type::word_type, uint64_t>::value, "only codes of one word can be mapped");
+    assert(std::is_sorted(r.intervals.begin(), r.intervals.end()));
+    assert(index_stride > 0);
+    detail::mapped_region_header header {};
+    std::memcpy(header.magic, detail::mapped_region_magic, sizeof(header.magic));
+    header.dimension = Dimension;
+    header.bits_per_dimension = BitsPerDimension;
+    header.interval_size = sizeof(interval_type);
+    header.data_size = std::is_same<T, std::monostate>::value ? 0 : sizeof(T);
+    header.count = r.intervals.size();
+    header.index_stride = index_stride;
+    header.index_count = (header.count + index_stride - 1) / index_stride;
+    header.intervals_offset = detail::mapped_region_align(sizeof(header));
+    header.index_offset = detail::mapped_region_align(header.intervals_offset + header.count * sizeof(interval_type));
+    std::vector<uint64_t> index(header.index_count);
+    for (size_t i = 0; i < index.size(); i++) {
+        index[i] = r.intervals[i * index_stride].start;
+    }
+
+    std::FILE* f = std::fopen(path, "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    static const char padding[64] = {};
+    const size_t padding_size = header.index_offset - header.intervals_offset - header.count * sizeof(interval_type);
+    bool ok =
+        std::fwrite(&header, sizeof(header), 1, f) == 1 &&
+        (r.intervals.empty() || std::fwrite(r.intervals.data(), sizeof(interval_type), r.intervals.size(), f) == r.intervals.size()) &&
+        std::fwrite(padding, 1, padding_size, f) == padding_size &&
+        (index.empty() || std::fwrite(index.data(), sizeof(uint64_t), index.size(), f) == index.size());
+    return std::fclose(f) == 0 && ok;
+}
+
+// A read-only region backed by a file written by write_mapped_region. The mapping is
+// released when the mapped_region is destroyed, so it can be moved but not copied.
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T = std::monostate>
+class mapped_region {
+public:
+    using interval_type = detail::interval<Dimension, BitsPerDimension, T>;
+    using region_type = region<Dimension, BitsPerDimension, T>;
+    static_assert(std::is_trivially_copyable<interval_type>::value, "only regions of trivially copyable data can be mapped");
+    static_assert(std::is_same<typename interval_type::word_type, uint64_t>::value, "only codes of one word can be mapped");
+
+    // Returns std::nullopt if path can't be mapped, or wasn't written for this region type.
+    static std::optional<mapped_region> open(const char* path);
+
+    mapped_region(mapped_region&& m): base(m.base), length(m.length), header(m.header), mapped_intervals(m.mapped_intervals), mapped_index(m.mapped_index) {
+        m.base = nullptr;
+    }
+
+    mapped_region& operator=(mapped_region&& m) {
+        std::swap(base, m.base);
+        std::swap(length, m.length);
+        header = m.header;
+        mapped_intervals = m.mapped_intervals;
+        mapped_index = m.mapped_index;
+        return *this;
+    }
+
+    mapped_region(const mapped_region&) = delete;
+    mapped_region& operator=(const mapped_region&) = delete;
+
+    ~mapped_region() {
+        if (base != nullptr) {
+            munmap(base, length);
+        }
+    }
+
+    zinc::span<const interval_type> intervals() const {
+        return mapped_intervals;
+    }
+
+    size_t size() const {
+        return mapped_intervals.size();
+    }
+
+    bool empty() const {
+        return mapped_intervals.empty();
+    }
+
+    uint64_t area(zinc::cpu::isa isa = zinc::cpu::best_isa()) const {
+        return detail::interleaved_area(mapped_intervals.data(), mapped_intervals.size(), isa);
+    }
+
+    // Returns the interval containing c, or nullptr if there isn't one.
+    const interval_type* find(const morton_code<Dimension, BitsPerDimension> c) const;
+
+    bool contains(const morton_code<Dimension, BitsPerDimension> c) const {
+        return find(c) != nullptr;
+    }
+
+    template<typename M>
+    bool intersects(const region<Dimension, BitsPerDimension, M>& rhs, zinc::cpu::isa isa = zinc::cpu::best_isa()) const;
+
+    // The intersection with an in-memory region, each piece keeping the data of the mapped interval.
+    template<typename M>
+    friend region_type operator&(const mapped_region& lhs, const region<Dimension, BitsPerDimension, M>& rhs) {
+        assert(std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+        region_type result;
+        detail::merge_intersection(lhs.mapped_intervals.begin(), lhs.mapped_intervals.end(), rhs.intervals.begin(), rhs.intervals.end(), std::back_inserter(result.intervals));
+        return result;
+    }
+
+    // The cells of every interval in order, computed as they are visited.
+    detail::cells_of_intervals<interval_type> cells() const {
+        return {mapped_intervals.begin(), mapped_intervals.end(), BitsPerDimension};
+    }
+
+    detail::cells_of_intervals<interval_type> cells(size_t max_level) const {
+        return {mapped_intervals.begin(), mapped_intervals.end(), max_level};
+    }
+
+private:
+    void* base = nullptr;
+    size_t length = 0;
+    detail::mapped_region_header header {};
+    zinc::span<const interval_type> mapped_intervals;
+    zinc::span<const uint64_t> mapped_index;
+
+    mapped_region() = default;
+};
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+std::optional<mapped_region<Dimension, BitsPerDimension, T>> mapped_region<Dimension, BitsPerDimension, T>::open(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(detail::mapped_region_header)) {
+        close(fd);
+        return std::nullopt;
+    }
+    mapped_region m;
+    m.length = static_cast<size_t>(st.st_size);
+    void* base = mmap(nullptr, m.length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return std::nullopt;
+    }
+    m.base = base;
+    const auto* bytes = static_cast<const uint8_t*>(base);
+    std::memcpy(&m.header, bytes, sizeof(m.header));
+    const auto& h = m.header;
+    if (std::memcmp(h.magic, detail::mapped_region_magic, sizeof(h.magic)) != 0 ||
+        h.dimension != Dimension || h.bits_per_dimension != BitsPerDimension || h.interval_size != sizeof(interval_type) ||
+        h.data_size != (std::is_same<T, std::monostate>::value ? 0 : sizeof(T)) ||
+        h.index_stride == 0 || h.index_count != (h.count == 0 ? 0 : (h.count - 1) / h.index_stride + 1) ||
+        h.intervals_offset % alignof(interval_type) != 0 || h.index_offset % alignof(uint64_t) != 0 ||
+        h.intervals_offset > m.length || h.count > (m.length - h.intervals_offset) / sizeof(interval_type) ||
+        h.index_offset > m.length || h.index_count > (m.length - h.index_offset) / sizeof(uint64_t)) {
+        return std::nullopt;
+    }
+    m.mapped_intervals = {reinterpret_cast<const interval_type*>(bytes + h.intervals_offset), h.count};
+    m.mapped_index = {reinterpret_cast<const uint64_t*>(bytes + h.index_offset), h.index_count};
+    // the index must be the starts it stands for, which keeps every search inside the
+    // intervals. Checking that the intervals are sorted would read the whole file.
+    for (size_t b = 0; b < m.mapped_index.size(); b++) {
+        if (m.mapped_index[b] != m.mapped_intervals[b * h.index_stride].start || (b > 0 && m.mapped_index[b] <= m.mapped_index[b - 1])) {
+            return std::nullopt;
+        }
+    }
+    assert(std::is_sorted(m.mapped_intervals.begin(), m.mapped_intervals.end()));
+    return m;
+}
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+const typename mapped_region<Dimension, BitsPerDimension, T>::interval_type* mapped_region<Dimension, BitsPerDimension, T>::find(const morton_code<Dimension, BitsPerDimension> c) const {
+    // the index gives the run of index_stride intervals that can hold the first start after c
+    auto block = std::upper_bound(mapped_index.begin(), mapped_index.end(), c.data);
+    if (block == mapped_index.begin()) {
+        return nullptr;
+    }
+    const size_t first = static_cast<size_t>(block - mapped_index.begin() - 1) * header.index_stride;
+    const size_t last = std::min<size_t>(first + header.index_stride, mapped_intervals.size());
+    auto it = std::upper_bound(mapped_intervals.begin() + first, mapped_intervals.begin() + last, c.data,
+        [](uint64_t code, const interval_type& i) { return code < i.start; });
+    if (it == mapped_intervals.begin() + first) {
+        return nullptr;
+    }
+    --it;
+    return c.data <= it->end ? it : nullptr;
+}
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+template <typename M>
+bool mapped_region<Dimension, BitsPerDimension, T>::intersects(const region<Dimension, BitsPerDimension, M>& rhs, zinc::cpu::isa isa) const {
+    assert(std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+    return detail::interleaved_intersects(mapped_intervals.data(), mapped_intervals.size(), rhs.intervals.data(), rhs.intervals.size(), isa);
+}
+
+} //::morton
+
+} //::zinc
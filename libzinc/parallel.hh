@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include "AABB.hh"
+#include "region.hh"
+#include "sort.hh"
+#include "span.hh"
+#include "thread_pool.hh"
+
+namespace zinc {
+
+namespace morton {
+
+namespace detail {
+
+// Where a region's intervals are cut for the parallel set operations: the first
+// interval of each slice, in lhs and in rhs.
+struct split_point {
+    size_t lhs, rhs;
+};
+
+// The first interval starting at or after key. If the interval before it also reaches
+// key, key is moved past that interval's end and true is returned.
+template<typename Interval, typename Word>
+static bool clear_of(const std::vector<Interval>& intervals, Word& key, bool& past_end, size_t& position) {
+    auto it = std::partition_point(intervals.begin(), intervals.end(), [key](const Interval& i) { return i.start < key; });
+    position = static_cast<size_t>(it - intervals.begin());
+    if (it != intervals.begin() && std::prev(it)->end >= key) {
+        if (std::prev(it)->end == ~Word{0}) {
+            past_end = true;
+        } else {
+            key = std::prev(it)->end + 1;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Picks up to slices - 1 keys at even quantiles of the larger region, and moves each
+// forward until no interval in either region contains both key - 1 and key. No output
+// interval of a set operation can then straddle a key either, so the slices between the
+// keys can be processed independently and concatenated.
+template<typename L, typename R>
+static std::vector<split_point> split_points(const L& lhs, const R& rhs, size_t slices) {
+    const bool by_lhs = lhs.size() >= rhs.size();
+    const size_t n = by_lhs ? lhs.size() : rhs.size();
+    if (n == 0) {
+        return {{0, 0}, {lhs.size(), rhs.size()}};
+    }
+    using word_type = typename L::value_type::word_type;
+    std::vector<split_point> points {{0, 0}};
+    word_type key = 0;
+    for (size_t j = 1; j < slices; j++) {
+        word_type quantile = by_lhs ? lhs[j * n / slices].start : rhs[j * n / slices].start;
+        key = std::max(key, quantile);
+        bool past_end = false;
+        split_point p {0, 0};
+        bool moved = true;
+        while (moved && !past_end) {
+            moved = clear_of(lhs, key, past_end, p.lhs);
+            moved = clear_of(rhs, key, past_end, p.rhs) || moved;
+        }
+        if (past_end) {
+            break;
+        }
+        if (p.lhs != points.back().lhs || p.rhs != points.back().rhs) {
+            points.push_back(p);
+        }
+    }
+    points.push_back({lhs.size(), rhs.size()});
+    return points;
+}
+
+// Writes the slices one after another over target, copying them in parallel. When
+// coalesce is set, the intervals at the start of each slice that the slices before reach
+// are folded into them, as a serial union would.
+template<typename Interval>
+static void join_slices(std::vector<std::vector<Interval>>& out, std::vector<Interval>& target, thread_pool& pool, bool coalesce) {
+    const size_t slices = out.size();
+    std::vector<size_t> skip(slices, 0), offsets(slices + 1, 0);
+    Interval* last = nullptr;
+    for (size_t j = 0; j < slices; j++) {
+        while (coalesce && last != nullptr && skip[j] < out[j].size() && can_coalesce(*last, out[j][skip[j]])) {
+            last->end = std::max(last->end, out[j][skip[j]].end);
+            skip[j]++;
+        }
+        if (out[j].size() > skip[j]) {
+            last = &out[j].back();
+        }
+        offsets[j + 1] = offsets[j] + out[j].size() - skip[j];
+    }
+    target.clear();
+    if (offsets.back() == 0) {
+        return;
+    }
+    target.resize(offsets.back(), *last);
+    pool.parallel_for(slices, [&](size_t j) {
+        std::copy(out[j].begin() + static_cast<ptrdiff_t>(skip[j]), out[j].end(), target.begin() + static_cast<ptrdiff_t>(offsets[j]));
+    });
+}
+
+// Runs merge on each slice of lhs and rhs across the pool, then writes the slices'
+// results back over lhs.
+template<typename Interval, typename M, typename Merge>
+static void parallel_merge(std::vector<Interval>& lhs, const std::vector<M>& rhs, thread_pool& pool, bool coalesce, Merge merge) {
+    auto points = split_points(lhs, rhs, pool.size() * 4);
+    const size_t slices = points.size() - 1;
+    std::vector<std::vector<Interval>> out(slices);
+    pool.parallel_for(slices, [&](size_t j) {
+        const auto &a = points[j], &b = points[j + 1];
+        out[j].reserve(b.lhs - a.lhs + b.rhs - a.rhs);
+        merge(lhs.begin() + static_cast<ptrdiff_t>(a.lhs), lhs.begin() + static_cast<ptrdiff_t>(b.lhs),
+              rhs.begin() + static_cast<ptrdiff_t>(a.rhs), rhs.begin() + static_cast<ptrdiff_t>(b.rhs),
+              std::back_inserter(out[j]));
+    });
+    join_slices(out, lhs, pool, coalesce);
+}
+
+} //::detail
+
+// Parallel versions of |=, &= and -= for very large regions. Both regions are cut at
+// the same points of the curve, the slices are merged on the pool, and the results are
+// joined back together. The result is identical to the serial operator's, given regions
+// whose intervals are sorted and don't overlap. A pool of one thread runs the serial operator.
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+static void parallel_union(region<Dimension, BitsPerDimension, T>& lhs, const region<Dimension, BitsPerDimension, T>& rhs, thread_pool& pool) {
+    assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+    if (&lhs == &rhs || pool.size() == 1) {
+        lhs |= rhs;
+        return;
+    }
+    detail::parallel_merge(lhs.intervals, rhs.intervals, pool, true, [](auto... args) { return detail::merge_union(args...); });
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename M>
+static void parallel_intersection(region<Dimension, BitsPerDimension, T>& lhs, const region<Dimension, BitsPerDimension, M>& rhs, thread_pool& pool) {
+    assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+    if (pool.size() == 1) {
+        lhs &= rhs;
+        return;
+    }
+    detail::parallel_merge(lhs.intervals, rhs.intervals, pool, false, [](auto... args) { return detail::merge_intersection(args...); });
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename M>
+static void parallel_difference(region<Dimension, BitsPerDimension, T>& lhs, const region<Dimension, BitsPerDimension, M>& rhs, thread_pool& pool) {
+    assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+    if (pool.size() == 1) {
+        lhs -= rhs;
+        return;
+    }
+    detail::parallel_merge(lhs.intervals, rhs.intervals, pool, false, [](auto... args) { return detail::merge_difference(args...); });
+}
+
+// regions_from_aabbs across the pool, with the same result. Each thread decomposes, sorts
+// and coalesces a run of the boxes. The curve is then cut at quantiles of those runs'
+// starts, and each thread sorts and coalesces the intervals of every run that start in one
+// piece of the curve.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+static region<Dimension, BitsPerDimension> parallel_regions_from_aabbs(zinc::span<const AABB<Dimension, BitsPerDimension>> boxes, thread_pool& pool) {
+    using interval_type = detail::interval<Dimension, BitsPerDimension>;
+    using word_type = typename interval_type::word_type;
+    if (pool.size() == 1) {
+        return regions_from_aabbs(boxes);
+    }
+    const size_t slices = pool.size() * 4;
+    std::vector<region<Dimension, BitsPerDimension>> runs(std::min(slices, boxes.size()));
+    pool.parallel_for(runs.size(), [&](size_t j) {
+        const size_t first = j * boxes.size() / runs.size(), last = (j + 1) * boxes.size() / runs.size();
+        runs[j] = regions_from_aabbs(boxes.subspan(first, last - first));
+    });
+
+    std::vector<word_type> samples;
+    for (auto& run : runs) {
+        for (size_t k = 1; k < slices && !run.intervals.empty(); k++) {
+            samples.push_back(run.intervals[k * run.intervals.size() / slices].start);
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+    // the first start of each piece, the first piece starting at the start of the curve
+    std::vector<word_type> keys {0};
+    for (size_t k = 1; k < slices && !samples.empty(); k++) {
+        const word_type key = samples[k * samples.size() / slices];
+        if (key != keys.back()) {
+            keys.push_back(key);
+        }
+    }
+
+    std::vector<std::vector<interval_type>> out(keys.size());
+    pool.parallel_for(keys.size(), [&](size_t j) {
+        for (auto& run : runs) {
+            auto starting_before = [](word_type key) {
+                return [key](const interval_type& i) { return i.start < key; };
+            };
+            auto first = std::partition_point(run.intervals.begin(), run.intervals.end(), starting_before(keys[j]));
+            auto last = j + 1 == keys.size() ? run.intervals.end() : std::partition_point(first, run.intervals.end(), starting_before(keys[j + 1]));
+            out[j].insert(out[j].end(), first, last);
+        }
+        auto& v = out[j];
+        zinc::radix_sort(v, [](const interval_type& i) { return word_type{i.start}; }, detail::scratch_intervals<interval_type>());
+        v.erase(detail::merge_union(v.begin(), v.end(), v.end(), v.end(), v.begin()), v.end());
+    });
+    region<Dimension, BitsPerDimension> r;
+    detail::join_slices(out, r.intervals, pool, true);
+    return r;
+}
+
+} //::morton
+
+} //::zinc
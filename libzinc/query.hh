@@ -0,0 +1,327 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "AABB.hh"
+#include "encoding.hh"
+#include "span.hh"
+
+namespace zinc {
+
+namespace morton {
+
+namespace detail {
+
+// Returns the first of the ascending codes in [it, end) that is at least c, by an
+// exponential search for a bound followed by a binary search, so short skips stay cheap.
+template<typename Word>
+static const Word* gallop_to(const Word* it, const Word* end, Word c) {
+    size_t step = 1;
+    while (it + step < end && it[step] < c) {
+        it += step;
+        step *= 2;
+    }
+    return std::lower_bound(it, std::min(it + step + 1, end), c);
+}
+
+// The squared distance from centre to p, and to the nearest point of the box [lo, hi].
+template<typename Coordinate, size_t Dimension>
+static double distance_squared(const std::array<Coordinate, Dimension>& centre, const std::array<Coordinate, Dimension>& p) {
+    double d2 = 0;
+    for (size_t d = 0; d < Dimension; d++) {
+        const double delta = static_cast<double>(centre[d]) - static_cast<double>(p[d]);
+        d2 += delta * delta;
+    }
+    return d2;
+}
+
+template<typename Coordinate, size_t Dimension>
+static double distance_squared(const std::array<Coordinate, Dimension>& centre, const std::array<Coordinate, Dimension>& lo, const std::array<Coordinate, Dimension>& hi) {
+    std::array<Coordinate, Dimension> nearest;
+    for (size_t d = 0; d < Dimension; d++) {
+        nearest[d] = std::min(std::max(centre[d], lo[d]), hi[d]);
+    }
+    return distance_squared(centre, nearest);
+}
+
+// The corners of the cube of half side h around centre, clipped to the space.
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename Coordinate>
+static std::pair<std::array<Coordinate, Dimension>, std::array<Coordinate, Dimension>> cube_around(const std::array<Coordinate, Dimension>& centre, Coordinate h) {
+    const Coordinate last = static_cast<Coordinate>(~Coordinate{0} >> (sizeof(Coordinate) * 8 - BitsPerDimension));
+    std::array<Coordinate, Dimension> lo, hi;
+    for (size_t d = 0; d < Dimension; d++) {
+        lo[d] = centre[d] > h ? static_cast<Coordinate>(centre[d] - h) : 0;
+        hi[d] = last - centre[d] > h ? static_cast<Coordinate>(centre[d] + h) : last;
+    }
+    return {lo, hi};
+}
+
+} //::detail
+
+// The codes of a sorted array that are inside a box, as the index ranges [first, last) of
+// the runs of them, in order. Nothing is decomposed up front: the box is split as in
+// AABB::to_cells as the scan goes, and a piece holding none of the codes is passed over
+// whole. From a code outside the box the scan jumps to the next code the box holds, BIGMIN
+// in Tropf and Herzog, Multidimensional Range Search in Dynamically Balanced Trees, 1981,
+// and from a code inside it to the end of the box's cell holding it. Runs of codes in
+// neighbouring cells are joined.
+//
+// The codes must outlive the query, and stay sorted and unchanged while it is used.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+class sorted_query {
+public:
+    using word_type = typename morton_code<Dimension, BitsPerDimension>::word_type;
+
+    sorted_query(zinc::span<const word_type> _codes, const AABB<Dimension, BitsPerDimension>& _box): codes(_codes), box(_box) {
+        assert(std::is_sorted(codes.begin(), codes.end()));
+    }
+
+    class iterator {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            typedef std::pair<size_t, size_t> value_type;
+            typedef ptrdiff_t difference_type;
+            typedef const value_type* pointer;
+            typedef const value_type& reference;
+
+            iterator(const sorted_query* _parent, bool finished): parent(_parent), value({0, 0}), position(0), is_finished(finished) {
+                if (!is_finished) {
+                    pieces.push_back(parent->box);
+                    position = static_cast<size_t>(std::lower_bound(parent->codes.begin(), parent->codes.end(), word_type{parent->box.min}) - parent->codes.begin());
+                    progress();
+                }
+            }
+
+            iterator &operator++() {
+                progress();
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator i = *this;
+                progress();
+                return i;
+            }
+
+            bool operator==(const iterator &i) const {
+                return is_finished == i.is_finished && (is_finished || value == i.value);
+            }
+
+            bool operator!=(const iterator &i) const {
+                return !(*this == i);
+            }
+
+            reference operator*() const {
+                return value;
+            }
+
+            pointer operator->() const {
+                return &value;
+            }
+
+        private:
+            const sorted_query* parent;
+            value_type value;
+            // the first code not yet scanned
+            size_t position;
+            // the pieces of the box that codes from position on may be in, the next at the back
+            typename AABB<Dimension, BitsPerDimension>::split_stack pieces;
+            bool is_finished;
+
+            void progress() {
+                const word_type* codes = parent->codes.data();
+                const size_t n = parent->codes.size();
+                size_t first = n;
+                while (position < n && !pieces.empty()) {
+                    AABB<Dimension, BitsPerDimension> piece = pieces.back();
+                    const word_type c = codes[position];
+                    if (c > piece.max) {
+                        pieces.pop_back();
+                        continue;
+                    }
+                    if (c < piece.min) {
+                        // outside the box, which ends the run, if there is one
+                        if (first != n) {
+                            break;
+                        }
+                        position = static_cast<size_t>(detail::gallop_to<word_type>(codes + position, codes + n, piece.min) - codes);
+                        continue;
+                    }
+                    pieces.pop_back();
+                    if (!piece.is_morton_aligned()) {
+                        auto [litmax, bigmin] = piece.morton_get_next_address();
+                        pieces.push_back({bigmin, piece.max});
+                        pieces.push_back({piece.min, litmax});
+                        continue;
+                    }
+                    if (first == n) {
+                        first = position;
+                    }
+                    if (piece.max == ~word_type{0}) {
+                        position = n;
+                    } else {
+                        position = static_cast<size_t>(detail::gallop_to<word_type>(codes + position, codes + n, piece.max + 1) - codes);
+                    }
+                }
+                if (first == n) {
+                    is_finished = true;
+                    return;
+                }
+                value = {first, position};
+            }
+    };
+
+    iterator begin() const {
+        return iterator(this, false);
+    }
+
+    iterator end() const {
+        return iterator(this, true);
+    }
+
+private:
+    zinc::span<const word_type> codes;
+    AABB<Dimension, BitsPerDimension> box;
+};
+
+// The runs of codes inside box, see sorted_query.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+static sorted_query<Dimension, BitsPerDimension> query_sorted(zinc::span<const typename morton_code<Dimension, BitsPerDimension>::word_type> codes, const AABB<Dimension, BitsPerDimension>& box) {
+    return {codes, box};
+}
+
+// Appends to out the indices of the sorted codes within radius of centre, in order: the
+// codes in the cube around the ball are found with query_sorted, and decoded to be measured.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+static void query_radius(zinc::span<const typename morton_code<Dimension, BitsPerDimension>::word_type> codes,
+                         const std::array<typename morton_code<Dimension, BitsPerDimension>::coordinate_type, Dimension>& centre, double radius, std::vector<size_t>& out) {
+    using code_type = morton_code<Dimension, BitsPerDimension>;
+    using coordinate_type = typename code_type::coordinate_type;
+    assert(radius >= 0);
+    const double last = static_cast<double>(~coordinate_type{0} >> (sizeof(coordinate_type) * 8 - BitsPerDimension));
+    const auto h = static_cast<coordinate_type>(std::min(std::ceil(radius), last));
+    const auto [lo, hi] = detail::cube_around<Dimension, BitsPerDimension>(centre, h);
+    const double r2 = radius * radius;
+    for (auto run : query_sorted<Dimension, BitsPerDimension>(codes, {code_type::encode(lo), code_type::encode(hi)})) {
+        for (size_t i = run.first; i < run.second; i++) {
+            if (detail::distance_squared(centre, code_type::decode(codes[i])) <= r2) {
+                out.push_back(i);
+            }
+        }
+    }
+}
+
+// Writes to out the indices of the k sorted codes nearest centre, nearest first, or of all
+// of them if there are no more than k.
+//
+// The codes either side of centre's own code are near it along the curve, so the k nearest
+// of those give a first cube around centre that holds at least k codes. Once that cube is
+// searched, the kth nearest found so far bounds the ball the answer lies in, and the search
+// grows to the cube around that ball. Only the ring between the two cubes is searched, in a
+// box for each face, and a face no nearer than the kth nearest found is passed over.
+template<uint32_t Dimension, uint32_t BitsPerDimension>
+static void query_nearest(zinc::span<const typename morton_code<Dimension, BitsPerDimension>::word_type> codes,
+                          const std::array<typename morton_code<Dimension, BitsPerDimension>::coordinate_type, Dimension>& centre, size_t k, std::vector<size_t>& out) {
+    using code_type = morton_code<Dimension, BitsPerDimension>;
+    using coordinate_type = typename code_type::coordinate_type;
+    using box_type = std::array<coordinate_type, Dimension>;
+    assert(std::is_sorted(codes.begin(), codes.end()));
+    out.clear();
+    k = std::min(k, codes.size());
+    if (k == 0) {
+        return;
+    }
+    const coordinate_type last = static_cast<coordinate_type>(~coordinate_type{0} >> (sizeof(coordinate_type) * 8 - BitsPerDimension));
+
+    // the k nearest found so far, as a heap with the farthest on top
+    std::vector<std::pair<double, size_t>> heap;
+    heap.reserve(k + 1);
+    auto consider = [&](size_t i) {
+        const double d2 = detail::distance_squared(centre, code_type::decode(codes[i]));
+        if (heap.size() < k || d2 < heap.front().first) {
+            heap.push_back({d2, i});
+            std::push_heap(heap.begin(), heap.end());
+            if (heap.size() > k) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.pop_back();
+            }
+        }
+    };
+    auto search = [&](const box_type& lo, const box_type& hi) {
+        if (heap.size() == k && detail::distance_squared(centre, lo, hi) >= heap.front().first) {
+            return;
+        }
+        for (auto run : query_sorted<Dimension, BitsPerDimension>(codes, {code_type::encode(lo), code_type::encode(hi)})) {
+            for (size_t i = run.first; i < run.second; i++) {
+                consider(i);
+            }
+        }
+    };
+
+    // the half side of the first cube, from the codes around centre's
+    const size_t at = static_cast<size_t>(std::lower_bound(codes.begin(), codes.end(), code_type::encode(centre).data) - codes.begin());
+    const size_t from = at - std::min(at, k), to = std::min(codes.size(), at + k);
+    std::vector<coordinate_type> reach;
+    reach.reserve(to - from);
+    for (size_t i = from; i < to; i++) {
+        const auto p = code_type::decode(codes[i]);
+        coordinate_type r = 0;
+        for (size_t d = 0; d < Dimension; d++) {
+            r = std::max<coordinate_type>(r, centre[d] > p[d] ? centre[d] - p[d] : p[d] - centre[d]);
+        }
+        reach.push_back(r);
+    }
+    std::nth_element(reach.begin(), reach.begin() + static_cast<ptrdiff_t>(k - 1), reach.end());
+    coordinate_type h = reach[k - 1];
+    auto [lo, hi] = detail::cube_around<Dimension, BitsPerDimension>(centre, h);
+    search(lo, hi);
+    assert(heap.size() == k);
+
+    while (true) {
+        const double reach_needed = std::ceil(std::sqrt(heap.front().first));
+        if (reach_needed <= static_cast<double>(h) || h == last) {
+            break;
+        }
+        const auto grown = static_cast<coordinate_type>(std::min(reach_needed, static_cast<double>(last)));
+        const auto [outer_lo, outer_hi] = detail::cube_around<Dimension, BitsPerDimension>(centre, grown);
+        // the ring as a box below and above the inner cube along each axis, over the
+        // outer cube on the axes after it and the inner cube on the axes before it
+        for (size_t d = 0; d < Dimension; d++) {
+            box_type slab_lo = outer_lo, slab_hi = outer_hi;
+            for (size_t e = 0; e < d; e++) {
+                slab_lo[e] = lo[e];
+                slab_hi[e] = hi[e];
+            }
+            if (outer_lo[d] < lo[d]) {
+                box_type below = slab_hi;
+                below[d] = static_cast<coordinate_type>(lo[d] - 1);
+                search(slab_lo, below);
+            }
+            if (hi[d] < outer_hi[d]) {
+                box_type above = slab_lo;
+                above[d] = static_cast<coordinate_type>(hi[d] + 1);
+                search(above, slab_hi);
+            }
+        }
+        h = grown;
+        lo = outer_lo;
+        hi = outer_hi;
+    }
+    std::sort_heap(heap.begin(), heap.end());
+    for (auto& [d2, i] : heap) {
+        out.push_back(i);
+    }
+}
+
+} //::morton
+
+} //::zinc
@@ -4,285 +4,761 @@
 #include <cassert>
 
 #include <algorithm>
+#include <array>
+#include <iterator>
 #include <vector>
 #include <tuple>
+#include <optional>
 #include <variant>
 #include <type_traits>
 
+#include "cpu.hh"
 #include "encoding.hh"
 #include "interval.hh"
+#include "simd.hh"
+#include "sort.hh"
+#include "span.hh"
 #include <immintrin.h>
 
 namespace zinc {
 
 namespace morton {
 
+namespace detail {
+
+// Whether x, which doesn't start before pending, can be folded into pending by a union:
+// it overlaps or touches pending and carries the same data.
+template<typename Interval>
+static bool can_coalesce(const Interval& pending, const Interval& x) {
+    return (x.start <= pending.end || x.start - 1 == pending.end) && x.data_equals(pending);
+}
+
+// Merges two sorted ranges of intervals into out, folding overlapping or touching
+// intervals with the same data together. Ties are taken from the first range.
+// out may point into the storage of the first range, as long as it is at least as far
+// before the first range as the second range is long, since writes trail reads.
+template<typename It1, typename It2, typename Out>
+static Out merge_union(It1 lhs_it, It1 lhs_end, It2 rhs_it, It2 rhs_end, Out out) {
+    using interval_type = typename std::iterator_traits<It1>::value_type;
+    auto next = [&]() -> interval_type {
+        if (rhs_it == rhs_end || (lhs_it != lhs_end && !(*rhs_it < *lhs_it))) {
+            return *lhs_it++;
+        }
+        return *rhs_it++;
+    };
+    if (lhs_it == lhs_end && rhs_it == rhs_end) {
+        return out;
+    }
+    interval_type pending = next();
+    while (lhs_it != lhs_end || rhs_it != rhs_end) {
+        interval_type x = next();
+        if (can_coalesce(pending, x)) {
+            pending.end = std::max(pending.end, x.end);
+        } else {
+            *out++ = pending;
+            pending = x;
+        }
+    }
+    *out++ = pending;
+    return out;
+}
+
+// Writes the intersection of two sorted ranges of intervals to out,
+// each piece keeping the data of the first range's interval.
+template<typename It1, typename It2, typename Out>
+static Out merge_intersection(It1 lhs_it, It1 lhs_end, It2 rhs_it, It2 rhs_end, Out out) {
+    using interval_type = typename std::iterator_traits<It1>::value_type;
+    using word_type = typename interval_type::word_type;
+    while(lhs_it != lhs_end && rhs_it != rhs_end){
+        if (lhs_it->end < rhs_it->start) {
+            ++lhs_it;
+            continue;
+        } else if (rhs_it->end < lhs_it->start) {
+            ++rhs_it;
+            continue;
+        }
+        word_type s = std::max<word_type>(lhs_it->start, rhs_it->start);
+        word_type e = std::min<word_type>(lhs_it->end, rhs_it->end);
+        *out++ = interval_type{s, e, lhs_it->data};
+        if (lhs_it->end < rhs_it->end){
+            ++lhs_it;
+        } else if(rhs_it->end < lhs_it->end) {
+            ++rhs_it;
+        } else {
+            ++rhs_it;
+            ++lhs_it;
+        }
+    }
+    return out;
+}
+
+// Writes the parts of the first sorted range of intervals that aren't covered
+// by the second to out, each keeping its data.
+template<typename It1, typename It2, typename Out>
+static Out merge_difference(It1 lhs_it, It1 lhs_end, It2 rhs_it, It2 rhs_end, Out out) {
+    using interval_type = typename std::iterator_traits<It1>::value_type;
+    typename interval_type::word_type s = 0;
+    if (lhs_it != lhs_end) {
+         s = lhs_it->start;
+    }
+    while(lhs_it != lhs_end && rhs_it != rhs_end){
+        if (lhs_it->end < rhs_it->start ){ //if the lhs is entirely behind the rhs push the lhs
+            // lhs: |------|
+            // rhs:          |--|
+            *out++ = interval_type{s, lhs_it->end, lhs_it->data};
+            ++lhs_it;
+            if (lhs_it != lhs_end) {
+                s = lhs_it->start;
+            }
+            continue;
+        }
+        if (s > rhs_it->end){ // if the rhs is entirely behind the lhs, push the rhs
+            // lhs:      |---|
+            // rhs:|--|
+            ++rhs_it;
+            continue;
+        }
+        // we know now that the rhs collides with the lhs
+        if (s >= rhs_it->start){
+            //      A       |  |     B
+            // lhs:  |---|  |or|     |---|
+            // rhs:|--|     |  | |-------|
+            if (lhs_it->end <= rhs_it->end){ // case B - move onto the next interval
+                ++lhs_it;
+                if (lhs_it != lhs_end) {
+                    s = lhs_it->start;
+                }
+            } else { // case A - split the interval and check the next rhs segment
+                s = rhs_it->end + 1;
+                ++rhs_it;
+            }
+            continue;
+        }
+        // s must be < rhs
+        //      A     |  |     B
+        // lhs:|---|  |or| |---|
+        // rhs: |-|   |  |   |----|
+        *out++ = interval_type{s, rhs_it->start - 1, lhs_it->data};
+        if (rhs_it->end < lhs_it->end) { // case A
+            s = rhs_it->end + 1;
+            ++rhs_it;
+        } else { // case B
+            ++lhs_it;
+            if (lhs_it != lhs_end) {
+                s = lhs_it->start;
+            }
+        }
+    }
+    if (lhs_it != lhs_end) {
+        //push the last one, then copy the rest
+        *out++ = interval_type{s, lhs_it->end, lhs_it->data};
+        out = std::copy(++lhs_it, lhs_end, out);
+    }
+    return out;
+}
+
+// Returns the first interval in [it, end) ending at or after c, by an exponential
+// search for a bound followed by a binary search, so short skips stay cheap.
+template<typename Interval>
+static const Interval* gallop_to_end(const Interval* it, const Interval* end, typename Interval::word_type c) {
+    size_t step = 1;
+    while (it + step < end && it[step].end < c) {
+        it += step;
+        step *= 2;
+    }
+    return std::partition_point(it, std::min(it + step + 1, end), [c](const Interval& x) { return x.end < c; });
+}
+
+// Calls emit(i, interval) for the n ascending codes code(0) ... code(n-1),
+// moving forward through the intervals by galloping then binary searching.
+template<typename Interval, typename Code, typename Emit>
+static void merge_lookup(const std::vector<Interval>& intervals, size_t n, Code code, Emit emit) {
+    size_t i = 0;
+    for (size_t q = 0; q < n; q++) {
+        const typename Interval::word_type c = code(q);
+        assert(q == 0 || code(q - 1) <= c);
+        if (i < intervals.size() && intervals[i].end < c) {
+            i = static_cast<size_t>(gallop_to_end(intervals.data() + i, intervals.data() + intervals.size(), c) - intervals.data());
+        }
+        emit(q, i < intervals.size() && intervals[i].start <= c ? &intervals[i] : nullptr);
+    }
+}
+
+// Writes the parts of two sorted ranges of intervals covered by exactly one of them to out,
+// each keeping the data of the interval it came from. Touching pieces with the same data
+// are coalesced, so the result matches (lhs - rhs) | (rhs - lhs).
+template<typename It1, typename It2, typename Out>
+static Out merge_symmetric_difference(It1 lhs_it, It1 lhs_end, It2 rhs_it, It2 rhs_end, Out out) {
+    using interval_type = typename std::iterator_traits<It1>::value_type;
+    using word_type = typename interval_type::word_type;
+    std::optional<interval_type> pending;
+    auto emit = [&](word_type s, word_type e, const auto& data) {
+        interval_type x {s, e, data};
+        if (pending && can_coalesce(*pending, x)) {
+            pending->end = std::max(pending->end, x.end);
+        } else {
+            if (pending) {
+                *out++ = *pending;
+            }
+            pending = x;
+        }
+    };
+    // the start of what is left of the current interval on each side
+    word_type ls = lhs_it != lhs_end ? static_cast<word_type>(lhs_it->start) : 0;
+    word_type rs = rhs_it != rhs_end ? static_cast<word_type>(rhs_it->start) : 0;
+    auto next_lhs = [&]() { if (++lhs_it != lhs_end) ls = lhs_it->start; };
+    auto next_rhs = [&]() { if (++rhs_it != rhs_end) rs = rhs_it->start; };
+    while (lhs_it != lhs_end && rhs_it != rhs_end) {
+        if (lhs_it->end < rs) { // lhs: |--|  rhs:     |--|
+            emit(ls, lhs_it->end, lhs_it->data);
+            next_lhs();
+        } else if (rhs_it->end < ls) { // lhs:     |--|  rhs: |--|
+            emit(rs, rhs_it->end, rhs_it->data);
+            next_rhs();
+        } else if (ls < rs) { // they overlap, emit the part of lhs in front
+            emit(ls, rs - 1, lhs_it->data);
+            ls = rs;
+        } else if (rs < ls) {
+            emit(rs, ls - 1, rhs_it->data);
+            rs = ls;
+        } else { // both start together, drop the common part
+            word_type e = std::min<word_type>(lhs_it->end, rhs_it->end);
+            if (lhs_it->end == e) {
+                next_lhs();
+            } else {
+                ls = e + 1;
+            }
+            if (rhs_it->end == e) {
+                next_rhs();
+            } else {
+                rs = e + 1;
+            }
+        }
+    }
+    for (; lhs_it != lhs_end; next_lhs()) {
+        emit(ls, lhs_it->end, lhs_it->data);
+    }
+    for (; rhs_it != rhs_end; next_rhs()) {
+        emit(rs, rhs_it->end, rhs_it->data);
+    }
+    if (pending) {
+        *out++ = *pending;
+    }
+    return out;
+}
+
+// A per-thread buffer for set operations that can't write their result in place.
+template<typename Interval>
+static std::vector<Interval>& scratch_intervals() {
+    static thread_local std::vector<Interval> scratch;
+    return scratch;
+}
+
+// The cells of each interval in a sorted run of intervals, one interval after another,
+// without storing them.
+template<typename Interval>
+struct cells_of_intervals {
+    using cell_iterator = decltype(std::declval<const Interval&>().cells(0).begin());
+    const Interval* first;
+    const Interval* last;
+    size_t max_level;
+
+    class iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef Interval value_type;
+            typedef ptrdiff_t difference_type;
+            typedef const value_type *pointer;
+            typedef const value_type &reference;
+
+            iterator(const Interval* _it, const Interval* _end, size_t _max_level): it(_it), end(_end), max_level(_max_level) {
+                if (it != end) {
+                    cell = it->cells(max_level).begin();
+                }
+            }
+
+            iterator &operator++() {
+                if (++cell == cell_iterator()) {
+                    if (++it != end) {
+                        cell = it->cells(max_level).begin();
+                    }
+                }
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator i = *this;
+                ++*this;
+                return i;
+            }
+
+            bool operator==(const iterator &i) const {
+                return it == i.it && (it == end || cell == i.cell);
+            }
+
+            bool operator!=(const iterator &i) const {
+                return !(*this == i);
+            }
+
+            reference operator*() const {
+                return *cell;
+            }
+
+            pointer operator->() const {
+                return &*cell;
+            }
+
+        private:
+            const Interval* it;
+            const Interval* end;
+            size_t max_level;
+            cell_iterator cell;
+    };
+
+    iterator begin() const {
+        return iterator(first, last, max_level);
+    }
+
+    iterator end() const {
+        return iterator(last, last, max_level);
+    }
+};
+
+// The SIMD kernels in simd.hh read the intervals where they lie: each interval is a run of
+// uint64_t's beginning with its start and end, and the kernels step over the data between.
+// Codes wider than a word take the plain loops instead.
+template<typename Interval>
+static const uint64_t* interval_words(const Interval* intervals) {
+    static_assert(sizeof(Interval) % sizeof(uint64_t) == 0 && sizeof(Interval::start) == sizeof(uint64_t),
+        "intervals are read as a stride of uint64_t's");
+    return reinterpret_cast<const uint64_t*>(intervals);
+}
+
+template<typename Interval>
+static typename Interval::word_type interleaved_area(const Interval* intervals, size_t n, zinc::cpu::isa isa) {
+    assert(zinc::cpu::supports(isa));
+    if constexpr (!std::is_same<typename Interval::word_type, uint64_t>::value) {
+        typename Interval::word_type area = 0;
+        for (size_t i = 0; i < n; i++) {
+            area += intervals[i].area();
+        }
+        return area;
+    } else {
+        constexpr size_t stride = sizeof(Interval) / sizeof(uint64_t);
+        const uint64_t* words = interval_words(intervals);
+        switch (isa) {
+            case zinc::cpu::isa::avx512: return simd::area_interleaved_avx512<stride>(words, n);
+            case zinc::cpu::isa::avx2: return simd::area_interleaved_avx2<stride>(words, n);
+            case zinc::cpu::isa::scalar: break;
+        }
+        return simd::area_interleaved_scalar<stride>(words, n);
+    }
+}
+
+template<typename IntervalA, typename IntervalB>
+static bool interleaved_intersects(const IntervalA* a, size_t na, const IntervalB* b, size_t nb, zinc::cpu::isa isa) {
+    assert(zinc::cpu::supports(isa));
+    if constexpr (!std::is_same<typename IntervalA::word_type, uint64_t>::value) {
+        for (size_t i = 0, j = 0; i < na && j < nb;) {
+            if (a[i].end < b[j].start) {
+                i++;
+            } else if (b[j].end < a[i].start) {
+                j++;
+            } else {
+                return true;
+            }
+        }
+        return false;
+    } else {
+        constexpr size_t stride_a = sizeof(IntervalA) / sizeof(uint64_t), stride_b = sizeof(IntervalB) / sizeof(uint64_t);
+        const uint64_t *a_words = interval_words(a), *b_words = interval_words(b);
+        switch (isa) {
+            case zinc::cpu::isa::avx512: return simd::intersects_avx512<stride_a, stride_b>(a_words, a_words + 1, na, b_words, b_words + 1, nb);
+            case zinc::cpu::isa::avx2: return simd::intersects_avx2<stride_a, stride_b>(a_words, a_words + 1, na, b_words, b_words + 1, nb);
+            case zinc::cpu::isa::scalar: break;
+        }
+        return simd::intersects_scalar<stride_a, stride_b>(a_words, a_words + 1, na, b_words, b_words + 1, nb);
+    }
+}
+
+} //::detail
+
 //https://en.wikipedia.org/wiki/Linear_octree
 //https://geidav.wordpress.com/2014/08/18/advanced-octrees-2-node-representations/
 //(see Linear (hashed) Octrees section
-template <uint32_t Dimension, uint32_t BitsPerDimension, typename T = std::monostate>
+//
+// Curve is the curve the intervals are on, morton_curve or hilbert_curve. The set
+// operations and lookups only compare codes, so they are the same on either.
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T = std::monostate, typename Curve = morton_curve>
 struct region {
-    using interval_type = morton::detail::interval<Dimension, BitsPerDimension, T>;
+    using interval_type = morton::detail::interval<Dimension, BitsPerDimension, T, Curve>;
+    using code_type = typename interval_type::code_type;
+    using word_type = typename interval_type::word_type;
     std::vector<interval_type> intervals;
 
     template<typename M = std::monostate>
-    friend bool operator==(const region& lhs, const region<Dimension, BitsPerDimension, M>& rhs) {
+    friend bool operator==(const region& lhs, const region<Dimension, BitsPerDimension, M, Curve>& rhs) {
         return lhs.intervals == rhs.intervals;
     }
 
     friend region operator|(const region& lhs, const region& rhs) {
-        region r = lhs;
-        r |= rhs;
+        assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+        region r;
+        r.intervals.reserve(lhs.intervals.size() + rhs.intervals.size());
+        detail::merge_union(lhs.intervals.begin(), lhs.intervals.end(), rhs.intervals.begin(), rhs.intervals.end(), std::back_inserter(r.intervals));
         return r;
     }
 
     template<typename M = std::monostate>
-    friend region operator&(const region& lhs, const region<Dimension, BitsPerDimension, M>& rhs) {
-        region r = lhs;
-        r &= rhs;
+    friend region operator&(const region& lhs, const region<Dimension, BitsPerDimension, M, Curve>& rhs) {
+        assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+        region r;
+        detail::merge_intersection(lhs.intervals.begin(), lhs.intervals.end(), rhs.intervals.begin(), rhs.intervals.end(), std::back_inserter(r.intervals));
         return r;
     }
 
+    // this merges and coalesces in a single pass, in place, so it only allocates
+    // when lhs doesn't have the capacity for both regions
     friend void operator|=(region& lhs, const region& rhs) {
-        {
-            assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
-            size_t mid = lhs.intervals.size();
-            lhs.intervals.insert(lhs.intervals.end(), rhs.intervals.begin(), rhs.intervals.end());
-            std::inplace_merge(lhs.intervals.begin(), lhs.intervals.begin() + mid, lhs.intervals.end());
+        assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+        auto& v = lhs.intervals;
+        if (&lhs == &rhs) {
+            v.erase(detail::merge_union(v.begin(), v.end(), v.end(), v.end(), v.begin()), v.end());
+            return;
         }
-        std::vector<bool> to_delete(lhs.intervals.size());
-        for (size_t i = 0; i < lhs.intervals.size() - 1; i++) {
-            auto end = lhs.intervals[i].end;
-            size_t j;
-            for (j = i + 1;
-                j < lhs.intervals.size() &&
-                lhs.intervals[j].start-1 <= end && lhs.intervals[j].data_equals(lhs.intervals[i])
-            ; j++) {
-                end = std::max(end, lhs.intervals[j].end);
-            }
-            lhs.intervals[i].end = end;
-            for (size_t k = i+1; k < j; k++) {
-                to_delete[k] = true;
-            }
-            i = j-1; // to skip over the merged intervals
+        // move lhs to the back of the buffer, then merge forwards into the front.
+        // The write position never passes the read position in lhs.
+        const size_t n = v.size();
+        if (!rhs.intervals.empty()) {
+            v.resize(n + rhs.intervals.size(), rhs.intervals.front());
         }
-        auto it = to_delete.begin();
-        lhs.intervals.erase(
-            std::remove_if(lhs.intervals.begin(), lhs.intervals.end(),
-                [&it](const morton::detail::interval<Dimension, BitsPerDimension, T>& d) -> bool { return *it++; }
-            )
-        , lhs.intervals.end());
+        std::move_backward(v.begin(), v.begin() + static_cast<ptrdiff_t>(n), v.end());
+        auto lhs_begin = v.end() - static_cast<ptrdiff_t>(n);
+        v.erase(detail::merge_union(lhs_begin, v.end(), rhs.intervals.begin(), rhs.intervals.end(), v.begin()), v.end());
     }
 
+    // The result of &= and -= can't be written over lhs as it is read, so it is built in a
+    // per-thread scratch buffer whose storage is then swapped with lhs's. The old storage
+    // becomes the next scratch buffer, so neither reallocates once they are large enough.
+    // intersect and subtract do the same with a buffer of the caller's choosing.
+
     // this assumes regions contain a sorted list of morton intervals
     template<typename M = std::monostate>
-    friend void operator&=(region& lhs, const region<Dimension, BitsPerDimension, M>& rhs) {
+    friend void operator&=(region& lhs, const region<Dimension, BitsPerDimension, M, Curve>& rhs) {
+        intersect(lhs, rhs, detail::scratch_intervals<interval_type>());
+    }
+
+    template<typename M = std::monostate>
+    friend void operator-=(region& lhs, const region<Dimension, BitsPerDimension, M, Curve>& rhs) {
+        subtract(lhs, rhs, detail::scratch_intervals<interval_type>());
+    }
+
+    // xor, the parts covered by exactly one of the regions, in a single sweep over both
+    friend void operator^=(region& lhs, const region& rhs) {
+        symmetric_difference(lhs, rhs, detail::scratch_intervals<interval_type>());
+    }
+
+    template<typename M = std::monostate>
+    static void intersect(region& lhs, const region<Dimension, BitsPerDimension, M, Curve>& rhs, std::vector<interval_type>& scratch) {
         assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
-        auto lhs_it = lhs.intervals.begin();
-        auto rhs_it = rhs.intervals.begin();
-        std::vector<morton::detail::interval<Dimension, BitsPerDimension, T>> out = {};
-        while(lhs_it != lhs.intervals.end() && rhs_it != rhs.intervals.end()){
-            if (lhs_it->end < rhs_it->start) {
-                ++lhs_it;
-                continue;
-            } else if (rhs_it->end < lhs_it->start) {
-                ++rhs_it;
-                continue;
-            }
-            auto s = std::max(lhs_it->start, rhs_it->start);
-            auto e = std::min(lhs_it->end, rhs_it->end);
-            out.push_back(morton::detail::interval<Dimension, BitsPerDimension, T>{s,e, lhs_it->data});
-            if (lhs_it->end < rhs_it->end){
-                ++lhs_it;
-            } else if(rhs_it->end < lhs_it->end) {
-                ++rhs_it;
-            } else {
-                ++rhs_it;
-                ++lhs_it;
-            }
-        }
-        lhs.intervals = out;
+        scratch.clear();
+        detail::merge_intersection(lhs.intervals.begin(), lhs.intervals.end(), rhs.intervals.begin(), rhs.intervals.end(), std::back_inserter(scratch));
+        lhs.intervals.swap(scratch);
     }
 
     template<typename M = std::monostate>
-    friend void operator-=(region& lhs, const region<Dimension, BitsPerDimension, M>& rhs) {
+    static void subtract(region& lhs, const region<Dimension, BitsPerDimension, M, Curve>& rhs, std::vector<interval_type>& scratch) {
         assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
-        auto lhs_it = lhs.intervals.begin();
-        auto rhs_it = rhs.intervals.begin();
-        std::vector<morton::detail::interval<Dimension, BitsPerDimension, T>> out {};
-        morton_code<2, 32> s{0};
-        if (lhs_it != lhs.intervals.end()) {
-             s = lhs_it->start;
-        }
-        while(lhs_it != lhs.intervals.end() && rhs_it != rhs.intervals.end()){
-            if (lhs_it->end < rhs_it->start ){ //if the lhs is entirely behind the rhs push the lhs
-                // lhs: |------|
-                // rhs:          |--|
-                out.push_back(morton::detail::interval<Dimension, BitsPerDimension, T>{s,lhs_it->end, lhs_it->data});
-                ++lhs_it;
-                if (lhs_it != lhs.intervals.end()) {
-                    s = lhs_it->start;
-                }
-                continue;
-            }
-            if (s > rhs_it->end){ // if the rhs is entirely behind the lhs, push the rhs
-                // lhs:      |---|
-                // rhs:|--|
-                ++rhs_it;
-                continue;
-            }
-            // we know now that the rhs collides with the lhs
-            if (s >= rhs_it->start){
-                //      A       |  |     B
-                // lhs:  |---|  |or|     |---|
-                // rhs:|--|     |  | |-------|
-                if (lhs_it->end <= rhs_it->end){ // case B - move onto the next interval
-                    ++lhs_it;
-                    if (lhs_it != lhs.intervals.end()) {
-                        s = lhs_it->start;
-                    }
-                } else { // case A - split the interval and check the next rhs segment
-                    s = rhs_it->end + 1;
-                    ++rhs_it;
-                }
-                continue;
-            }
-            // s must be < rhs
-            //      A     |  |     B
-            // lhs:|---|  |or| |---|
-            // rhs: |-|   |  |   |----|
-            out.push_back({s,rhs_it->start-1,lhs_it->data});
-            if (rhs_it->end < lhs_it->end) { // case A
-                s = rhs_it->end +1;
-                ++rhs_it;
-            } else { // case B
-                ++lhs_it;
-                if (lhs_it != lhs.intervals.end()) {
-                    s = lhs_it->start;
-                }
-            }
-        }
-        if (lhs_it != lhs.intervals.end()) {
-            //push the last one, then copy the rest
-            out.push_back({s,lhs_it->end, lhs_it->data});
-            out.insert(out.end(), ++lhs_it, lhs.intervals.end());
-        }
-        lhs.intervals = out;
+        scratch.clear();
+        detail::merge_difference(lhs.intervals.begin(), lhs.intervals.end(), rhs.intervals.begin(), rhs.intervals.end(), std::back_inserter(scratch));
+        lhs.intervals.swap(scratch);
+    }
+
+    static void symmetric_difference(region& lhs, const region& rhs, std::vector<interval_type>& scratch) {
+        assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+        scratch.clear();
+        detail::merge_symmetric_difference(lhs.intervals.begin(), lhs.intervals.end(), rhs.intervals.begin(), rhs.intervals.end(), std::back_inserter(scratch));
+        lhs.intervals.swap(scratch);
+    }
+
+    friend region operator^(const region& lhs, const region& rhs) {
+        assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+        region r;
+        detail::merge_symmetric_difference(lhs.intervals.begin(), lhs.intervals.end(), rhs.intervals.begin(), rhs.intervals.end(), std::back_inserter(r.intervals));
+        return r;
     }
 
     template<typename M = std::monostate>
-    friend region operator-(const region& lhs, const region<Dimension, BitsPerDimension, M>& rhs) {
-        region x = lhs;
-        x -= rhs;
-        return x;
+    friend region operator-(const region& lhs, const region<Dimension, BitsPerDimension, M, Curve>& rhs) {
+        assert(std::is_sorted(lhs.intervals.begin(), lhs.intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+        region r;
+        detail::merge_difference(lhs.intervals.begin(), lhs.intervals.end(), rhs.intervals.begin(), rhs.intervals.end(), std::back_inserter(r.intervals));
+        return r;
     }
 
+    // Temporaries on the left hand side, as in (a | b) & c - d, are
+    // operated on in place and moved on, rather than copied at each step.
+    friend region operator|(region&& lhs, const region& rhs) {
+        lhs |= rhs;
+        return std::move(lhs);
+    }
+
+    // intervals only compare equal when their data does, so union is commutative
+    friend region operator|(const region& lhs, region&& rhs) {
+        rhs |= lhs;
+        return std::move(rhs);
+    }
+
+    friend region operator|(region&& lhs, region&& rhs) {
+        lhs |= rhs;
+        return std::move(lhs);
+    }
+
+    template<typename M = std::monostate>
+    friend region operator&(region&& lhs, const region<Dimension, BitsPerDimension, M, Curve>& rhs) {
+        lhs &= rhs;
+        return std::move(lhs);
+    }
+
+    template<typename M = std::monostate>
+    friend region operator-(region&& lhs, const region<Dimension, BitsPerDimension, M, Curve>& rhs) {
+        lhs -= rhs;
+        return std::move(lhs);
+    }
+
+    friend region operator^(region&& lhs, const region& rhs) {
+        lhs ^= rhs;
+        return std::move(lhs);
+    }
+
+    // Unions all the regions in one k-way merge of their intervals, in O(n log k) rather than
+    // the O(nk) of folding them together with |. Intervals that overlap or touch are joined
+    // only when their data is equal. Otherwise each is kept with its own data, so overlaps
+    // keep the data of both sides, in the order of operator<. Without data this is the same
+    // result as the fold. With data the fold can leave the same codes and data split into
+    // different intervals, as each | only coalesces within its own pair of regions.
+    static region union_all(zinc::span<const region> regions);
+    // Intersects all the regions in one k-way merge, each piece keeping the data of the first
+    // region. An empty list of regions gives an empty region.
+    static region intersect_all(zinc::span<const region> regions);
+
+    // intersects and area run over blocks of intervals with the kernels for isa.
     template<typename M>
-    bool intersects(const region<Dimension, BitsPerDimension, M>& rhs) const;
+    bool intersects(const region<Dimension, BitsPerDimension, M, Curve>& rhs, zinc::cpu::isa isa = zinc::cpu::best_isa()) const;
     bool empty() const;
-    uint64_t area() const;
-    bool contains(const morton_code<Dimension, BitsPerDimension> c) const {
-        for (auto& i: intervals) {
-            if (c.code < i.start) {
-                return false;
-            } else if (c.code <= i.end) {
-                return true;
-            }
-        }
-        return false;
+    word_type area(zinc::cpu::isa isa = zinc::cpu::best_isa()) const;
+    // Returns the interval containing c, or nullptr if there isn't one.
+    // This is a binary search, so it assumes the intervals are sorted and don't overlap.
+    const interval_type* find(const code_type c) const;
+    bool contains(const code_type c) const {
+        return find(c) != nullptr;
     };
-    std::vector<detail::interval<Dimension, BitsPerDimension>> to_cells() const;
-    std::vector<detail::interval<Dimension, BitsPerDimension>> to_cells(size_t max_level) const;
+    // Sets out[i] to the interval containing queries[i], or nullptr, for queries sorted in ascending order.
+    // This is a single merge pass that gallops over runs of intervals without queries,
+    // so dense query sets cost amortised O(1) each and sparse ones O(log n).
+    void lookup_sorted(zinc::span<const code_type> queries, zinc::span<const interval_type*> out) const;
+    // As lookup_sorted, but for queries in any order, which are radix sorted first.
+    void lookup(zinc::span<const code_type> queries, zinc::span<const interval_type*> out) const;
+    // The cells of every interval in order, computed as they are visited instead of stored.
+    detail::cells_of_intervals<interval_type> cells() const {
+        return {intervals.data(), intervals.data() + intervals.size(), BitsPerDimension};
+    }
+    detail::cells_of_intervals<interval_type> cells(size_t max_level) const {
+        return {intervals.data(), intervals.data() + intervals.size(), max_level};
+    }
+    std::vector<detail::interval<Dimension, BitsPerDimension, std::monostate, Curve>> to_cells() const;
+    std::vector<detail::interval<Dimension, BitsPerDimension, std::monostate, Curve>> to_cells(size_t max_level) const;
     std::vector<std::pair<uint64_t,uint64_t>> count_cells() const;
+    // The number of cells of each level over all the intervals, see interval::cell_histogram.
+    std::array<uint64_t, BitsPerDimension + 1> cell_histogram() const;
 };
 
-    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-    template<typename M>
-    bool region<Dimension, BitsPerDimension, T>::intersects(const region<Dimension, BitsPerDimension, M>& rhs) const {
-        assert(std::is_sorted(intervals.begin(), intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
-        auto lhs_it = intervals.begin();
-        auto rhs_it = rhs.intervals.begin();
-        while(lhs_it != intervals.end() && rhs_it != rhs.intervals.end()){
-            if (lhs_it->end < rhs_it->start) {
-                ++lhs_it;
-                continue;
-            } else if (rhs_it->end < lhs_it->start) {
-                ++rhs_it;
-                continue;
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    region<Dimension, BitsPerDimension, T, Curve> region<Dimension, BitsPerDimension, T, Curve>::union_all(zinc::span<const region> regions) {
+        struct cursor {
+            const interval_type* it;
+            const interval_type* end;
+            size_t source;
+        };
+        // a min heap on the current interval of each region, ties going to the earlier region
+        auto later = [](const cursor& a, const cursor& b) {
+            return *b.it < *a.it || (!(*a.it < *b.it) && b.source < a.source);
+        };
+        std::vector<cursor> heap;
+        heap.reserve(regions.size());
+        size_t total = 0;
+        for (size_t i = 0; i < regions.size(); i++) {
+            auto& v = regions[i].intervals;
+            assert(std::is_sorted(v.begin(), v.end()));
+            if (!v.empty()) {
+                heap.push_back({v.data(), v.data() + v.size(), i});
             }
-            return true;
+            total += v.size();
         }
-        return false;
+        std::make_heap(heap.begin(), heap.end(), later);
+
+        region r;
+        if (heap.empty()) {
+            return r;
+        }
+        r.intervals.reserve(total);
+        // the first interval popped is pending itself, which coalesces with no effect
+        interval_type pending = *heap.front().it;
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            cursor& c = heap.back();
+            const interval_type& x = *c.it;
+            if (detail::can_coalesce(pending, x)) {
+                pending.end = std::max(pending.end, x.end);
+            } else {
+                r.intervals.push_back(pending);
+                pending = x;
+            }
+            if (++c.it == c.end) {
+                heap.pop_back();
+            } else {
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+        }
+        r.intervals.push_back(pending);
+        return r;
     }
 
-    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-    bool region<Dimension, BitsPerDimension, T>::empty() const {
-        return intervals.empty();
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    region<Dimension, BitsPerDimension, T, Curve> region<Dimension, BitsPerDimension, T, Curve>::intersect_all(zinc::span<const region> regions) {
+        region r;
+        if (regions.empty()) {
+            return r;
+        }
+        // every region's current interval starts at or before max_start. When the
+        // interval ending first ends after max_start, every region covers the piece between.
+        std::vector<const interval_type*> cursors(regions.size());
+        std::vector<size_t> heap(regions.size());
+        typename interval_type::word_type max_start = 0;
+        for (size_t i = 0; i < regions.size(); i++) {
+            auto& v = regions[i].intervals;
+            assert(std::is_sorted(v.begin(), v.end()));
+            if (v.empty()) {
+                return r;
+            }
+            cursors[i] = v.data();
+            heap[i] = i;
+            max_start = std::max<typename interval_type::word_type>(max_start, v.front().start);
+        }
+        auto later = [&cursors](size_t a, size_t b) { return cursors[b]->end < cursors[a]->end; };
+        std::make_heap(heap.begin(), heap.end(), later);
+        while (true) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            const size_t i = heap.back();
+            typename interval_type::word_type e = cursors[i]->end;
+            if (max_start <= e) {
+                r.intervals.push_back(interval_type{max_start, e, cursors[0]->data});
+            }
+            // skip every interval that ends before anything else could still cover it
+            auto& v = regions[i].intervals;
+            cursors[i] = detail::gallop_to_end(cursors[i] + 1, v.data() + v.size(), max_start);
+            if (cursors[i] == v.data() + v.size()) {
+                break;
+            }
+            max_start = std::max<typename interval_type::word_type>(max_start, cursors[i]->start);
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+        return r;
     }
 
-    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-    uint64_t region<Dimension, BitsPerDimension, T>::area() const {
-        uint64_t a = 0;
-        for(auto &cell : intervals){
-            a += cell.area();
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    template<typename M>
+    bool region<Dimension, BitsPerDimension, T, Curve>::intersects(const region<Dimension, BitsPerDimension, M, Curve>& rhs, zinc::cpu::isa isa) const {
+        assert(std::is_sorted(intervals.begin(), intervals.end()) && std::is_sorted(rhs.intervals.begin(), rhs.intervals.end()));
+        return detail::interleaved_intersects(intervals.data(), intervals.size(), rhs.intervals.data(), rhs.intervals.size(), isa);
+    }
+
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    const typename region<Dimension, BitsPerDimension, T, Curve>::interval_type* region<Dimension, BitsPerDimension, T, Curve>::find(const code_type c) const {
+        assert(std::is_sorted(intervals.begin(), intervals.end()));
+        // the first interval starting after c, the one before it is the only candidate
+        auto it = std::upper_bound(intervals.begin(), intervals.end(), c.data,
+            [](typename interval_type::word_type code, const interval_type& i) { return code < i.start; });
+        if (it == intervals.begin()) {
+            return nullptr;
         }
-        return a;
+        --it;
+        return c.data <= it->end ? &*it : nullptr;
     }
 
-    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-    std::vector<detail::interval<Dimension, BitsPerDimension>> region<Dimension, BitsPerDimension, T>::to_cells() const {
-        std::vector<detail::interval<Dimension, BitsPerDimension>> v = {};
-        for (auto &i : intervals){
-            auto c = i.to_cells();
-            v.insert(v.end(), c.begin(), c.end());
+
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    void region<Dimension, BitsPerDimension, T, Curve>::lookup_sorted(zinc::span<const code_type> queries, zinc::span<const interval_type*> out) const {
+        assert(queries.size() == out.size());
+        detail::merge_lookup(intervals, queries.size(),
+            [&](size_t q) { return queries[q].data; },
+            [&](size_t q, const interval_type* i) { out[q] = i; });
+    }
+
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    void region<Dimension, BitsPerDimension, T, Curve>::lookup(zinc::span<const code_type> queries, zinc::span<const interval_type*> out) const {
+        assert(queries.size() == out.size());
+        // sort (code, position) pairs, then write each result back to its query's position
+        std::vector<std::pair<word_type, size_t>> sorted;
+        sorted.reserve(queries.size());
+        for (size_t q = 0; q < queries.size(); q++) {
+            sorted.push_back({queries[q].data, q});
         }
-        return v;
+        zinc::radix_sort(sorted, [](const std::pair<word_type, size_t>& p) { return p.first; });
+        detail::merge_lookup(intervals, sorted.size(),
+            [&](size_t q) { return sorted[q].first; },
+            [&](size_t q, const interval_type* i) { out[sorted[q].second] = i; });
     }
 
-    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-    std::vector<detail::interval<Dimension, BitsPerDimension>> region<Dimension, BitsPerDimension, T>::to_cells(size_t max_level) const {
-        std::vector<detail::interval<Dimension, BitsPerDimension>> v = {};
-        for (auto &i : intervals){
-            auto c = i.to_cells(max_level);
-            v.insert(v.end(), c.begin(), c.end());
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    bool region<Dimension, BitsPerDimension, T, Curve>::empty() const {
+        return intervals.empty();
+    }
+
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    typename region<Dimension, BitsPerDimension, T, Curve>::word_type region<Dimension, BitsPerDimension, T, Curve>::area(zinc::cpu::isa isa) const {
+        return detail::interleaved_area(intervals.data(), intervals.size(), isa);
+    }
+
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    std::vector<detail::interval<Dimension, BitsPerDimension, std::monostate, Curve>> region<Dimension, BitsPerDimension, T, Curve>::to_cells() const {
+        return to_cells(BitsPerDimension);
+    }
+
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    std::vector<detail::interval<Dimension, BitsPerDimension, std::monostate, Curve>> region<Dimension, BitsPerDimension, T, Curve>::to_cells(size_t max_level) const {
+        std::vector<detail::interval<Dimension, BitsPerDimension, std::monostate, Curve>> v = {};
+        for (auto &c : cells(max_level)){
+            v.push_back({c.start, c.end});
         }
         return v;
     }
 
-    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T>
-    std::vector<std::pair<uint64_t,uint64_t>> region<Dimension, BitsPerDimension, T>::count_cells() const {
-        std::vector<std::pair<uint64_t,uint64_t>> counts = {};
-        if (intervals.empty()) { return counts;}
-        counts = intervals[0].count_cells();
-        for(size_t i = 1; i < intervals.size(); i++){
-            auto v = intervals[i].count_cells();
-            for(auto it = v.begin(); it != v.end(); ++it){
-                size_t j = 0;
-                for(; j < counts.size(); j++){
-                    if(counts[j].first < it->first && j < counts.size() -1 && counts[j+1].first > it->first){
-                        //insert if between two existing values
-                        counts.emplace(counts.begin()+j,*it);
-                        break;
-                    }
-                    if(counts[j].first == it->first){
-                        counts[j].second += it->second;
-                        break;
-                    }
-                }
-                if (j == counts.size()){
-                    counts.push_back(*it);
-                }
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    std::array<uint64_t, BitsPerDimension + 1> region<Dimension, BitsPerDimension, T, Curve>::cell_histogram() const {
+        std::array<uint64_t, BitsPerDimension + 1> counts {};
+        for (auto &i : intervals){
+            auto h = i.cell_histogram();
+            for (size_t level = 0; level <= BitsPerDimension; level++){
+                counts[level] += h[level];
             }
         }
         return counts;
     }
 
-template<typename T>
-static region<2,32,T> cell_to_region(uint64_t code, uint64_t level, T data) {
+    template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Curve>
+    std::vector<std::pair<uint64_t,uint64_t>> region<Dimension, BitsPerDimension, T, Curve>::count_cells() const {
+        return detail::histogram_to_counts(cell_histogram());
+    }
+
+template<uint32_t Dimension = 2, uint32_t BitsPerDimension = 32, typename T>
+static region<Dimension, BitsPerDimension, T> cell_to_region(typename morton_code<Dimension, BitsPerDimension>::word_type code, uint64_t level, T data) {
+    using word_type = typename morton_code<Dimension, BitsPerDimension>::word_type;
+    const word_type end = code + get_morton_code<Dimension, word_type>(level);
     if constexpr (std::is_same<T, std::monostate>::value) {
-        return {{{code, code + (1 << (level * 2)) - 1}}};
+        return {{{code, end}}};
     } else {
-        return {{{code, code + (1 << (level * 2)) - 1, data}}};
+        return {{{code, end, data}}};
     }
 }
 
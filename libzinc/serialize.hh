@@ -0,0 +1,433 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "encoding.hh"
+#include "region.hh"
+#include "span.hh"
+
+namespace zinc {
+
+namespace morton {
+
+// A compact binary form of a region, for sending regions between processes.
+//
+//   "ZR", version              3 bytes
+//   interval count             varint
+//   intervals per block        varint
+//   block directory            per block: its first start and its offset into the blocks, 8 bytes each, little endian
+//   blocks                     per interval: start, end - start and data
+//
+// Within a block, start is written as the gap from the previous interval's end + 1, and the
+// first interval of each block has its start in full, so every block can be decoded by itself.
+// Numbers are LEB128 varints, so a region of small, close intervals takes a few bytes per
+// interval. data is written by a codec, see data_codec below.
+//
+// encoded_region works directly on such a buffer: lookups search the directory and decode a
+// single block, and set operations and iteration decode as they go.
+
+// Encodes and decodes the data of an interval. decode returns the byte after the data, or
+// nullptr if the buffer ends first. The default writes integers as varints, std::monostate as
+// nothing, and anything else trivially copyable as its bytes. Other types need their own codec.
+template<typename T, typename = void>
+struct data_codec {
+    static_assert(std::is_trivially_copyable<T>::value, "data that isn't trivially copyable needs a codec");
+    static void encode(const T& t, std::vector<uint8_t>& out) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&t);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+    static const uint8_t* decode(const uint8_t* in, const uint8_t* end, T& t) {
+        if (static_cast<size_t>(end - in) < sizeof(T)) {
+            return nullptr;
+        }
+        std::memcpy(&t, in, sizeof(T));
+        return in + sizeof(T);
+    }
+};
+
+template<>
+struct data_codec<std::monostate> {
+    static void encode(const std::monostate&, std::vector<uint8_t>&) {}
+    static const uint8_t* decode(const uint8_t* in, const uint8_t*, std::monostate&) {
+        return in;
+    }
+};
+
+namespace detail {
+
+static void put_varint(uint64_t v, std::vector<uint8_t>& out) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+static const uint8_t* get_varint(const uint8_t* in, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (uint32_t shift = 0; in != end && shift < 64; shift += 7) {
+        uint8_t b = *in++;
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (b < 0x80) {
+            return in;
+        }
+    }
+    return nullptr;
+}
+
+static void put_fixed(uint64_t v, std::vector<uint8_t>& out) {
+    for (uint32_t i = 0; i < 8; i++) {
+        out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+}
+
+static uint64_t get_fixed(const uint8_t* in) {
+    uint64_t v = 0;
+    for (uint32_t i = 0; i < 8; i++) {
+        v |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return v;
+}
+
+static const uint8_t encoded_region_magic[3] = {'Z', 'R', 1};
+
+} //::detail
+
+// integers as varints, with signed values zigzag encoded so small negative values stay short
+template<typename T>
+struct data_codec<T, typename std::enable_if<std::is_integral<T>::value>::type> {
+    static void encode(const T& t, std::vector<uint8_t>& out) {
+        if constexpr (std::is_signed<T>::value) {
+            int64_t v = t;
+            detail::put_varint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63), out);
+        } else {
+            detail::put_varint(t, out);
+        }
+    }
+    static const uint8_t* decode(const uint8_t* in, const uint8_t* end, T& t) {
+        uint64_t v = 0;
+        in = detail::get_varint(in, end, v);
+        if constexpr (std::is_signed<T>::value) {
+            t = static_cast<T>(static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1));
+        } else {
+            t = static_cast<T>(v);
+        }
+        return in;
+    }
+};
+
+// Appends the encoding of r to out. The intervals must be sorted and must not overlap.
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Codec = data_codec<T>>
+static void serialize(const region<Dimension, BitsPerDimension, T>& r, std::vector<uint8_t>& out, size_t block_size = 64) {
+    static_assert(std::is_same<typename region<Dimension, BitsPerDimension, T>::word_type, uint64_t>::value, "only codes of one word can be serialized");
+    assert(block_size > 0);
+    const auto& intervals = r.intervals;
+    std::vector<uint8_t> blocks;
+    std::vector<uint64_t> directory;
+    for (size_t i = 0; i < intervals.size(); i++) {
+        uint64_t start = intervals[i].start;
+        if (i % block_size == 0) {
+            directory.push_back(start);
+            directory.push_back(blocks.size());
+            detail::put_varint(start, blocks);
+        } else {
+            assert(intervals[i - 1].end < start);
+            detail::put_varint(start - intervals[i - 1].end - 1, blocks);
+        }
+        assert(start <= intervals[i].end);
+        detail::put_varint(intervals[i].end - start, blocks);
+        Codec::encode(intervals[i].data, blocks);
+    }
+    out.insert(out.end(), std::begin(detail::encoded_region_magic), std::end(detail::encoded_region_magic));
+    detail::put_varint(intervals.size(), out);
+    detail::put_varint(block_size, out);
+    for (uint64_t d : directory) {
+        detail::put_fixed(d, out);
+    }
+    out.insert(out.end(), blocks.begin(), blocks.end());
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Codec = data_codec<T>>
+static std::vector<uint8_t> serialize(const region<Dimension, BitsPerDimension, T>& r, size_t block_size = 64) {
+    std::vector<uint8_t> out;
+    serialize<Dimension, BitsPerDimension, T, Codec>(r, out, block_size);
+    return out;
+}
+
+// A read-only view of an encoded region. It refers to the buffer it was opened on, which must
+// outlive it. open decodes every block once to check it, so a view that opens can be read
+// without further checks.
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T = std::monostate, typename Codec = data_codec<T>>
+class encoded_region {
+public:
+    using interval_type = detail::interval<Dimension, BitsPerDimension, T>;
+    using region_type = region<Dimension, BitsPerDimension, T>;
+    static_assert(std::is_same<typename interval_type::word_type, uint64_t>::value, "only codes of one word can be serialized");
+
+    // Returns std::nullopt if buffer doesn't start with a well formed header, directory and
+    // blocks, holding sorted intervals that don't overlap.
+    static std::optional<encoded_region> open(zinc::span<const uint8_t> buffer);
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    class iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef interval_type value_type;
+            typedef ptrdiff_t difference_type;
+            typedef const value_type *pointer;
+            typedef const value_type &reference;
+
+            iterator(): parent(nullptr), index(0), in(nullptr), value({0, 0}) {}
+
+            iterator(const encoded_region* _parent, size_t _index): parent(_parent), index(_index), in(nullptr), value({0, 0}) {
+                if (index < parent->count) {
+                    in = parent->blocks + parent->block_offset(index / parent->block_size);
+                    decode();
+                }
+            }
+
+            iterator &operator++() {
+                if (++index < parent->count) {
+                    decode();
+                }
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator i = *this;
+                ++*this;
+                return i;
+            }
+
+            bool operator==(const iterator &i) const {
+                return index == i.index;
+            }
+
+            bool operator!=(const iterator &i) const {
+                return !(*this == i);
+            }
+
+            reference operator*() const {
+                return value;
+            }
+
+            pointer operator->() const {
+                return &value;
+            }
+
+        private:
+            const encoded_region* parent;
+            size_t index;
+            const uint8_t* in;
+            value_type value;
+
+            void decode() {
+                const uint8_t* end = parent->blocks_end;
+                uint64_t start = 0, length = 0;
+                in = detail::get_varint(in, end, start);
+                assert(in != nullptr);
+                if (index % parent->block_size != 0) {
+                    start += value.end + 1;
+                }
+                in = detail::get_varint(in, end, length);
+                assert(in != nullptr);
+                value.start = start;
+                value.end = start + length;
+                in = Codec::decode(in, end, value.data);
+                assert(in != nullptr);
+            }
+    };
+
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, count);
+    }
+
+    // Returns the interval containing c, if there is one.
+    // This binary searches the directory and decodes one block.
+    std::optional<interval_type> find(const morton_code<Dimension, BitsPerDimension> c) const;
+
+    bool contains(const morton_code<Dimension, BitsPerDimension> c) const {
+        return find(c).has_value();
+    }
+
+    // A single merge over the encoded intervals and rhs, stopping at the first overlap.
+    template<typename M>
+    bool intersects(const region<Dimension, BitsPerDimension, M>& rhs) const;
+
+    region_type decode() const {
+        region_type r;
+        r.intervals.reserve(count);
+        r.intervals.insert(r.intervals.end(), begin(), end());
+        return r;
+    }
+
+private:
+    size_t count = 0;
+    size_t block_size = 1;
+    const uint8_t* directory = nullptr;
+    const uint8_t* blocks = nullptr;
+    const uint8_t* blocks_end = nullptr;
+
+    size_t block_count() const {
+        return count == 0 ? 0 : (count - 1) / block_size + 1;
+    }
+
+    uint64_t block_start(size_t block) const {
+        return detail::get_fixed(directory + 16 * block);
+    }
+
+    uint64_t block_offset(size_t block) const {
+        return detail::get_fixed(directory + 16 * block + 8);
+    }
+};
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Codec>
+std::optional<encoded_region<Dimension, BitsPerDimension, T, Codec>> encoded_region<Dimension, BitsPerDimension, T, Codec>::open(zinc::span<const uint8_t> buffer) {
+    const uint8_t* in = buffer.data();
+    const uint8_t* end = buffer.data() + buffer.size();
+    const size_t magic_size = sizeof(detail::encoded_region_magic);
+    if (buffer.size() < magic_size || std::memcmp(in, detail::encoded_region_magic, magic_size) != 0) {
+        return std::nullopt;
+    }
+    in += magic_size;
+    uint64_t count = 0, block_size = 0;
+    in = detail::get_varint(in, end, count);
+    if (in == nullptr) {
+        return std::nullopt;
+    }
+    in = detail::get_varint(in, end, block_size);
+    if (in == nullptr || block_size == 0) {
+        return std::nullopt;
+    }
+    encoded_region r;
+    r.count = count;
+    r.block_size = block_size;
+    // each interval takes at least two bytes, which bounds the directory before it is read
+    if (count > static_cast<uint64_t>(end - in) / 2) {
+        return std::nullopt;
+    }
+    const size_t directory_size = 16 * r.block_count();
+    if (directory_size > static_cast<size_t>(end - in)) {
+        return std::nullopt;
+    }
+    r.directory = in;
+    r.blocks = in + directory_size;
+    r.blocks_end = end;
+    for (size_t b = 0; b < r.block_count(); b++) {
+        if (r.block_offset(b) >= static_cast<uint64_t>(end - r.blocks) ||
+            (b > 0 && (r.block_offset(b) <= r.block_offset(b - 1) || r.block_start(b) <= r.block_start(b - 1)))) {
+            return std::nullopt;
+        }
+    }
+    // each block must decode to exactly its own bytes, starting where the directory says,
+    // and carry on after the block before it
+    const uint64_t last = std::numeric_limits<uint64_t>::max();
+    std::optional<uint64_t> previous_end;
+    for (size_t b = 0; b < r.block_count(); b++) {
+        const uint8_t* block = r.blocks + r.block_offset(b);
+        const uint8_t* block_end = b + 1 < r.block_count() ? r.blocks + r.block_offset(b + 1) : end;
+        const size_t n = std::min<size_t>(r.count - b * r.block_size, r.block_size);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t start = 0, length = 0;
+            block = detail::get_varint(block, block_end, start);
+            if (block == nullptr) {
+                return std::nullopt;
+            }
+            if (i == 0) {
+                if (start != r.block_start(b) || (previous_end && start <= *previous_end)) {
+                    return std::nullopt;
+                }
+            } else {
+                if (*previous_end == last || start > last - *previous_end - 1) {
+                    return std::nullopt;
+                }
+                start += *previous_end + 1;
+            }
+            block = detail::get_varint(block, block_end, length);
+            if (block == nullptr || length > last - start) {
+                return std::nullopt;
+            }
+            previous_end = start + length;
+            T data {};
+            block = Codec::decode(block, block_end, data);
+            if (block == nullptr) {
+                return std::nullopt;
+            }
+        }
+        // iteration runs straight on from one block into the next
+        if (b + 1 < r.block_count() && block != block_end) {
+            return std::nullopt;
+        }
+    }
+    return r;
+}
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Codec>
+std::optional<typename encoded_region<Dimension, BitsPerDimension, T, Codec>::interval_type> encoded_region<Dimension, BitsPerDimension, T, Codec>::find(const morton_code<Dimension, BitsPerDimension> c) const {
+    // the first block starting after c
+    size_t lo = 0, hi = block_count();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (block_start(mid) <= c.data) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return std::nullopt;
+    }
+    size_t left = std::min(count, lo * block_size) - (lo - 1) * block_size;
+    for (iterator it(this, (lo - 1) * block_size); it->start <= c.data; ++it) {
+        if (c.data <= it->end) {
+            return *it;
+        }
+        if (--left == 0) {
+            break;
+        }
+    }
+    return std::nullopt;
+}
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T, typename Codec>
+template <typename M>
+bool encoded_region<Dimension, BitsPerDimension, T, Codec>::intersects(const region<Dimension, BitsPerDimension, M>& rhs) const {
+    auto lhs_it = begin();
+    const auto lhs_end = end();
+    auto rhs_it = rhs.intervals.begin();
+    while (lhs_it != lhs_end && rhs_it != rhs.intervals.end()) {
+        if (lhs_it->end < rhs_it->start) {
+            ++lhs_it;
+        } else if (rhs_it->end < lhs_it->start) {
+            ++rhs_it;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+} //::morton
+
+} //::zinc
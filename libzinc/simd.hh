@@ -0,0 +1,428 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+#include "cpu.hh"
+#include <immintrin.h>
+
+namespace zinc {
+
+namespace morton {
+
+namespace simd {
+
+// Batch kernels for 2D, 32 bits per dimension Morton codes.
+// Each kernel handles the largest multiple of its lane count and returns how many
+// points it processed, the caller finishes the tail with the scalar encoder.
+//
+// Both directions use the perfect shuffle from Hacker's Delight (7-2): a 64 bit lane
+// holding x in the low half and y in the high half is interleaved in five
+// swap steps, and decoding runs the same steps in reverse order.
+
+__attribute__((target("avx2")))
+static inline __m256i shuffle_2_avx2(__m256i v, const uint64_t mask, const int shift) {
+    __m256i t = _mm256_and_si256(_mm256_xor_si256(v, _mm256_srli_epi64(v, shift)), _mm256_set1_epi64x(static_cast<int64_t>(mask)));
+    return _mm256_xor_si256(v, _mm256_xor_si256(t, _mm256_slli_epi64(t, shift)));
+}
+
+__attribute__((target("avx2")))
+static size_t encode_2_avx2(const uint32_t* xs, const uint32_t* ys, uint64_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(xs + i)));
+        __m256i y = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ys + i)));
+        __m256i v = _mm256_or_si256(x, _mm256_slli_epi64(y, 32));
+        v = shuffle_2_avx2(v, 0x00000000ffff0000, 16);
+        v = shuffle_2_avx2(v, 0x0000ff000000ff00, 8);
+        v = shuffle_2_avx2(v, 0x00f000f000f000f0, 4);
+        v = shuffle_2_avx2(v, 0x0c0c0c0c0c0c0c0c, 2);
+        v = shuffle_2_avx2(v, 0x2222222222222222, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), v);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t decode_2_avx2(const uint64_t* codes, uint32_t* xs, uint32_t* ys, size_t n) {
+    const __m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + i));
+        v = shuffle_2_avx2(v, 0x2222222222222222, 1);
+        v = shuffle_2_avx2(v, 0x0c0c0c0c0c0c0c0c, 2);
+        v = shuffle_2_avx2(v, 0x00f000f000f000f0, 4);
+        v = shuffle_2_avx2(v, 0x0000ff000000ff00, 8);
+        v = shuffle_2_avx2(v, 0x00000000ffff0000, 16);
+        // gather the low halves (x) into the bottom 128 bits and the high halves (y) into the top
+        v = _mm256_permutevar8x32_epi32(v, split);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(xs + i), _mm256_castsi256_si128(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(ys + i), _mm256_extracti128_si256(v, 1));
+    }
+    return i;
+}
+
+// Kernels over arrays of interval starts and ends.
+//
+// Each array is read with a stride, in uint64_t's: a struct of arrays region passes 1, and
+// region passes the size of its interval type, so the same kernels run directly over its
+// interleaved intervals without copying the starts and ends out first.
+//
+// leading_below returns how many of the sorted keys, from the front, are less than v.
+// It compares a block of keys at a time, so runs of intervals can be skipped in one step.
+// AVX2 only compares signed 64 bit lanes, so both sides are offset by 2^63 first.
+
+template<size_t Stride = 1>
+static inline size_t leading_below_scalar(const uint64_t* keys, size_t n, uint64_t v) {
+    size_t i = 0;
+    while (i < n && keys[i * Stride] < v) {
+        i++;
+    }
+    return i;
+}
+
+// Interleaved keys, Stride > 1, are read in whole vectors as they lie in memory, keys and
+// data alike: the layout repeats every period uint64_t's, the least common multiple of the
+// stride and the vector width, and key_lanes marks the lanes of a period holding keys.
+// Past 8 uint64_t's an interval is mostly data, so it is cheaper to read the keys alone.
+template<size_t Stride, size_t Lanes>
+constexpr size_t interleaved_period = Stride * Lanes / std::gcd(Stride, Lanes);
+
+template<size_t Stride, size_t Lanes>
+constexpr bool interleaved_vectorizes = Stride >= 2 && Stride <= 8 && interleaved_period<Stride, Lanes> / Lanes <= 8;
+
+template<size_t Stride, size_t Period>
+constexpr uint64_t key_lanes() {
+    uint64_t lanes = 0;
+    for (size_t q = 0; q < Period; q += Stride) {
+        lanes |= uint64_t{1} << q;
+    }
+    return lanes;
+}
+
+// keys[0], keys[Stride], keys[2 * Stride] and keys[3 * Stride]
+template<size_t Stride>
+__attribute__((target("avx2")))
+static inline __m256i load_strided_avx2(const uint64_t* keys) {
+    if constexpr (Stride == 1) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys));
+    } else {
+        const __m256i offsets = _mm256_setr_epi64x(0, Stride, 2 * Stride, 3 * Stride);
+        return _mm256_i64gather_epi64(reinterpret_cast<const long long*>(keys), offsets, 8);
+    }
+}
+
+template<size_t Stride = 1>
+__attribute__((target("avx2")))
+static inline size_t leading_below_avx2(const uint64_t* keys, size_t n, uint64_t v) {
+    size_t i = 0;
+    const __m256i bias = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+    const __m256i value = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(v)), bias);
+    if constexpr (interleaved_vectorizes<Stride, 4>) {
+        constexpr size_t period = interleaved_period<Stride, 4>;
+        constexpr size_t vectors = period / 4, per_period = period / Stride;
+        // the last period is left to the scalar loop, as reading it whole could run past the final key
+        for (; i + per_period < n; i += per_period) {
+            const uint64_t* p = keys + i * Stride;
+            uint64_t below = ~key_lanes<Stride, period>();
+            #pragma GCC unroll 8
+            for (size_t w = 0; w < vectors; w++) {
+                __m256i k = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + w * 4)), bias);
+                below |= static_cast<uint64_t>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(value, k)))) << (w * 4);
+            }
+            if (~below != 0) {
+                return i + static_cast<size_t>(__builtin_ctzll(~below)) / Stride;
+            }
+        }
+        return i + leading_below_scalar<Stride>(keys + i * Stride, n - i, v);
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m256i k = _mm256_xor_si256(load_strided_avx2<Stride>(keys + i * Stride), bias);
+        int below = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(value, k)));
+        if (below != 0xf) {
+            return i + static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(below)));
+        }
+    }
+    return i + leading_below_scalar<Stride>(keys + i * Stride, n - i, v);
+}
+
+// The sum of end + 1 - start over the intervals, wrapping as the scalar sum does.
+static inline uint64_t area_scalar(const uint64_t* starts, const uint64_t* ends, size_t n) {
+    uint64_t a = 0;
+    for (size_t i = 0; i < n; i++) {
+        a += ends[i] + 1 - starts[i];
+    }
+    return a;
+}
+
+// As area_scalar, for intervals of Stride uint64_t's that each begin with their start and end.
+template<size_t Stride>
+static inline uint64_t area_interleaved_scalar(const uint64_t* intervals, size_t n) {
+    uint64_t a = 0;
+    for (size_t i = 0; i < n; i++) {
+        a += intervals[i * Stride + 1] + 1 - intervals[i * Stride];
+    }
+    return a;
+}
+
+// The vector versions of area_interleaved_scalar add up whole vectors of the intervals as
+// they lie in memory, starts, ends and data alike, with one accumulator for each vector in
+// the period. Only at the end are the lanes holding starts subtracted and the lanes holding
+// ends added, so the loop needs no shuffles or gathers.
+
+// Folds the summed period back into the area, given the intervals it covered.
+template<size_t Stride, size_t Period>
+static inline uint64_t area_of_period(const uint64_t (&sums)[Period], size_t covered) {
+    uint64_t a = covered;
+    for (size_t q = 0; q < Period; q++) {
+        if (q % Stride == 0) {
+            a -= sums[q];
+        } else if (q % Stride == 1) {
+            a += sums[q];
+        }
+    }
+    return a;
+}
+
+template<size_t Stride>
+__attribute__((target("avx2")))
+static inline uint64_t area_interleaved_avx2(const uint64_t* intervals, size_t n) {
+    if constexpr (!interleaved_vectorizes<Stride, 4>) {
+        return area_interleaved_scalar<Stride>(intervals, n);
+    } else {
+        constexpr size_t period = interleaved_period<Stride, 4>;
+        constexpr size_t vectors = period / 4, per_period = period / Stride;
+        __m256i acc[vectors];
+        for (size_t v = 0; v < vectors; v++) {
+            acc[v] = _mm256_setzero_si256();
+        }
+        size_t i = 0;
+        for (; i + per_period <= n; i += per_period) {
+            const uint64_t* p = intervals + i * Stride;
+            #pragma GCC unroll 8
+            for (size_t v = 0; v < vectors; v++) {
+                acc[v] = _mm256_add_epi64(acc[v], _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + v * 4)));
+            }
+        }
+        alignas(32) uint64_t sums[period];
+        for (size_t v = 0; v < vectors; v++) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(sums + v * 4), acc[v]);
+        }
+        return area_of_period<Stride>(sums, i) + area_interleaved_scalar<Stride>(intervals + i * Stride, n - i);
+    }
+}
+
+// Whether any interval of a overlaps any interval of b, both sorted and disjoint. This is
+// the usual merge, stepping past one interval at a time, until one side has been stepped
+// past run times in a row: leading_below then skips the rest of that run in blocks. Tight
+// interleavings never get that far, so they don't pay for setting up the blocks.
+template<size_t StrideA, size_t StrideB, typename LeadingBelowA, typename LeadingBelowB>
+__attribute__((always_inline))
+static inline bool intersects_sorted(const uint64_t* a_starts, const uint64_t* a_ends, size_t na,
+                                     const uint64_t* b_starts, const uint64_t* b_ends, size_t nb,
+                                     LeadingBelowA leading_below_a, LeadingBelowB leading_below_b) {
+    constexpr size_t run = 8;
+    size_t i = 0, j = 0, a_run = 0, b_run = 0;
+    while (i < na && j < nb) {
+        if (a_ends[i * StrideA] < b_starts[j * StrideB]) {
+            b_run = 0;
+            if (++a_run < run) {
+                i++;
+            } else {
+                i += leading_below_a(a_ends + i * StrideA, na - i, b_starts[j * StrideB]);
+                a_run = 0;
+            }
+        } else if (b_ends[j * StrideB] < a_starts[i * StrideA]) {
+            a_run = 0;
+            if (++b_run < run) {
+                j++;
+            } else {
+                j += leading_below_b(b_ends + j * StrideB, nb - j, a_starts[i * StrideA]);
+                b_run = 0;
+            }
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+template<size_t StrideA = 1, size_t StrideB = 1>
+static inline bool intersects_scalar(const uint64_t* a_starts, const uint64_t* a_ends, size_t na,
+                                     const uint64_t* b_starts, const uint64_t* b_ends, size_t nb) {
+    return intersects_sorted<StrideA, StrideB>(a_starts, a_ends, na, b_starts, b_ends, nb,
+                                               leading_below_scalar<StrideA>, leading_below_scalar<StrideB>);
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t area_avx2(const uint64_t* starts, const uint64_t* ends, size_t n) {
+    // two accumulators hide the latency of the adds
+    __m256i a0 = _mm256_set1_epi64x(0), a1 = _mm256_set1_epi64x(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm256_add_epi64(a0, _mm256_sub_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ends + i)),
+                                                   _mm256_loadu_si256(reinterpret_cast<const __m256i*>(starts + i))));
+        a1 = _mm256_add_epi64(a1, _mm256_sub_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ends + i + 4)),
+                                                   _mm256_loadu_si256(reinterpret_cast<const __m256i*>(starts + i + 4))));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(a0, a1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + i + area_scalar(starts + i, ends + i, n - i);
+}
+
+template<size_t StrideA = 1, size_t StrideB = 1>
+__attribute__((target("avx2")))
+static inline bool intersects_avx2(const uint64_t* a_starts, const uint64_t* a_ends, size_t na,
+                                   const uint64_t* b_starts, const uint64_t* b_ends, size_t nb) {
+    return intersects_sorted<StrideA, StrideB>(a_starts, a_ends, na, b_starts, b_ends, nb,
+                                               leading_below_avx2<StrideA>, leading_below_avx2<StrideB>);
+}
+
+// GCC reports the self-initialised _mm512_undefined_epi32() inside its own intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+__attribute__((target("avx512f")))
+static inline __m512i shuffle_2_avx512(__m512i v, const uint64_t mask, const int shift) {
+    __m512i t = _mm512_and_si512(_mm512_xor_si512(v, _mm512_srli_epi64(v, shift)), _mm512_set1_epi64(static_cast<int64_t>(mask)));
+    // v ^ t ^ (t << shift) in a single instruction
+    return _mm512_ternarylogic_epi64(v, t, _mm512_slli_epi64(t, shift), 0x96);
+}
+
+__attribute__((target("avx512f")))
+static size_t encode_2_avx512(const uint32_t* xs, const uint32_t* ys, uint64_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i x = _mm512_cvtepu32_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + i)));
+        __m512i y = _mm512_cvtepu32_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ys + i)));
+        __m512i v = _mm512_or_si512(x, _mm512_slli_epi64(y, 32));
+        v = shuffle_2_avx512(v, 0x00000000ffff0000, 16);
+        v = shuffle_2_avx512(v, 0x0000ff000000ff00, 8);
+        v = shuffle_2_avx512(v, 0x00f000f000f000f0, 4);
+        v = shuffle_2_avx512(v, 0x0c0c0c0c0c0c0c0c, 2);
+        v = shuffle_2_avx512(v, 0x2222222222222222, 1);
+        _mm512_storeu_si512(out + i, v);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f")))
+static size_t decode_2_avx512(const uint64_t* codes, uint32_t* xs, uint32_t* ys, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512i v = _mm512_loadu_si512(codes + i);
+        v = shuffle_2_avx512(v, 0x2222222222222222, 1);
+        v = shuffle_2_avx512(v, 0x0c0c0c0c0c0c0c0c, 2);
+        v = shuffle_2_avx512(v, 0x00f000f000f000f0, 4);
+        v = shuffle_2_avx512(v, 0x0000ff000000ff00, 8);
+        v = shuffle_2_avx512(v, 0x00000000ffff0000, 16);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(xs + i), _mm512_cvtepi64_epi32(v));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(ys + i), _mm512_cvtepi64_epi32(_mm512_srli_epi64(v, 32)));
+    }
+    return i;
+}
+
+template<size_t Stride>
+__attribute__((target("avx512f")))
+static inline __m512i load_strided_avx512(const uint64_t* keys) {
+    if constexpr (Stride == 1) {
+        return _mm512_loadu_si512(keys);
+    } else {
+        const __m512i offsets = _mm512_setr_epi64(0, Stride, 2 * Stride, 3 * Stride, 4 * Stride, 5 * Stride, 6 * Stride, 7 * Stride);
+        return _mm512_i64gather_epi64(offsets, keys, 8);
+    }
+}
+
+template<size_t Stride = 1>
+__attribute__((target("avx512f")))
+static inline size_t leading_below_avx512(const uint64_t* keys, size_t n, uint64_t v) {
+    size_t i = 0;
+    const __m512i value = _mm512_set1_epi64(static_cast<int64_t>(v));
+    if constexpr (interleaved_vectorizes<Stride, 8>) {
+        constexpr size_t period = interleaved_period<Stride, 8>;
+        constexpr size_t vectors = period / 8, per_period = period / Stride;
+        for (; i + per_period < n; i += per_period) {
+            const uint64_t* p = keys + i * Stride;
+            uint64_t below = ~key_lanes<Stride, period>();
+            #pragma GCC unroll 8
+            for (size_t w = 0; w < vectors; w++) {
+                below |= static_cast<uint64_t>(_mm512_cmplt_epu64_mask(_mm512_loadu_si512(p + w * 8), value)) << (w * 8);
+            }
+            if (~below != 0) {
+                return i + static_cast<size_t>(__builtin_ctzll(~below)) / Stride;
+            }
+        }
+        return i + leading_below_scalar<Stride>(keys + i * Stride, n - i, v);
+    }
+    for (; i + 8 <= n; i += 8) {
+        __mmask8 below = _mm512_cmplt_epu64_mask(load_strided_avx512<Stride>(keys + i * Stride), value);
+        if (below != 0xff) {
+            return i + static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(below)));
+        }
+    }
+    return i + leading_below_scalar<Stride>(keys + i * Stride, n - i, v);
+}
+
+__attribute__((target("avx512f")))
+static inline uint64_t area_avx512(const uint64_t* starts, const uint64_t* ends, size_t n) {
+    __m512i a0 = _mm512_set1_epi64(0), a1 = _mm512_set1_epi64(0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        a0 = _mm512_add_epi64(a0, _mm512_sub_epi64(_mm512_loadu_si512(ends + i), _mm512_loadu_si512(starts + i)));
+        a1 = _mm512_add_epi64(a1, _mm512_sub_epi64(_mm512_loadu_si512(ends + i + 8), _mm512_loadu_si512(starts + i + 8)));
+    }
+    return static_cast<uint64_t>(_mm512_reduce_add_epi64(_mm512_add_epi64(a0, a1))) + i + area_scalar(starts + i, ends + i, n - i);
+}
+
+template<size_t Stride>
+__attribute__((target("avx512f")))
+static inline uint64_t area_interleaved_avx512(const uint64_t* intervals, size_t n) {
+    if constexpr (!interleaved_vectorizes<Stride, 8>) {
+        return area_interleaved_scalar<Stride>(intervals, n);
+    } else {
+        constexpr size_t period = interleaved_period<Stride, 8>;
+        constexpr size_t vectors = period / 8, per_period = period / Stride;
+        __m512i acc[vectors];
+        for (size_t v = 0; v < vectors; v++) {
+            acc[v] = _mm512_setzero_si512();
+        }
+        size_t i = 0;
+        for (; i + per_period <= n; i += per_period) {
+            const uint64_t* p = intervals + i * Stride;
+            #pragma GCC unroll 8
+            for (size_t v = 0; v < vectors; v++) {
+                acc[v] = _mm512_add_epi64(acc[v], _mm512_loadu_si512(p + v * 8));
+            }
+        }
+        alignas(64) uint64_t sums[period];
+        for (size_t v = 0; v < vectors; v++) {
+            _mm512_store_si512(sums + v * 8, acc[v]);
+        }
+        return area_of_period<Stride>(sums, i) + area_interleaved_scalar<Stride>(intervals + i * Stride, n - i);
+    }
+}
+
+template<size_t StrideA = 1, size_t StrideB = 1>
+__attribute__((target("avx512f")))
+static inline bool intersects_avx512(const uint64_t* a_starts, const uint64_t* a_ends, size_t na,
+                                     const uint64_t* b_starts, const uint64_t* b_ends, size_t nb) {
+    return intersects_sorted<StrideA, StrideB>(a_starts, a_ends, na, b_starts, b_ends, nb,
+                                               leading_below_avx512<StrideA>, leading_below_avx512<StrideB>);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+} //::simd
+
+} //::morton
+
+} //::zinc
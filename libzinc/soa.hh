@@ -0,0 +1,301 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "cpu.hh"
+#include "encoding.hh"
+#include "region.hh"
+#include "simd.hh"
+
+namespace zinc {
+
+namespace morton {
+
+// A region stored as a struct of arrays: the starts, ends and data of its intervals each
+// in their own array. Searches, area and intersects then read only the plain uint64_t
+// arrays they need, in blocks with SIMD. data is left empty when T is std::monostate.
+//
+// It has the same set operations as region, and converts to and from one.
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T = std::monostate>
+struct soa_region {
+    using interval_type = detail::interval<Dimension, BitsPerDimension, T>;
+    using region_type = region<Dimension, BitsPerDimension, T>;
+    static constexpr bool has_data = !std::is_same<T, std::monostate>::value;
+    static_assert(std::is_same<typename interval_type::word_type, uint64_t>::value, "the SIMD kernels only take codes of one word");
+
+    std::vector<uint64_t> starts;
+    std::vector<uint64_t> ends;
+    std::vector<T> data;
+
+    soa_region() = default;
+
+    explicit soa_region(const region_type& r) {
+        reserve(r.intervals.size());
+        for (auto& i : r.intervals) {
+            push_back(i);
+        }
+    }
+
+    region_type to_region() const {
+        region_type r;
+        r.intervals.reserve(size());
+        r.intervals.insert(r.intervals.end(), begin(), end());
+        return r;
+    }
+
+    size_t size() const {
+        return starts.size();
+    }
+
+    bool empty() const {
+        return starts.empty();
+    }
+
+    void reserve(size_t n) {
+        starts.reserve(n);
+        ends.reserve(n);
+        if constexpr (has_data) {
+            data.reserve(n);
+        }
+    }
+
+    void push_back(const interval_type& i) {
+        starts.push_back(i.start);
+        ends.push_back(i.end);
+        if constexpr (has_data) {
+            data.push_back(i.data);
+        }
+    }
+
+    interval_type operator[](size_t i) const {
+        assert(i < size());
+        if constexpr (has_data) {
+            return {starts[i], ends[i], data[i]};
+        } else {
+            return {starts[i], ends[i]};
+        }
+    }
+
+    // Visits the intervals by value, as they are put together from the arrays.
+    class iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef interval_type value_type;
+            typedef ptrdiff_t difference_type;
+            typedef value_type reference;
+
+            // operator-> needs an object to point at
+            struct pointer {
+                value_type value;
+                const value_type* operator->() const {
+                    return &value;
+                }
+            };
+
+            iterator(): parent(nullptr), index(0) {}
+            iterator(const soa_region* _parent, size_t _index): parent(_parent), index(_index) {}
+
+            iterator &operator++() {
+                index++;
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator i = *this;
+                index++;
+                return i;
+            }
+
+            bool operator==(const iterator &i) const {
+                return index == i.index;
+            }
+
+            bool operator!=(const iterator &i) const {
+                return index != i.index;
+            }
+
+            reference operator*() const {
+                return (*parent)[index];
+            }
+
+            pointer operator->() const {
+                return {(*parent)[index]};
+            }
+
+        private:
+            const soa_region* parent;
+            size_t index;
+    };
+
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, size());
+    }
+
+    // Appends each interval written through it, for the merges in region.hh.
+    class back_insert_iterator {
+        public:
+            typedef std::output_iterator_tag iterator_category;
+            typedef void value_type;
+            typedef void difference_type;
+            typedef void pointer;
+            typedef void reference;
+
+            back_insert_iterator(soa_region& _target): target(&_target) {}
+
+            back_insert_iterator& operator=(const interval_type& i) {
+                target->push_back(i);
+                return *this;
+            }
+
+            back_insert_iterator& operator*() {
+                return *this;
+            }
+
+            back_insert_iterator& operator++() {
+                return *this;
+            }
+
+            back_insert_iterator operator++(int) {
+                return *this;
+            }
+
+        private:
+            soa_region* target;
+    };
+
+    friend bool operator==(const soa_region& lhs, const soa_region& rhs) {
+        return lhs.starts == rhs.starts && lhs.ends == rhs.ends && lhs.data == rhs.data;
+    }
+
+    friend bool operator!=(const soa_region& lhs, const soa_region& rhs) {
+        return !(lhs == rhs);
+    }
+
+    friend soa_region operator|(const soa_region& lhs, const soa_region& rhs) {
+        soa_region result;
+        result.reserve(lhs.size() + rhs.size());
+        detail::merge_union(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), back_insert_iterator(result));
+        return result;
+    }
+
+    template<typename M>
+    friend soa_region operator&(const soa_region& lhs, const soa_region<Dimension, BitsPerDimension, M>& rhs) {
+        soa_region result;
+        detail::merge_intersection(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), back_insert_iterator(result));
+        return result;
+    }
+
+    template<typename M>
+    friend soa_region operator-(const soa_region& lhs, const soa_region<Dimension, BitsPerDimension, M>& rhs) {
+        soa_region result;
+        detail::merge_difference(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), back_insert_iterator(result));
+        return result;
+    }
+
+    friend soa_region operator^(const soa_region& lhs, const soa_region& rhs) {
+        soa_region result;
+        detail::merge_symmetric_difference(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), back_insert_iterator(result));
+        return result;
+    }
+
+    friend void operator|=(soa_region& lhs, const soa_region& rhs) {
+        lhs = lhs | rhs;
+    }
+
+    template<typename M>
+    friend void operator&=(soa_region& lhs, const soa_region<Dimension, BitsPerDimension, M>& rhs) {
+        lhs = lhs & rhs;
+    }
+
+    template<typename M>
+    friend void operator-=(soa_region& lhs, const soa_region<Dimension, BitsPerDimension, M>& rhs) {
+        lhs = lhs - rhs;
+    }
+
+    friend void operator^=(soa_region& lhs, const soa_region& rhs) {
+        lhs = lhs ^ rhs;
+    }
+
+    // Returns the position of the interval containing c, or size() if there isn't one.
+    // A branchless binary search narrows the starts to a block, which is finished with SIMD.
+    size_t find(const morton_code<Dimension, BitsPerDimension> c, zinc::cpu::isa isa = zinc::cpu::best_isa()) const;
+
+    bool contains(const morton_code<Dimension, BitsPerDimension> c, zinc::cpu::isa isa = zinc::cpu::best_isa()) const {
+        return find(c, isa) != size();
+    }
+
+    uint64_t area(zinc::cpu::isa isa = zinc::cpu::best_isa()) const;
+
+    template<typename M>
+    bool intersects(const soa_region<Dimension, BitsPerDimension, M>& rhs, zinc::cpu::isa isa = zinc::cpu::best_isa()) const;
+};
+
+namespace detail {
+
+static inline size_t leading_below(const uint64_t* keys, size_t n, uint64_t v, zinc::cpu::isa isa) {
+    assert(zinc::cpu::supports(isa));
+    switch (isa) {
+        case zinc::cpu::isa::avx512: return simd::leading_below_avx512(keys, n, v);
+        case zinc::cpu::isa::avx2: return simd::leading_below_avx2(keys, n, v);
+        case zinc::cpu::isa::scalar: break;
+    }
+    return simd::leading_below_scalar(keys, n, v);
+}
+
+} //::detail
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+size_t soa_region<Dimension, BitsPerDimension, T>::find(const morton_code<Dimension, BitsPerDimension> c, zinc::cpu::isa isa) const {
+    // the first start after c is in [lo, lo + n]
+    size_t lo = 0, n = size();
+    while (n > 16) {
+        size_t half = n / 2;
+        lo = starts[lo + half] <= c.data ? lo + half : lo;
+        n -= half;
+    }
+    size_t upper = c.data == std::numeric_limits<uint64_t>::max() ? lo + n : lo + detail::leading_below(starts.data() + lo, n, c.data + 1, isa);
+    if (upper == 0 || ends[upper - 1] < c.data) {
+        return size();
+    }
+    return upper - 1;
+}
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+uint64_t soa_region<Dimension, BitsPerDimension, T>::area(zinc::cpu::isa isa) const {
+    assert(zinc::cpu::supports(isa));
+    switch (isa) {
+        case zinc::cpu::isa::avx512: return simd::area_avx512(starts.data(), ends.data(), size());
+        case zinc::cpu::isa::avx2: return simd::area_avx2(starts.data(), ends.data(), size());
+        case zinc::cpu::isa::scalar: break;
+    }
+    return simd::area_scalar(starts.data(), ends.data(), size());
+}
+
+template <uint32_t Dimension, uint32_t BitsPerDimension, typename T>
+template <typename M>
+bool soa_region<Dimension, BitsPerDimension, T>::intersects(const soa_region<Dimension, BitsPerDimension, M>& rhs, zinc::cpu::isa isa) const {
+    assert(zinc::cpu::supports(isa));
+    const uint64_t *a_starts = starts.data(), *a_ends = ends.data(), *b_starts = rhs.starts.data(), *b_ends = rhs.ends.data();
+    switch (isa) {
+        case zinc::cpu::isa::avx512: return simd::intersects_avx512(a_starts, a_ends, size(), b_starts, b_ends, rhs.size());
+        case zinc::cpu::isa::avx2: return simd::intersects_avx2(a_starts, a_ends, size(), b_starts, b_ends, rhs.size());
+        case zinc::cpu::isa::scalar: break;
+    }
+    return simd::intersects_scalar(a_starts, a_ends, size(), b_starts, b_ends, rhs.size());
+}
+
+} //::morton
+
+} //::zinc
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <array>
+#include <type_traits>
+#include <vector>
+
+namespace zinc {
+
+// Stable LSD radix sort of v by an unsigned integer key, one byte per pass.
+// All the byte histograms are built in a single pass, and passes where every
+// key has the same byte are skipped, so keys confined to a small range sort in
+// fewer passes. scratch is resized to v's size and can be reused between calls.
+template<typename T, typename Key>
+static void radix_sort(std::vector<T>& v, Key key, std::vector<T>& scratch) {
+    if (v.empty()) {
+        return;
+    }
+    using key_type = typename std::decay<decltype(key(v[0]))>::type;
+    constexpr size_t digits = sizeof(key_type);
+    std::array<std::array<size_t, 256>, digits> counts {};
+    for (const T& t : v) {
+        key_type k = key(t);
+        for (size_t d = 0; d < digits; d++) {
+            counts[d][(k >> (8 * d)) & 0xff]++;
+        }
+    }
+    scratch.resize(v.size(), v[0]);
+    for (size_t d = 0; d < digits; d++) {
+        auto& count = counts[d];
+        if (count[(key(v[0]) >> (8 * d)) & 0xff] == v.size()) {
+            continue;
+        }
+        size_t offset = 0;
+        for (auto& c : count) {
+            size_t n = c;
+            c = offset;
+            offset += n;
+        }
+        for (const T& t : v) {
+            scratch[count[(key(t) >> (8 * d)) & 0xff]++] = t;
+        }
+        v.swap(scratch);
+    }
+}
+
+template<typename T, typename Key>
+static void radix_sort(std::vector<T>& v, Key key) {
+    std::vector<T> scratch;
+    radix_sort(v, key, scratch);
+}
+
+} //::zinc
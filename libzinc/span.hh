@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cassert>
+#include <type_traits>
+#include <utility>
+
+namespace zinc {
+
+// A minimal stand-in for C++20 std::span: a non-owning view over contiguous elements.
+// It can be built from a pointer and a count, or from anything with data() and size()
+// such as std::vector and std::array.
+template<typename T>
+struct span {
+    using element_type = T;
+    using value_type = typename std::remove_cv<T>::type;
+    using iterator = T*;
+
+    constexpr span(): ptr(nullptr), count(0) {}
+    constexpr span(T* _ptr, size_t _count): ptr(_ptr), count(_count) {}
+
+    template<typename Container, typename = typename std::enable_if<
+        std::is_convertible<decltype(std::declval<Container&>().data()), T*>::value>::type>
+    constexpr span(Container&& c): ptr(c.data()), count(c.size()) {}
+
+    constexpr T* data() const { return ptr; }
+    constexpr size_t size() const { return count; }
+    constexpr bool empty() const { return count == 0; }
+    constexpr T* begin() const { return ptr; }
+    constexpr T* end() const { return ptr + count; }
+
+    constexpr T& operator[](size_t i) const {
+        assert(i < count);
+        return ptr[i];
+    }
+
+    constexpr span subspan(size_t offset, size_t n) const {
+        assert(offset + n <= count);
+        return {ptr + offset, n};
+    }
+
+    constexpr span subspan(size_t offset) const {
+        assert(offset <= count);
+        return {ptr + offset, count - offset};
+    }
+
+private:
+    T* ptr;
+    size_t count;
+};
+
+} //::zinc
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace zinc {
+
+// A fixed set of worker threads for running parallel loops.
+// The thread calling parallel_for takes part in the loop, so a pool of size 1 has no
+// workers and runs everything inline. Only one loop runs at a time.
+class thread_pool {
+public:
+    thread_pool(size_t threads = std::thread::hardware_concurrency()) {
+        for (size_t i = 1; i < threads; i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // the number of threads that run a loop, including the caller
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    // Runs f(0) ... f(n-1) across the pool, returning once every call has finished.
+    template<typename F>
+    void parallel_for(size_t n, F&& f) {
+        if (workers.empty() || n <= 1) {
+            for (size_t i = 0; i < n; i++) {
+                f(i);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = [&f](size_t i) { f(i); };
+            task_count = n;
+            next = 0;
+            busy = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        run_tasks();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+        task = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::function<void(size_t)> task;
+    size_t task_count = 0;
+    std::atomic<size_t> next {0};
+    // the workers yet to finish the current loop
+    size_t busy = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void run_tasks() {
+        for (size_t i = next++; i < task_count; i = next++) {
+            task(i);
+        }
+    }
+
+    void work() {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            lock.unlock();
+            run_tasks();
+            lock.lock();
+            if (--busy == 0) {
+                done.notify_one();
+            }
+        }
+    }
+};
+
+} //::zinc
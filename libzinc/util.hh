@@ -3,6 +3,13 @@
 #include <cstdint>
 #include <cassert>
 
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include "cpu.hh"
 #include "encoding.hh"
 #include <immintrin.h>
 
@@ -10,122 +17,362 @@ namespace zinc {
 
 namespace morton {
 
+// Codes of more than 64 bits are kept in two words, as an unsigned __int128.
+__extension__ typedef unsigned __int128 uint128_t;
+
+// Lets a template parameter be given explicitly without being deduced from an argument,
+// so the helpers below take uint64_t unless a wider word is asked for.
+template<typename T>
+struct word_identity {
+    using type = T;
+};
+
+template<typename T>
+using word_identity_t = typename word_identity<T>::type;
+
 static uint64_t fast_log2(const uint64_t x) {
     assert(x != 0);
     return sizeof(x) * 8 - 1 - __builtin_clzll(x);
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension>
+static inline uint64_t fast_log2(const uint128_t x) {
+    const uint64_t high = static_cast<uint64_t>(x >> 64);
+    return high != 0 ? 64 + fast_log2(high) : fast_log2(static_cast<uint64_t>(x));
+}
+
+static inline uint64_t count_trailing_zeros(const uint64_t x) {
+    assert(x != 0);
+    return __builtin_ctzll(x);
+}
+
+static inline uint64_t count_trailing_zeros(const uint128_t x) {
+    const uint64_t low = static_cast<uint64_t>(x);
+    return low != 0 ? count_trailing_zeros(low) : 64 + count_trailing_zeros(static_cast<uint64_t>(x >> 64));
+}
+
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename Word = uint64_t>
 // This gives the maximum alignment level possible for a given number, 
 // e.g. given 2 it returns 0, given 8 it returns 1, given 0 it returns 32.
-static uint64_t get_max_align_level(const uint64_t code){
-    return code == 0 ? BitsPerDimension : __builtin_ctzll(code)/ Dimension;
+static uint64_t get_max_align_level(const word_identity_t<Word> code){
+    return code == 0 ? BitsPerDimension : count_trailing_zeros(code)/ Dimension;
 }
 
-template<uint32_t Dimension>
+template<uint32_t Dimension, typename Word = uint64_t>
 // Returns the level size required for two points to be in the same cell
-static uint64_t get_unifying_level(const uint64_t min, const uint64_t max){
+static uint64_t get_unifying_level(const word_identity_t<Word> min, const word_identity_t<Word> max){
     assert(max >= min);
     // the gets the maximum allowed for this range, max+1
     return max == min ? 0 : (fast_log2(max ^ min)/Dimension) +1;
 }
 
-template<uint32_t Dimension>
+template<uint32_t Dimension, typename Word = uint64_t>
 // Returns the  morton code for a given level, starting from 0;
-static uint64_t get_morton_code(const uint64_t level) {
-    return (1LLU << level * Dimension) -1;
+static Word get_morton_code(const uint64_t level) {
+    return level * Dimension >= sizeof(Word) * 8 ? ~Word{0} : (Word{1} << level * Dimension) -1;
 }
 
-template<uint32_t Dimension>
+template<uint32_t Dimension, typename Word = uint64_t>
 // given a morton value it will return the morton aligned value of size level that contains it.
 // e.g. given 14,1 it will give 12. given 14,2 it will give 0.
-static uint64_t get_parent_morton_aligned(const uint64_t code, uint32_t level) {
-    return (code >> (Dimension * level)) << (Dimension * level);
+static Word get_parent_morton_aligned(const word_identity_t<Word> code, uint32_t level) {
+    return Dimension * level >= sizeof(Word) * 8 ? 0 : (code >> (Dimension * level)) << (Dimension * level);
 }
 
-template<uint32_t Dimension, uint32_t BitsPerDimension>
+template<uint32_t Dimension, uint32_t BitsPerDimension, typename Word = uint64_t>
 // given a range this will return the next morton aligned value
-static uint64_t get_align_max(const uint64_t min, const uint64_t max) {
+static Word get_align_max(const word_identity_t<Word> min, const word_identity_t<Word> max) {
     assert(max >= min);
     if (max == min) return min;
     // this gets the maximum allowed for this value
-    uint64_t align_max = (min != 0) ? 
-          min + get_morton_code<Dimension>(get_max_align_level<Dimension,BitsPerDimension>(min))
-        : std::numeric_limits<uint64_t>::max();
-    uint64_t max_align = min + get_morton_code<Dimension>((fast_log2(max+1 - min)/Dimension));
+    Word align_max = (min != 0) ? 
+          min + get_morton_code<Dimension, Word>(get_max_align_level<Dimension,BitsPerDimension,Word>(min))
+        : ~Word{0};
+    Word max_align = min + get_morton_code<Dimension, Word>((fast_log2(max+1 - min)/Dimension));
     return std::min(align_max,max_align);
 }
 
 
-static const uint64_t __morton_2_x_mask = 0x5555555555555555;
-static const uint64_t __morton_2_y_mask = 0xaaaaaaaaaaaaaaaa;
+// The mask of the bits of the first coordinate in a word, every Dimension'th bit.
+template<uint32_t Dimension, typename Word = uint64_t>
+static constexpr Word morton_x_mask() {
+    static_assert(Dimension >= 1 && Dimension <= 64);
+    Word mask = 0;
+    for (uint32_t bit = 0; bit + Dimension <= sizeof(Word) * 8; bit += Dimension) {
+        mask |= Word{1} << bit;
+    }
+    return mask;
+}
 
-static const uint64_t __morton_3_x_mask = 0x1249249249249249;
-static const uint64_t __morton_3_y_mask = 0x2492492492492492;
-static const uint64_t __morton_3_z_mask = 0x4924924924924924;
+static const uint64_t __morton_2_x_mask = morton_x_mask<2>();
+static const uint64_t __morton_2_y_mask = morton_x_mask<2>() << 1;
 
-#ifdef __BMI2__
-template<typename Integer>
-static inline constexpr Integer pdep(Integer v, Integer mask) {
-    static_assert(sizeof(Integer) == 4 || sizeof(Integer) == 8);
-    if constexpr (sizeof(Integer) == 4)
-        return _pdep_u32(v, mask);
-    else if constexpr (sizeof(Integer) == 8)
-        return _pdep_u64(v, mask);
+static const uint64_t __morton_3_x_mask = morton_x_mask<3>();
+static const uint64_t __morton_3_y_mask = morton_x_mask<3>() << 1;
+static const uint64_t __morton_3_z_mask = morton_x_mask<3>() << 2;
+
+namespace detail {
+
+// The masks for the magic bits expand and compact of Bits bits into every Dimension'th
+// bit of a word. The bits are moved as chunks that halve in size each step: with chunks
+// of p bits, chunk j sits at j * p * Dimension, so bit i is at (i / p) * p * Dimension + i % p.
+// masks[k] has the bits where the chunks of 2^k bits are, from masks[steps], everything in
+// one chunk, down to masks[0], every bit in its place.
+template<uint32_t Dimension, uint32_t Bits>
+struct magic_bits {
+    static_assert(Dimension >= 1 && Bits >= 1 && Dimension * (Bits - 1) < 64, "the bits must fit in a word");
+
+    static constexpr uint32_t make_steps() {
+        uint32_t steps = 0;
+        while ((uint64_t{1} << steps) < Bits) {
+            steps++;
+        }
+        return steps;
+    }
+
+    static constexpr uint32_t steps = make_steps();
+
+    static constexpr std::array<uint64_t, steps + 1> make_masks() {
+        std::array<uint64_t, steps + 1> masks {};
+        for (uint32_t k = 0; k <= steps; k++) {
+            const uint64_t p = uint64_t{1} << k;
+            for (uint64_t i = 0; i < Bits; i++) {
+                masks[k] |= uint64_t{1} << ((i / p) * p * Dimension + i % p);
+            }
+        }
+        return masks;
+    }
+
+    static constexpr std::array<uint64_t, steps + 1> masks = make_masks();
+
+    // how far the upper half of each chunk of 2^(k + 1) bits moves to become its own chunk
+    static constexpr uint32_t shift(uint32_t k) {
+        return (uint32_t{1} << k) * (Dimension - 1);
+    }
+};
+
+} //::detail
+
+namespace detail {
+
+// The steps of the magic bits below, one for each halving, written out with a fold so
+// that they are always unrolled.
+template<uint32_t Dimension, uint32_t Bits, size_t... K>
+static inline constexpr uint64_t expand_steps(uint64_t x, std::index_sequence<K...>) {
+    using magic = magic_bits<Dimension, Bits>;
+    ((x = (x | (x << magic::shift(magic::steps - 1 - K))) & magic::masks[magic::steps - 1 - K]), ...);
+    return x;
 }
 
-template<typename Integer>
-static inline constexpr Integer pext(Integer v, Integer mask) {
-    static_assert(sizeof(Integer) == 4 || sizeof(Integer) == 8);
-    if constexpr (sizeof(Integer) == 4)
-        return _pext_u32(v, mask);
-    else if constexpr (sizeof(Integer) == 8)
-        return _pext_u64(v, mask);
+template<uint32_t Dimension, uint32_t Bits, size_t... K>
+static inline constexpr uint64_t compact_steps(uint64_t x, std::index_sequence<K...>) {
+    using magic = magic_bits<Dimension, Bits>;
+    ((x = (x | (x >> magic::shift(K))) & magic::masks[K + 1]), ...);
+    return x;
 }
 
-template<typename Integer>
-static inline constexpr Integer expand_bits_2(Integer v) {
-    return pdep(v, __morton_2_x_mask);
+} //::detail
+
+// The magic bits expand and compact for any Dimension and Bits, which spread the bits out,
+// or gather them back in, with a shift and a mask for each halving. They work on any
+// x86-64, and are what expand_bits and compact_bits use without BMI2.
+template<uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline constexpr uint64_t expand_bits_magic(uint64_t x) {
+    using magic = detail::magic_bits<Dimension, Bits>;
+    return detail::expand_steps<Dimension, Bits>(x & magic::masks[magic::steps], std::make_index_sequence<magic::steps>{});
 }
 
-template<typename Integer>
-static inline constexpr Integer compact_bits_2(Integer v) {
-    return pext(v, __morton_2_x_mask);
+template<uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline constexpr uint64_t compact_bits_magic(uint64_t x) {
+    using magic = detail::magic_bits<Dimension, Bits>;
+    return detail::compact_steps<Dimension, Bits>(x & magic::masks[0], std::make_index_sequence<magic::steps>{});
+}
+
+static inline constexpr uint64_t expand_bits_2_magic(uint64_t x) {
+    return expand_bits_magic<2, 32>(x);
+}
+
+static inline constexpr uint64_t compact_bits_2_magic(uint64_t x) {
+    return compact_bits_magic<2, 32>(x);
+}
+
+static inline constexpr uint64_t expand_bits_3_magic(uint64_t x) {
+    return expand_bits_magic<3, 21>(x);
+}
+
+static inline constexpr uint64_t compact_bits_3_magic(uint64_t x) {
+    return compact_bits_magic<3, 21>(x);
+}
+
+namespace detail {
+
+// The lookup tables for interleaving a byte at a time, for up to 8 dimensions.
+// expand[b] is byte b spread out to every Dimension'th bit. compact[phase][b] gathers the
+// bits of byte b at positions i where (i + phase) % Dimension == 0, which are the bits of
+// the first coordinate when the byte starts phase bits past a multiple of Dimension.
+template<uint32_t Dimension>
+struct interleave_tables {
+    static_assert(Dimension >= 1 && Dimension <= 8, "a byte spread out must fit in a word");
+
+    static constexpr std::array<uint64_t, 256> make_expand() {
+        std::array<uint64_t, 256> expand {};
+        for (uint32_t b = 0; b < 256; b++) {
+            for (uint32_t i = 0; i < 8; i++) {
+                expand[b] |= uint64_t{(b >> i) & 1} << (i * Dimension);
+            }
+        }
+        return expand;
+    }
+
+    static constexpr std::array<std::array<uint8_t, 256>, Dimension> make_compact() {
+        std::array<std::array<uint8_t, 256>, Dimension> compact {};
+        for (uint32_t phase = 0; phase < Dimension; phase++) {
+            for (uint32_t b = 0; b < 256; b++) {
+                uint32_t n = 0;
+                for (uint32_t i = 0; i < 8; i++) {
+                    if ((i + phase) % Dimension == 0) {
+                        compact[phase][b] |= static_cast<uint8_t>(((b >> i) & 1) << n++);
+                    }
+                }
+            }
+        }
+        return compact;
+    }
+
+    static constexpr std::array<uint64_t, 256> expand = make_expand();
+    static constexpr std::array<std::array<uint8_t, 256>, Dimension> compact = make_compact();
+};
+
+template<uint32_t Dimension, uint32_t Bits, size_t... K>
+static inline uint64_t expand_bytes(uint64_t x, std::index_sequence<K...>) {
+    return (... | (interleave_tables<Dimension>::expand[(x >> (8 * K)) & 0xff] << (8 * K * Dimension)));
+}
+
+// byte K of the code holds the coordinate bits from (8 * K + Dimension - 1) / Dimension up
+template<uint32_t Dimension, uint32_t Bits, size_t... K>
+static inline uint64_t compact_bytes(uint64_t x, std::index_sequence<K...>) {
+    return (... | (uint64_t{interleave_tables<Dimension>::compact[(8 * K) % Dimension][(x >> (8 * K)) & 0xff]} << ((8 * K + Dimension - 1) / Dimension)));
+}
+
+} //::detail
+
+// The lookup table expand and compact, a byte at a time, for up to 8 dimensions. They need
+// no BMI2. Expanding takes fewer steps than magic bits, but compacting takes a lookup for
+// each byte of the code and is slower than magic bits, see encoding-bench.
+template<uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline uint64_t expand_bits_lut(uint64_t x) {
+    using magic = detail::magic_bits<Dimension, Bits>;
+    // only the bytes of x that land inside the word
+    constexpr size_t bytes = std::min<size_t>((Bits + 7) / 8, (64 + 8 * Dimension - 1) / (8 * Dimension));
+    return detail::expand_bytes<Dimension, Bits>(x, std::make_index_sequence<bytes>{}) & magic::masks[0];
+}
+
+template<uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline uint64_t compact_bits_lut(uint64_t x) {
+    using magic = detail::magic_bits<Dimension, Bits>;
+    constexpr size_t bytes = (Dimension * (Bits - 1) + 8) / 8;
+    return detail::compact_bytes<Dimension, Bits>(x & magic::masks[0], std::make_index_sequence<bytes>{});
+}
+
+// The pdep and pext expand and compact, which must only be called where the CPU supports
+// BMI2. They are written in asm rather than with the intrinsics, which would need the
+// caller to be compiled for BMI2 too, so they inline into code built for any x86-64.
+template<uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline uint64_t expand_bits_bmi2(uint64_t x) {
+    uint64_t result;
+    asm("pdep %2, %1, %0" : "=r"(result) : "r"(x), "rm"(detail::magic_bits<Dimension, Bits>::masks[0]));
+    return result;
+}
+
+template<uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline uint64_t compact_bits_bmi2(uint64_t x) {
+    uint64_t result;
+    asm("pext %2, %1, %0" : "=r"(result) : "r"(x), "rm"(detail::magic_bits<Dimension, Bits>::masks[0]));
+    return result;
+}
+
+// Expand and compact with the way of interleaving given as a template argument, for code
+// that is specialised for each of them, see with_interleave.
+template<zinc::cpu::interleave How, uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline uint64_t expand_bits_as(uint64_t x) {
+    if constexpr (How == zinc::cpu::interleave::bmi2) {
+        return expand_bits_bmi2<Dimension, Bits>(x);
+    } else if constexpr (How == zinc::cpu::interleave::lut && Dimension <= 8) {
+        return expand_bits_lut<Dimension, Bits>(x);
+    } else {
+        return expand_bits_magic<Dimension, Bits>(x);
+    }
+}
+
+template<zinc::cpu::interleave How, uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline uint64_t compact_bits_as(uint64_t x) {
+    if constexpr (How == zinc::cpu::interleave::bmi2) {
+        return compact_bits_bmi2<Dimension, Bits>(x);
+    } else {
+        return compact_bits_magic<Dimension, Bits>(x);
+    }
+}
+
+namespace detail {
+
+// The choice made at load time, so that each call only has to branch on it.
+static const zinc::cpu::interleave interleave_in_use = zinc::cpu::best_interleave();
+
+} //::detail
+
+// Calls f with how as a std::integral_constant, so that f can be written once and
+// specialised for each way of interleaving, with one branch to pick between them.
+template<typename F>
+static inline auto with_interleave(zinc::cpu::interleave how, F f) {
+    assert(zinc::cpu::supports(how));
+    switch (how) {
+        case zinc::cpu::interleave::bmi2: return f(std::integral_constant<zinc::cpu::interleave, zinc::cpu::interleave::bmi2>{});
+        case zinc::cpu::interleave::lut: return f(std::integral_constant<zinc::cpu::interleave, zinc::cpu::interleave::lut>{});
+        case zinc::cpu::interleave::magic: break;
+    }
+    return f(std::integral_constant<zinc::cpu::interleave, zinc::cpu::interleave::magic>{});
+}
+
+template<typename F>
+static inline auto with_interleave(F f) {
+    return with_interleave(detail::interleave_in_use, f);
+}
+
+// Expand and compact for whichever dimension is given, for code that works in any, in
+// the fastest way on this machine unless one is given. Bits is how many bits of each
+// coordinate are taken.
+template<uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline uint64_t expand_bits(uint64_t v, zinc::cpu::interleave how = detail::interleave_in_use) {
+    return with_interleave(how, [v](auto as) { return expand_bits_as<decltype(as)::value, Dimension, Bits>(v); });
+}
+
+template<uint32_t Dimension, uint32_t Bits = 64 / Dimension>
+static inline uint64_t compact_bits(uint64_t v, zinc::cpu::interleave how = detail::interleave_in_use) {
+    return with_interleave(how, [v](auto as) { return compact_bits_as<decltype(as)::value, Dimension, Bits>(v); });
 }
 
 template<typename Integer>
-static inline constexpr Integer expand_bits_3(Integer v) {
-    return pdep(v, __morton_3_x_mask);
+static inline Integer expand_bits_2(Integer v) {
+    static_assert(sizeof(Integer) == 8, "the bits are expanded into a 64 bit code");
+    return expand_bits<2, 32>(v);
 }
 
 template<typename Integer>
-static inline constexpr Integer compact_bits_3(Integer v) {
-    return pext(v, __morton_3_x_mask);
+static inline Integer compact_bits_2(Integer v) {
+    static_assert(sizeof(Integer) == 8, "the bits are expanded into a 64 bit code");
+    return compact_bits<2, 32>(v);
 }
 
-#else
 template<typename Integer>
-static_assert(sizeof(Integer) == 8, "non 64bit non BMI2 expand/compact_bits_2 are not yet implemented");
-static inline constexpr Integer expand_bits_2(Integer x) {
-    x = (x ^ (x << 16)) & 0x0000ffff0000ffff;
-    x = (x ^ (x << 8))  & 0x00ff00ff00ff00ff;
-    x = (x ^ (x << 4))  & 0x0f0f0f0f0f0f0f0f;
-    x = (x ^ (x << 2))  & 0x3333333333333333;
-    x = (x ^ (x << 1))  & 0x5555555555555555;
-    return x;
+static inline Integer expand_bits_3(Integer v) {
+    static_assert(sizeof(Integer) == 8, "the bits are expanded into a 64 bit code");
+    return expand_bits<3, 21>(v);
 }
 
 template<typename Integer>
-static inline constexpr Integer compact_bits_2(Integer x) {
-    x &= 0x5555555555555555;
-    x = (x ^ (x >>  1))  & 0x3333333333333333;
-    x = (x ^ (x >>  2))  & 0x0f0f0f0f0f0f0f0f;
-    x = (x ^ (x >>  4))  & 0x00ff00ff00ff00ff;
-    x = (x ^ (x >>  8))  & 0x0000ffff0000ffff;
-    x = (x ^ (x >>  16)) & 0x00000000ffffffff;
-    return x;
+static inline Integer compact_bits_3(Integer v) {
+    static_assert(sizeof(Integer) == 8, "the bits are expanded into a 64 bit code");
+    return compact_bits<3, 21>(v);
 }
-#endif
 
 } //::morton
 
@@ -2,7 +2,20 @@
 
 #include "AABB.hh"
 #include "cell.hh"
+#include "cpu.hh"
 #include "encoding.hh"
+#include "expr.hh"
+#include "hilbert.hh"
+#include "index.hh"
 #include "interval.hh"
+#include "mapped.hh"
+#include "parallel.hh"
+#include "query.hh"
 #include "region.hh"
+#include "serialize.hh"
+#include "simd.hh"
+#include "soa.hh"
+#include "sort.hh"
+#include "span.hh"
+#include "thread_pool.hh"
 #include "util.hh"
@@ -3,9 +3,55 @@
 #include <cassert>
 #include <iostream>
 #include <cmath>
+#include <array>
+#include <numeric>
 
 #include <libzinc/zinc.hh>
 
+// The generator behind the randomised tests, so that every run checks the same cases.
+struct lcg {
+    uint64_t seed;
+
+    uint64_t operator()() {
+        seed = seed * 6364136223846793005u + 1442695040888963407u;
+        return seed;
+    }
+};
+
+// The codes of every point in the box [lo, hi], sorted.
+template<typename Code, typename Coordinate, size_t Dimension>
+static std::vector<typename Code::word_type> codes_in_box(const std::array<Coordinate, Dimension>& lo, const std::array<Coordinate, Dimension>& hi) {
+    std::vector<typename Code::word_type> codes;
+    std::array<Coordinate, Dimension> p = lo;
+    while (true) {
+        codes.push_back(Code::encode(p));
+        size_t d = 0;
+        for (; d < Dimension && p[d] == hi[d]; d++) {
+            p[d] = lo[d];
+        }
+        if (d == Dimension) {
+            break;
+        }
+        p[d]++;
+    }
+    std::sort(codes.begin(), codes.end());
+    return codes;
+}
+
+// The region of a sorted list of codes, each run of consecutive codes making one interval.
+template<typename Region, typename Word>
+static Region region_of_codes(const std::vector<Word>& codes) {
+    Region r;
+    for (auto c : codes) {
+        if (!r.intervals.empty() && r.intervals.back().end + 1 == c) {
+            r.intervals.back().end = c;
+        } else {
+            r.intervals.push_back({c, c});
+        }
+    }
+    return r;
+}
+
 int main() {
     {
         assert(!(zinc::morton::AABB<2, 32>{3, 12}).is_morton_aligned());
@@ -590,6 +636,1602 @@ int main() {
         assert(a5 == 4);
         assert(a6 == 0);
     }
+
+    {
+        // the batch kernels should agree with the scalar encoder, including the tail
+        std::vector<uint32_t> xs, ys;
+        for (uint32_t i = 0; i < 37; i++) {
+            xs.push_back(i * 2654435761u);
+            ys.push_back(~i * 40503u);
+        }
+        xs.push_back(0xffffffff);
+        ys.push_back(0xffffffff);
+        for (auto isa : {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512}) {
+            if (!zinc::cpu::supports(isa)) continue;
+            std::vector<uint64_t> codes(xs.size());
+            morton_code<2, 32>::encode_batch(xs, ys, codes, isa);
+            for (size_t i = 0; i < xs.size(); i++) {
+                assert((codes[i] == morton_code<2, 32>::encode({xs[i], ys[i]}).data));
+            }
+            std::vector<uint32_t> dx(xs.size()), dy(xs.size());
+            morton_code<2, 32>::decode_batch(codes, dx, dy, isa);
+            assert(dx == xs);
+            assert(dy == ys);
+        }
+    }
+
+    {
+        zinc::morton::region<2, 32, uint64_t> r = {{
+            {2, 5, 10},
+            {9, 9, 11},
+            {12, 40, 12},
+        }};
+        assert(!r.contains(0));
+        assert(r.contains(2));
+        assert(r.contains(5));
+        assert(!r.contains(6));
+        assert(r.contains(9));
+        assert(r.contains(40));
+        assert(!r.contains(41));
+        assert(r.find(1) == nullptr);
+        assert(r.find(13)->data == 12);
+        assert(r.find(9)->data == 11);
+        assert((zinc::morton::region<2, 32>{{}}).find(0) == nullptr);
+
+        // the index must agree with the binary search for every code around every interval
+        for (size_t n = 0; n <= r.intervals.size(); n++) {
+            zinc::morton::region<2, 32, uint64_t> s = {{r.intervals.begin(), r.intervals.begin() + n}};
+            zinc::morton::region_index<2, 32, uint64_t> index(s);
+            for (uint64_t c = 0; c < 45; c++) {
+                assert(index.find(c) == s.find(c));
+            }
+        }
+        zinc::morton::region<2, 32> big;
+        for (uint64_t i = 0; i < 1000; i++) {
+            big.intervals.push_back({i * 10, i * 10 + i % 7});
+        }
+        zinc::morton::region_index<2, 32> index(big);
+        for (uint64_t c = 0; c < 10010; c++) {
+            assert(index.contains(c) == big.contains(c));
+        }
+    }
+
+    {
+        zinc::morton::region<2, 32> r;
+        for (uint64_t i = 0; i < 1000; i++) {
+            r.intervals.push_back({i * 100, i * 100 + i % 50});
+        }
+        std::vector<morton_code<2, 32>> queries;
+        for (uint64_t i = 0; i < 5000; i++) {
+            queries.push_back((i * 2654435761u) % 101000);
+        }
+        std::vector<const zinc::morton::region<2, 32>::interval_type*> out(queries.size());
+        r.lookup(queries, out);
+        for (size_t i = 0; i < queries.size(); i++) {
+            assert(out[i] == r.find(queries[i]));
+        }
+        std::sort(queries.begin(), queries.end(), [](auto a, auto b) { return a.data < b.data; });
+        r.lookup_sorted(queries, out);
+        for (size_t i = 0; i < queries.size(); i++) {
+            assert(out[i] == r.find(queries[i]));
+        }
+        r.intervals.clear();
+        r.lookup(queries, out);
+        assert(std::count(out.begin(), out.end(), nullptr) == static_cast<ptrdiff_t>(out.size()));
+    }
+
+    {
+        zinc::morton::region<2, 32> a = {{}};
+        zinc::morton::region<2, 32> b = {{{0, 3}, {5, 7}}};
+        a |= b;
+        assert(a == b);
+        a |= zinc::morton::region<2, 32>{{}};
+        assert(a == b);
+        a |= zinc::morton::region<2, 32>{{{0, 0}, {4, 4}, {9, 9}}};
+        zinc::morton::region<2, 32> r = {{{0, 7}, {9, 9}}};
+        assert(a == r);
+        a |= a;
+        assert(a == r);
+        zinc::morton::region<2, 32> e = {{}};
+        e |= e;
+        assert(e.intervals.empty());
+        // intervals at the very end of the curve
+        a = {{{0, 0}, {std::numeric_limits<uint64_t>::max() - 1, std::numeric_limits<uint64_t>::max()}}};
+        a |= zinc::morton::region<2, 32>{{{0, 1}, {std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max()}}};
+        r = {{{0, 1}, {std::numeric_limits<uint64_t>::max() - 1, std::numeric_limits<uint64_t>::max()}}};
+        assert(a == r);
+    }
+
+    {
+        // intervals with different data are kept apart, and ties keep the lhs first
+        zinc::morton::region<2, 32, uint64_t> a = {{{0, 4, 1}, {8, 9, 1}}};
+        zinc::morton::region<2, 32, uint64_t> b = {{{5, 7, 1}, {8, 9, 2}}};
+        a |= b;
+        zinc::morton::region<2, 32, uint64_t> r = {{{0, 9, 1}, {8, 9, 2}}};
+        assert(a == r);
+    }
+
+    {
+        // temporaries on the left are reused, and must give the same results as copies
+        zinc::morton::region<2, 32> a = {{{0, 10}, {20, 30}}};
+        zinc::morton::region<2, 32> b = {{{5, 25}}};
+        zinc::morton::region<2, 32> c = {{{0, 40}}};
+        zinc::morton::region<2, 32> d = {{{8, 22}}};
+        zinc::morton::region<2, 32> ab = a | b;
+        zinc::morton::region<2, 32> cd = c - d;
+        zinc::morton::region<2, 32> r = {{{0, 7}, {23, 30}}};
+        assert((ab & cd) == r);
+        assert(((a | b) & (c - d)) == r);
+        assert((a | (b & c)) == (a | b));
+        assert(((a - d) | (b - d)) == (zinc::morton::region<2, 32>{{{0, 7}, {23, 30}}}));
+        std::vector<zinc::morton::region<2, 32>::interval_type> scratch;
+        zinc::morton::region<2, 32>::intersect(ab, cd, scratch);
+        assert(ab == r);
+        zinc::morton::region<2, 32>::subtract(ab, a, scratch);
+        assert(ab.empty());
+        a &= a;
+        assert(a == (zinc::morton::region<2, 32>{{{0, 10}, {20, 30}}}));
+        a -= a;
+        assert(a.empty());
+    }
+
+    {
+        // k-way union and intersection agree with folding the pairwise operators
+        std::vector<zinc::morton::region<2, 32, uint64_t>> regions(13);
+        lcg rng {1};
+        for (size_t i = 0; i < regions.size(); i++) {
+            uint64_t s = 0;
+            for (size_t j = 0; j < 20 + i; j++) {
+                const uint64_t seed = rng();
+                s += (seed >> 33) % 9;
+                uint64_t e = s + (seed >> 45) % 12;
+                regions[i].intervals.push_back({s, e, (seed >> 20) % 2});
+                s = e + 2;
+            }
+        }
+        zinc::morton::region<2, 32, uint64_t> u = regions[0], n = regions[0];
+        for (size_t i = 1; i < regions.size(); i++) {
+            u |= regions[i];
+            n &= regions[i];
+        }
+        // with data, the fold may not coalesce what the k-way merge does, so compare the codes
+        // covered with each piece of data
+        using data_region = zinc::morton::region<2, 32, uint64_t>;
+        auto covered = [](const data_region& r, uint64_t c, uint64_t data) {
+            return std::any_of(r.intervals.begin(), r.intervals.end(), [c, data](auto& i) { return i.contains(c) && i.data == data; });
+        };
+        data_region k_u = data_region::union_all(regions);
+        assert(std::is_sorted(k_u.intervals.begin(), k_u.intervals.end()));
+        for (uint64_t c = 0; c < 400; c++) {
+            assert(covered(k_u, c, 0) == covered(u, c, 0));
+            assert(covered(k_u, c, 1) == covered(u, c, 1));
+        }
+        assert(data_region::intersect_all(regions) == n);
+
+        using plain_region = zinc::morton::region<2, 32>;
+        std::vector<plain_region> plain(regions.size());
+        for (size_t i = 0; i < regions.size(); i++) {
+            for (auto& x : regions[i].intervals) {
+                plain[i].intervals.push_back({x.start, x.end});
+            }
+        }
+        plain_region pu = plain[0], pn = plain[0];
+        for (size_t i = 1; i < plain.size(); i++) {
+            pu |= plain[i];
+            pn &= plain[i];
+        }
+        assert(plain_region::union_all(plain) == pu);
+        assert(plain_region::intersect_all(plain) == pn);
+        assert(plain_region::intersect_all({plain.data(), 2}) == (plain[0] & plain[1]));
+        assert(plain_region::union_all({}).empty());
+        assert(plain_region::intersect_all({}).empty());
+        plain[5].intervals.clear();
+        assert(plain_region::intersect_all(plain).empty());
+    }
+
+    {
+        // the parallel operators must match the serial ones exactly, including around cuts
+        // that land inside intervals, and with intervals reaching the end of the curve
+        using data_region = zinc::morton::region<2, 32, uint64_t>;
+        lcg rng {7};
+        auto random_region = [&rng](size_t n, uint64_t gap, uint64_t len) {
+            data_region r;
+            uint64_t s = 0;
+            for (size_t i = 0; i < n; i++) {
+                const uint64_t seed = rng();
+                s += (seed >> 33) % gap;
+                uint64_t e = s + (seed >> 45) % len;
+                r.intervals.push_back({s, e, (seed >> 20) % 2});
+                s = e + 1 + (seed >> 10) % 2;
+            }
+            return r;
+        };
+        for (size_t threads : {1, 2, 3, 8}) {
+            zinc::thread_pool pool(threads);
+            for (size_t trial = 0; trial < 4; trial++) {
+                data_region a = random_region(300, 5 + trial * 20, 40), b = random_region(trial == 3 ? 2 : 250, 30, 200 * trial + 1);
+                if (trial == 2) {
+                    b.intervals.push_back({b.intervals.back().end + 5, std::numeric_limits<uint64_t>::max(), 1});
+                }
+                data_region r = a;
+                zinc::morton::parallel_union(r, b, pool);
+                assert(r == (a | b));
+                r = a;
+                zinc::morton::parallel_intersection(r, b, pool);
+                assert(r == (a & b));
+                r = a;
+                zinc::morton::parallel_difference(r, b, pool);
+                assert(r == (a - b));
+                r = b;
+                zinc::morton::parallel_difference(r, a, pool);
+                assert(r == (b - a));
+            }
+            data_region e, f;
+            zinc::morton::parallel_union(e, e, pool);
+            assert(e.empty());
+            zinc::morton::parallel_union(e, f, pool);
+            assert(e.empty());
+            zinc::morton::parallel_intersection(e, f, pool);
+            assert(e.empty());
+            zinc::morton::parallel_difference(e, f, pool);
+            assert(e.empty());
+            zinc::morton::parallel_intersection(e, random_region(10, 5, 5), pool);
+            assert(e.empty());
+            zinc::morton::parallel_difference(e, random_region(10, 5, 5), pool);
+            assert(e.empty());
+        }
+    }
+
+    {
+        zinc::morton::region<2, 32> a = {{{0, 9}, {20, 29}}};
+        zinc::morton::region<2, 32> b = {{{5, 24}, {30, 31}}};
+        zinc::morton::region<2, 32> r = {{{0, 4}, {10, 19}, {25, 31}}};
+        assert((a ^ b) == r);
+        assert((b ^ a) == r);
+        assert((a ^ a).empty());
+        assert((a ^ zinc::morton::region<2, 32>{{}}) == a);
+        a ^= b;
+        assert(a == r);
+        a ^= a;
+        assert(a.empty());
+
+        // compare against the emulation with differences, keeping the data of each side
+        using data_region = zinc::morton::region<2, 32, uint64_t>;
+        lcg rng {3};
+        auto random_region = [&rng](size_t n) {
+            data_region x;
+            uint64_t s = 0;
+            for (size_t i = 0; i < n; i++) {
+                const uint64_t seed = rng();
+                s += (seed >> 33) % 6;
+                uint64_t e = s + (seed >> 45) % 10;
+                x.intervals.push_back({s, e, (seed >> 20) % 3});
+                s = e + 1;
+            }
+            return x;
+        };
+        for (size_t trial = 0; trial < 20; trial++) {
+            data_region c = random_region(30 + trial), d = random_region(40 - trial);
+            assert((c ^ d) == ((c - d) | (d - c)));
+        }
+    }
+
+    {
+        using zinc::morton::lazy;
+        using data_region = zinc::morton::region<2, 32, uint64_t>;
+        using plain_region = zinc::morton::region<2, 32>;
+        lcg rng {5};
+        auto random_region = [&rng](size_t n) {
+            data_region x;
+            uint64_t s = 0;
+            for (size_t i = 0; i < n; i++) {
+                const uint64_t seed = rng();
+                s += (seed >> 33) % 6;
+                uint64_t e = s + (seed >> 45) % 10;
+                x.intervals.push_back({s, e, (seed >> 20) % 3});
+                s = e + 1;
+            }
+            return x;
+        };
+        for (size_t trial = 0; trial < 20; trial++) {
+            data_region a = random_region(30 + trial), b = random_region(40 - trial), c = random_region(35);
+            data_region r = lazy(a) | b;
+            assert(r == (a | b));
+            r = lazy(a) & b;
+            assert(r == (a & b));
+            r = lazy(a) - b;
+            assert(r == (a - b));
+            r = lazy(a) ^ b;
+            assert(r == (a ^ b));
+            // nested expressions, with a temporary region moved into the expression
+            auto e = (lazy(a) | b) & (lazy(c) - (b ^ a));
+            assert(e.eval() == ((a | b) & (c - (b ^ a))));
+            assert(e.area() == e.eval().area());
+            assert(e.empty() == e.eval().empty());
+            data_region walked;
+            for (const auto& i : e) {
+                walked.intervals.push_back(i);
+            }
+            assert(walked == e.eval());
+            assert((lazy(a) ^ c).intersects(b) == (a ^ c).intersects(b));
+            // a temporary region passed to lazy is owned by the expression
+            auto owned = lazy(data_region(a)) | b;
+            assert(owned.area() == (a | b).area());
+            assert(owned.eval() == (a | b));
+            // xor evaluates each side once, so deep nesting stays linear
+            data_region d = random_region(20), f = random_region(25);
+            assert((((((lazy(a) ^ b) ^ c) ^ d) ^ f) ^ (b ^ a)).eval() == (((((a ^ b) ^ c) ^ d) ^ f) ^ (b ^ a)));
+            assert((((((lazy(a) ^ b) ^ c) ^ a) ^ b) ^ c).empty());
+        }
+        plain_region p = {{{0, 9}, {20, 29}}};
+        plain_region q = {{{10, 19}}};
+        assert((lazy(p) | q).eval() == (plain_region{{{0, 29}}}));
+        assert((lazy(p) & q).empty());
+        assert(!(lazy(p) - q).empty());
+        assert((lazy(p) | q).intersects(plain_region{{{15, 15}}}));
+        assert(!(lazy(p) - q).intersects(plain_region{{{15, 15}}}));
+        assert((lazy(p) - p).empty() && (lazy(q) ^ q).area() == 0);
+    }
+
+    {
+        using interval = zinc::morton::detail::interval<2, 32>;
+        interval i = {1, 15};
+        std::vector<interval> t = {{1,1},{2,2},{3,3},{4,7},{8,11},{12,15}};
+        auto c = i.cells();
+        assert(std::vector<interval>(c.begin(), c.end()) == t);
+        assert(i.to_cells(1) == t);
+        assert(i.to_cells(0).size() == 15);
+        t = {{0,3},{4,7},{8,11},{12,15}};
+        assert((interval{0, 15}.to_cells(1) == t));
+        assert((interval{0, 63}.to_cells(2).size() == 4));
+        // the last cell of the curve
+        uint64_t max = std::numeric_limits<uint64_t>::max();
+        t = {{max - 4, max - 4}, {max - 3, max}};
+        assert((interval{max - 4, max}.to_cells() == t));
+
+        // region cells keep their data
+        zinc::morton::region<2, 32, uint64_t> r = {{{1, 15, 7}, {57, 57, 8}, {59, 63, 9}}};
+        std::vector<zinc::morton::detail::interval<2, 32, uint64_t>> cells;
+        for (const auto& cell : r.cells(1)) {
+            assert(cell.data == r.find(cell.start)->data);
+            cells.push_back(cell);
+        }
+        auto flat = r.to_cells(1);
+        assert(cells.size() == flat.size());
+        for (size_t j = 0; j < flat.size(); j++) {
+            assert(cells[j].start == flat[j].start && cells[j].end == flat[j].end);
+        }
+        assert((zinc::morton::region<2, 32>{}.cells().begin() == zinc::morton::region<2, 32>{}.cells().end()));
+
+        zinc::morton::AABB<2, 32> aabb {3, 48};
+        std::vector<interval> walked;
+        for (const auto& cell : aabb.cells()) {
+            walked.push_back(cell);
+        }
+        assert(walked == aabb.to_cells().intervals);
+        assert((zinc::morton::region<2, 32>{walked}.area() == aabb.to_intervals().area()));
+        // the range holds its own copy of a temporary box
+        walked.clear();
+        for (const auto& cell : zinc::morton::AABB<2, 32>{3, 48}.cells()) {
+            walked.push_back(cell);
+        }
+        assert(walked == aabb.to_cells().intervals);
+    }
+
+    {
+        // the closed form against visiting every cell
+        using interval = zinc::morton::detail::interval<2, 32>;
+        auto enumerate = [](const interval& i) {
+            std::array<uint64_t, 33> h {};
+            for (const auto& c : i.cells()) {
+                h[zinc::morton::fast_log2(c.end - c.start + 1) / 2]++;
+            }
+            return h;
+        };
+        lcg rng {11};
+        for (size_t trial = 0; trial < 2000; trial++) {
+            const uint64_t seed = rng();
+            uint64_t s = trial % 3 == 0 ? seed >> (seed % 64) : std::numeric_limits<uint64_t>::max() - (seed >> 40);
+            uint64_t length = (seed >> 20) % 100000;
+            uint64_t e = std::numeric_limits<uint64_t>::max() - s < length ? std::numeric_limits<uint64_t>::max() : s + length;
+            interval i = {s, e};
+            assert(i.cell_histogram() == enumerate(i));
+        }
+        assert((interval{0, 0}.cell_histogram()[0] == 1));
+        auto whole = interval{0, std::numeric_limits<uint64_t>::max()}.cell_histogram();
+        assert(whole[32] == 1 && std::accumulate(whole.begin(), whole.end(), uint64_t{0}) == 1);
+        assert((interval{1, std::numeric_limits<uint64_t>::max() - 1}.cell_histogram()[31] == 2));
+
+        zinc::morton::region<2, 32> r = {{{0, 21}, {23, 31}, {43, 63}}};
+        auto h = r.cell_histogram();
+        assert(h[0] == 4 && h[1] == 4 && h[2] == 2);
+    }
+
+    {
+        using data_region = zinc::morton::region<2, 32, int32_t>;
+        using encoded = zinc::morton::encoded_region<2, 32, int32_t>;
+        lcg rng {13};
+        data_region r;
+        uint64_t s = 0;
+        for (size_t i = 0; i < 1000; i++) {
+            const uint64_t seed = rng();
+            s += (seed >> 33) % 1000;
+            uint64_t e = s + (seed >> 45) % 100;
+            r.intervals.push_back({s, e, static_cast<int32_t>(seed >> 50) - 4000});
+            s = e + 1 + (i % 7 == 0 ? 1ULL << 40 : 0);
+        }
+        r.intervals.push_back({std::numeric_limits<uint64_t>::max() - 2, std::numeric_limits<uint64_t>::max(), -1});
+        for (size_t block_size : {1, 7, 64, 5000}) {
+            auto buffer = zinc::morton::serialize(r, block_size);
+            auto view = encoded::open(buffer);
+            assert(view.has_value());
+            assert(view->size() == r.intervals.size());
+            assert(view->decode() == r);
+            for (size_t q = 0; q < 3000; q++) {
+                const uint64_t seed = rng();
+                uint64_t c = q % 2 == 0 ? r.intervals[(seed >> 40) % r.intervals.size()].start + (seed >> 60) : seed;
+                auto found = view->find(c);
+                auto expected = r.find(c);
+                assert(found.has_value() == (expected != nullptr));
+                assert(!found || (*found == *expected && found->data == expected->data));
+            }
+            assert(view->intersects(data_region{{{r.intervals[500].end, r.intervals[500].end, 0}}}));
+            assert(!view->intersects(data_region{{{r.intervals[500].end + 1, r.intervals[501].start - 1, 0}}}));
+        }
+        // smaller than the intervals themselves
+        assert(zinc::morton::serialize(r).size() < r.intervals.size() * 8);
+
+        zinc::morton::region<2, 32> empty;
+        auto buffer = zinc::morton::serialize(empty);
+        auto view = zinc::morton::encoded_region<2, 32>::open(buffer);
+        assert(view && view->empty() && view->begin() == view->end() && !view->contains(0));
+
+        // malformed buffers
+        buffer = zinc::morton::serialize(r);
+        assert(!encoded::open(zinc::span<const uint8_t>(buffer.data(), 2)));
+        assert(!encoded::open(zinc::span<const uint8_t>(buffer.data(), 40)));
+        buffer[0] = 'X';
+        assert(!encoded::open(buffer));
+
+        // every truncation is refused, and a corrupted byte anywhere either is or still
+        // decodes to sorted intervals that don't overlap
+        data_region small;
+        small.intervals.assign(r.intervals.begin(), r.intervals.begin() + 40);
+        small.intervals.push_back(r.intervals.back());
+        buffer = zinc::morton::serialize(small, 7);
+        for (size_t n = 0; n < buffer.size(); n++) {
+            assert(!encoded::open(zinc::span<const uint8_t>(buffer.data(), n)));
+        }
+        for (size_t i = 0; i < buffer.size(); i++) {
+            for (uint8_t b : {uint8_t{0x00}, uint8_t{0x7f}, uint8_t{0x80}, uint8_t{0xff}}) {
+                auto corrupted = buffer;
+                corrupted[i] = b;
+                auto v = encoded::open(corrupted);
+                if (v) {
+                    data_region d = v->decode();
+                    assert(d.intervals.size() == v->size());
+                    for (size_t j = 0; j < d.intervals.size(); j++) {
+                        assert(d.intervals[j].start <= d.intervals[j].end);
+                        assert(j == 0 || d.intervals[j - 1].end < d.intervals[j].start);
+                    }
+                    assert(d.intervals.empty() || v->contains(d.intervals.back().end));
+                }
+            }
+        }
+
+        // a block size far larger than the count is one block, rather than none
+        data_region pair = {{{5, 9, 1}, {12, 12, -2}}};
+        buffer = zinc::morton::serialize(pair, 2);
+        std::vector<uint8_t> huge(buffer.begin(), buffer.begin() + 4);
+        zinc::morton::detail::put_varint(std::numeric_limits<uint64_t>::max(), huge);
+        huge.insert(huge.end(), buffer.begin() + 5, buffer.end());
+        auto huge_view = encoded::open(huge);
+        assert(huge_view && huge_view->decode() == pair);
+        // the header alone, with no directory or blocks for its two intervals
+        huge.resize(3 + 1 + 10);
+        assert(!encoded::open(huge));
+    }
+
+    {
+        using data_region = zinc::morton::region<2, 32, uint32_t>;
+        using mapped = zinc::morton::mapped_region<2, 32, uint32_t>;
+        const char* path = "zinc-test-mapped-region.bin";
+        lcg rng {17};
+        data_region r;
+        uint64_t s = 0;
+        for (size_t i = 0; i < 2000; i++) {
+            const uint64_t seed = rng();
+            s += 1 + (seed >> 33) % 100;
+            uint64_t e = s + (seed >> 45) % 100;
+            r.intervals.push_back({s, e, static_cast<uint32_t>(seed >> 50)});
+            s = e + 1;
+        }
+        for (uint64_t stride : {1, 3, 256, 5000}) {
+            assert(zinc::morton::write_mapped_region(r, path, stride));
+            auto m = mapped::open(path);
+            assert(m.has_value());
+            assert(m->size() == r.intervals.size() && m->area() == r.area());
+            for (size_t q = 0; q < 5000; q++) {
+                uint64_t c = q * 50;
+                auto found = m->find(c);
+                auto expected = r.find(c);
+                assert((found == nullptr) == (expected == nullptr));
+                assert(found == nullptr || (*found == *expected && found->data == expected->data));
+            }
+            data_region other = {{{100, 5000, 1}, {20000, 30000, 2}}};
+            auto cut = *m & other;
+            assert(cut == (r & other));
+            assert(m->intersects(other) == r.intersects(other));
+            assert(!m->intersects(data_region{{{s + 10, s + 20, 0}}}));
+            size_t cells = 0;
+            for (const auto& c : m->cells()) {
+                assert(r.find(c.start) != nullptr);
+                cells++;
+            }
+            assert(cells == r.to_cells().size());
+        }
+        // a moved mapping stays valid and is only released once
+        auto m = mapped::open(path);
+        mapped moved = std::move(*m);
+        assert(moved.size() == r.intervals.size());
+
+        // an index that doesn't match the intervals it stands for is refused
+        data_region few = {{{50, 60, 1}, {70, 80, 2}, {90, 95, 3}, {100, 120, 4}, {130, 131, 5}}};
+        auto patch_index = [path](size_t b, uint64_t value) {
+            std::FILE* f = std::fopen(path, "r+b");
+            zinc::morton::detail::mapped_region_header header;
+            assert(f != nullptr && std::fread(&header, sizeof(header), 1, f) == 1);
+            assert(std::fseek(f, static_cast<long>(header.index_offset + b * sizeof(uint64_t)), SEEK_SET) == 0);
+            assert(std::fwrite(&value, sizeof(value), 1, f) == 1);
+            std::fclose(f);
+        };
+        for (auto [b, value] : {std::pair<size_t, uint64_t>{0, 10}, {0, 55}, {1, 89}, {2, 131}, {2, 0}}) {
+            assert(zinc::morton::write_mapped_region(few, path, 2));
+            assert(mapped::open(path));
+            patch_index(b, value);
+            assert(!mapped::open(path));
+        }
+        assert(zinc::morton::write_mapped_region(few, path, 2));
+        auto intact = mapped::open(path);
+        assert(intact && !intact->contains(20) && intact->contains(50) && !intact->contains(85) && intact->contains(131));
+
+        assert(zinc::morton::write_mapped_region(data_region{}, path));
+        assert(mapped::open(path)->empty());
+        // the wrong type, or not a region at all
+        assert(!(zinc::morton::mapped_region<2, 32, uint64_t>::open(path)));
+        assert(!mapped::open("zinc-test-no-such-file.bin"));
+        std::remove(path);
+    }
+
+    {
+        using data_region = zinc::morton::region<2, 32, uint64_t>;
+        using soa = zinc::morton::soa_region<2, 32, uint64_t>;
+        lcg rng {19};
+        auto random_region = [&rng](size_t n, uint64_t max_gap) {
+            data_region x;
+            uint64_t s = 0;
+            for (size_t i = 0; i < n; i++) {
+                const uint64_t seed = rng();
+                s += 1 + (seed >> 33) % max_gap;
+                uint64_t e = s + (seed >> 45) % 10;
+                x.intervals.push_back({s, e, (seed >> 20) % 3});
+                s = e + 1;
+            }
+            return x;
+        };
+        for (size_t trial = 0; trial < 20; trial++) {
+            data_region a = random_region(50 + trial, 20), b = random_region(60 - trial, 20 + 10 * trial);
+            soa sa(a), sb(b);
+            assert(sa.to_region() == a && sa.size() == a.intervals.size());
+            assert((sa | sb).to_region() == (a | b));
+            assert((sa & sb).to_region() == (a & b));
+            assert((sa - sb).to_region() == (a - b));
+            assert((sa ^ sb).to_region() == (a ^ b));
+            for (auto isa : {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512}) {
+                if (!zinc::cpu::supports(isa)) continue;
+                assert(sa.area(isa) == a.area());
+                assert(sa.intersects(sb, isa) == a.intersects(b));
+                data_region one = {{{b.intervals[trial].start, b.intervals[trial].start, 0}}};
+                assert(sa.intersects(soa(one), isa) == a.intersects(one));
+                assert(soa(one).intersects(sa, isa) == a.intersects(one));
+                for (uint64_t c = 0; c < a.intervals.back().end + 2; c++) {
+                    size_t i = sa.find(c, isa);
+                    auto expected = a.find(c);
+                    assert((i == sa.size()) == (expected == nullptr));
+                    assert(i == sa.size() || (sa[i] == *expected && sa[i].data == expected->data));
+                }
+                assert(!sa.contains(std::numeric_limits<uint64_t>::max(), isa));
+            }
+        }
+        zinc::morton::soa_region<2, 32> plain(zinc::morton::region<2, 32>{{{5, std::numeric_limits<uint64_t>::max()}}});
+        assert(plain.data.empty() && plain.contains(std::numeric_limits<uint64_t>::max()) && !plain.contains(4));
+        assert((zinc::morton::soa_region<2, 32>().area() == 0 && !zinc::morton::soa_region<2, 32>().intersects(plain)));
+    }
+    {
+        // region's kernels step over the data of each interval, so check them for several interval sizes
+        lcg rng {23};
+        auto check = [&rng](auto tag) {
+            using data_type = decltype(tag);
+            using data_region = zinc::morton::region<2, 32, data_type>;
+            auto random_region = [&rng](size_t n, uint64_t max_gap) {
+                data_region x;
+                uint64_t s = 0;
+                for (size_t i = 0; i < n; i++) {
+                    const uint64_t seed = rng();
+                    s += 1 + (seed >> 33) % max_gap;
+                    uint64_t e = s + (seed >> 45) % 10;
+                    x.intervals.push_back({s, e});
+                    s = e + 1;
+                }
+                return x;
+            };
+            for (size_t trial = 0; trial < 20; trial++) {
+                data_region a = random_region(40 + trial, 20), b = random_region(45 - trial, 20 + 10 * trial);
+                uint64_t area = 0;
+                for (auto& i : a.intervals) {
+                    area += i.area();
+                }
+                bool overlap = false;
+                for (auto& i : a.intervals) {
+                    for (auto& j : b.intervals) {
+                        overlap |= i.start <= j.end && j.start <= i.end;
+                    }
+                }
+                data_region one = {{{b.intervals[trial].start, b.intervals[trial].start}}};
+                bool overlap_one = a.find(b.intervals[trial].start) != nullptr;
+                for (auto isa : {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512}) {
+                    if (!zinc::cpu::supports(isa)) continue;
+                    assert(a.area(isa) == area);
+                    assert(a.intersects(b, isa) == overlap && b.intersects(a, isa) == overlap);
+                    assert(a.intersects(one, isa) == overlap_one && one.intersects(a, isa) == overlap_one);
+                    assert(a.intersects(zinc::morton::region<2, 32>(), isa) == false);
+                }
+            }
+        };
+        check(std::monostate{});
+        check(uint32_t{});
+        check(std::array<uint64_t, 3>{});
+        check(std::array<uint64_t, 6>{});
+        check(std::array<uint64_t, 9>{});
+        zinc::morton::region<2, 32> everything = {{{0, std::numeric_limits<uint64_t>::max()}}};
+        for (auto isa : {zinc::cpu::isa::scalar, zinc::cpu::isa::avx2, zinc::cpu::isa::avx512}) {
+            if (!zinc::cpu::supports(isa)) continue;
+            // the area of the whole curve wraps to 0, as the sum of interval areas does
+            assert((everything.area(isa) == 0 && zinc::morton::region<2, 32>().area(isa) == 0));
+        }
+    }
+    {
+        // the magic bits encoders against whichever ones are in use
+        lcg rng {29};
+        for (size_t i = 0; i < 1000; i++) {
+            const uint64_t seed = rng();
+            assert(zinc::morton::expand_bits_2_magic(seed >> 32) == zinc::morton::expand_bits_2<uint64_t>(seed >> 32));
+            assert(zinc::morton::compact_bits_2_magic(seed) == zinc::morton::compact_bits_2<uint64_t>(seed));
+            assert(zinc::morton::expand_bits_3_magic(seed >> 43) == zinc::morton::expand_bits_3<uint64_t>(seed >> 43));
+            assert(zinc::morton::compact_bits_3_magic(seed) == zinc::morton::compact_bits_3<uint64_t>(seed));
+            std::array<uint32_t, 3> p = {static_cast<uint32_t>(seed >> 43), static_cast<uint32_t>(seed >> 22) & 0x1fffff, static_cast<uint32_t>(seed) & 0x1fffff};
+            assert((morton_code<3, 21>::decode(morton_code<3, 21>::encode(p)) == p));
+        }
+        assert((morton_code<3, 21>::encode({1, 0, 0}) == 1));
+        assert((morton_code<3, 21>::encode({0, 1, 0}) == 2));
+        assert((morton_code<3, 21>::encode({0, 0, 1}) == 4));
+        assert((morton_code<3, 21>::encode({2, 0, 0}) == 8));
+        assert((morton_code<3, 21>::encode({0x1fffff, 0x1fffff, 0x1fffff}) == (1ULL << 63) - 1));
+    }
+
+    {
+        // 3D boxes decompose into exactly the codes of the points inside them
+        using aabb3 = zinc::morton::AABB<3, 21>;
+        using region3 = zinc::morton::region<3, 21>;
+        lcg rng {31};
+        auto next = [&rng](uint32_t n) {
+            const uint64_t seed = rng();
+            return static_cast<uint32_t>((seed >> 33) % n);
+        };
+        for (size_t trial = 0; trial < 200; trial++) {
+            std::array<uint32_t, 3> lo, hi;
+            for (size_t d = 0; d < 3; d++) {
+                uint32_t a = next(16), b = next(16);
+                lo[d] = std::min(a, b);
+                hi[d] = std::max(a, b);
+            }
+            auto codes = codes_in_box<morton_code<3, 21>>(lo, hi);
+            region3 expected = region_of_codes<region3>(codes);
+            aabb3 box = {morton_code<3, 21>::encode(lo), morton_code<3, 21>::encode(hi)};
+            assert(box.to_intervals() == expected);
+            region3 cells = box.to_cells();
+            assert(cells.area() == codes.size());
+            for (auto& c : cells.intervals) {
+                assert((aabb3{c.start, c.end}).is_morton_aligned());
+            }
+            assert((expected.to_cells() == cells.intervals));
+        }
+    }
+
+    {
+        tree_cell<3, 21> cell = {morton_code<3, 21>::encode({4, 4, 4}), 2};
+        assert(cell.region() == (zinc::morton::region<3, 21>{{{448, 511}}}));
+        assert(cell.contains(morton_code<3, 21>::encode({7, 5, 4})) && !cell.contains(morton_code<3, 21>::encode({8, 5, 4})));
+        assert(cell.check_overlap({morton_code<3, 21>::encode({5, 5, 5}), 0}));
+        assert(!cell.check_overlap({morton_code<3, 21>::encode({3, 5, 5}), 0}));
+        tree_cell<> flat = {12, 1};
+        assert(flat.region(7).intervals[0].data == 7 && flat.region().area() == 4);
+        assert(flat.check_overlap(2, {14, 0}) && !flat.check_overlap(2, {16, 0}));
+        auto everything = zinc::morton::cell_to_region<3, 21>(0, 21, std::monostate{});
+        assert(everything.intervals[0].end == (1ULL << 63) - 1);
+    }
+
+    {
+        // two word codes against a bit by bit interleave, with coordinates running into the high word
+        using zinc::morton::uint128_t;
+        auto interleave = [](const auto& p) {
+            uint128_t code = 0;
+            for (size_t d = 0; d < p.size(); d++) {
+                for (size_t bit = 0; bit < 64 && bit * p.size() + d < 128; bit++) {
+                    code |= uint128_t{(uint64_t{p[d]} >> bit) & 1} << (bit * p.size() + d);
+                }
+            }
+            return code;
+        };
+        lcg rng {37};
+        auto next = [&rng]() {
+            const uint64_t seed = rng();
+            return seed;
+        };
+        for (size_t i = 0; i < 1000; i++) {
+            std::array<uint64_t, 3> p3 = {next() >> 22, next() >> 22, next() >> (22 + i % 40)};
+            auto c3 = morton_code<3, 42>::encode(p3);
+            assert((c3 == interleave(p3) && morton_code<3, 42>::decode(c3) == p3));
+            std::array<uint32_t, 4> p4 = {static_cast<uint32_t>(next()), static_cast<uint32_t>(next() >> 32), static_cast<uint32_t>(next() >> (i % 32)), 0};
+            auto c4 = morton_code<4, 32>::encode(p4);
+            assert((c4 == interleave(p4) && morton_code<4, 32>::decode(c4) == p4));
+
+            // each coordinate adds and subtracts on its own, wrapping within its bits
+            std::array<uint64_t, 3> q3 = {next() >> 22, next() >> 22, next() >> 22};
+            auto sum = c3;
+            sum += morton_code<3, 42>::encode(q3);
+            auto s = morton_code<3, 42>::decode(sum);
+            for (size_t d = 0; d < 3; d++) {
+                assert(s[d] == ((p3[d] + q3[d]) & ((1ULL << 42) - 1)));
+            }
+            sum -= morton_code<3, 42>::encode(q3);
+            assert(sum == c3);
+        }
+        assert((morton_code<3, 42>::encode({(1ULL << 42) - 1, (1ULL << 42) - 1, (1ULL << 42) - 1}) == (uint128_t{1} << 126) - 1));
+        assert((morton_code<4, 32>::encode({~0u, ~0u, ~0u, ~0u}) == ~uint128_t{0}));
+        assert((morton_code<3, 42>::encode({1ULL << 21, 0, 0}) == uint128_t{1} << 63));
+        assert((morton_code<4, 32>::encode({0, 0, 0, 1u << 16}) == uint128_t{1} << 67));
+    }
+
+    {
+        // two word boxes decompose into exactly the codes of the points inside them, and
+        // their regions combine like the sets of those codes
+        using zinc::morton::uint128_t;
+        lcg rng {41};
+        auto next = [&rng](uint64_t n) {
+            const uint64_t seed = rng();
+            return (seed >> 33) % n;
+        };
+        auto check = [&](auto code_tag, auto base, uint64_t side, size_t trials) {
+            using code_type = decltype(code_tag);
+            using coordinate_type = typename code_type::coordinate_type;
+            constexpr size_t dims = code_type::dimension;
+            using region_type = zinc::morton::region<dims, code_type::max_level>;
+            using aabb_type = zinc::morton::AABB<dims, code_type::max_level>;
+            auto box = [&](std::vector<uint128_t>& codes) {
+                std::array<coordinate_type, dims> lo, hi;
+                for (size_t d = 0; d < dims; d++) {
+                    uint64_t a = next(side), b = next(side);
+                    lo[d] = static_cast<coordinate_type>(base[d] + std::min(a, b));
+                    hi[d] = static_cast<coordinate_type>(base[d] + std::max(a, b));
+                }
+                codes = codes_in_box<code_type>(lo, hi);
+                return aabb_type{code_type::encode(lo), code_type::encode(hi)};
+            };
+            auto to_region = [](const std::vector<uint128_t>& codes) {
+                return region_of_codes<region_type>(codes);
+            };
+            for (size_t trial = 0; trial < trials; trial++) {
+                std::vector<uint128_t> a_codes, b_codes;
+                aabb_type a_box = box(a_codes), b_box = box(b_codes);
+                region_type a = a_box.to_intervals(), b = b_box.to_intervals();
+                assert(a == to_region(a_codes) && b == to_region(b_codes));
+                region_type cells = a_box.to_cells();
+                assert(cells.area() == a_codes.size());
+                for (auto& c : cells.intervals) {
+                    assert((aabb_type{c.start, c.end}).is_morton_aligned());
+                }
+                assert((a.to_cells() == cells.intervals));
+
+                std::vector<uint128_t> both, either, only_a, one;
+                std::set_intersection(a_codes.begin(), a_codes.end(), b_codes.begin(), b_codes.end(), std::back_inserter(both));
+                std::set_union(a_codes.begin(), a_codes.end(), b_codes.begin(), b_codes.end(), std::back_inserter(either));
+                std::set_difference(a_codes.begin(), a_codes.end(), b_codes.begin(), b_codes.end(), std::back_inserter(only_a));
+                std::set_symmetric_difference(a_codes.begin(), a_codes.end(), b_codes.begin(), b_codes.end(), std::back_inserter(one));
+                assert((a & b) == to_region(both));
+                assert((a | b) == to_region(either));
+                assert((a - b) == to_region(only_a));
+                assert((a ^ b) == to_region(one));
+                assert(a.intersects(b) == !both.empty());
+                assert((a | b).area() == either.size());
+                for (auto c : b_codes) {
+                    assert(a.contains(c) == std::binary_search(a_codes.begin(), a_codes.end(), c));
+                }
+            }
+        };
+        // boxes that straddle the bits split between the words, and the top of the range
+        check(morton_code<3, 42>{0}, std::array<uint64_t, 3>{(1ULL << 21) - 5, (1ULL << 42) - 12, (1ULL << 41) - 3}, 12, 100);
+        check(morton_code<4, 32>{0}, std::array<uint64_t, 4>{(1ULL << 16) - 3, (1ULL << 32) - 7, (1ULL << 31) - 2, 1ULL << 20}, 7, 100);
+    }
+
+    {
+        using zinc::morton::uint128_t;
+        tree_cell<4, 32> cell = {morton_code<4, 32>::encode({1u << 20, 0, 0, 0}), 20};
+        assert(cell.region().area() == uint128_t{1} << 80);
+        assert((cell.contains(morton_code<4, 32>::encode({(1u << 20) + 5, 7, 9, (1u << 20) - 1}))));
+        assert((!cell.contains(morton_code<4, 32>::encode({(1u << 20) + 5, 7, 9, 1u << 20}))));
+        auto everything = zinc::morton::cell_to_region<3, 42>(0, 42, std::monostate{});
+        assert(everything.intervals[0].end == (uint128_t{1} << 126) - 1 && everything.area() == uint128_t{1} << 126);
+    }
+
+    {
+        // the parallel and lazy operators on two word codes match the serial ones
+        using zinc::morton::uint128_t;
+        using zinc::morton::lazy;
+        using wide_region = zinc::morton::region<4, 32, uint64_t>;
+        lcg rng {97};
+        // with wide gaps, from a few codes to past the low word, or packed around the start of
+        // the high word, so slices are cut in the high word and across the two
+        auto random_region = [&rng](size_t n, bool wide) {
+            wide_region r;
+            uint128_t s = wide ? 0 : (uint128_t{1} << 64) - 1500;
+            for (size_t i = 0; i < n; i++) {
+                s += (((uint128_t{rng()} << 64) | rng()) >> (wide ? 12 + rng() % 116 : 124)) + 1;
+                const uint128_t e = s + (wide && rng() % 3 == 0 ? uint128_t{rng()} << 8 : rng() % 10);
+                r.intervals.push_back({s, e, rng() % 2});
+                s = e + 1 + rng() % 2;
+            }
+            return r;
+        };
+        for (size_t trial = 0; trial < 6; trial++) {
+            wide_region a = random_region(300, trial % 2 == 0), b = random_region(200 + trial * 20, trial % 2 == 0);
+            // an interval across the two words
+            const wide_region across = {{{(uint128_t{1} << 64) - 7, (uint128_t{1} << 64) + 7, 1}}};
+            a = (a - across) | across;
+            for (size_t threads : {2, 8}) {
+                zinc::thread_pool pool(threads);
+                wide_region r = a;
+                zinc::morton::parallel_union(r, b, pool);
+                assert(r == (a | b));
+                r = a;
+                zinc::morton::parallel_intersection(r, b, pool);
+                assert(r == (a & b));
+                r = a;
+                zinc::morton::parallel_difference(r, b, pool);
+                assert(r == (a - b));
+            }
+            wide_region r = lazy(a) | b;
+            assert(r == (a | b));
+            r = lazy(a) & b;
+            assert(r == (a & b));
+            r = lazy(a) - b;
+            assert(r == (a - b));
+            r = lazy(a) ^ b;
+            assert(r == (a ^ b));
+            assert((lazy(a) | b).area() == (a | b).area());
+            assert((lazy(a) - b).area() == (a - b).area());
+            assert((lazy(a) & b).empty() == (a & b).empty());
+            zinc::morton::region_index<4, 32, uint64_t> index(a);
+            for (auto& i : b.intervals) {
+                for (uint128_t c : {i.start - 1, uint128_t{i.start}, uint128_t{i.end}, i.end + 1}) {
+                    assert(index.find(c) == a.find(c));
+                }
+            }
+        }
+        // starts that only differ in the high word
+        const wide_region apart = {{{uint128_t{1} << 100, (uint128_t{1} << 100) + 10, 0}, {uint128_t{1} << 101, (uint128_t{1} << 101) + 10, 0}}};
+        zinc::morton::region_index<4, 32, uint64_t> apart_index(apart);
+        assert(!apart_index.contains((uint128_t{1} << 100) + 100) && apart_index.contains((uint128_t{1} << 101) + 10));
+        // a cut that lands on intervals crossing from the low word into the high word
+        const uint128_t high = uint128_t{1} << 64;
+        wide_region a, b;
+        for (uint64_t i = 0; i < 40; i++) {
+            a.intervals.push_back({uint128_t{10 * i}, uint128_t{10 * i + 5}, 0});
+            b.intervals.push_back({uint128_t{10 * i + 3}, uint128_t{10 * i + 7}, 0});
+        }
+        a.intervals.push_back({high - 100, high + 50, 0});
+        b.intervals.push_back({high - 120, high + 30, 0});
+        for (uint64_t i = 0; i < 40; i++) {
+            a.intervals.push_back({high + 100 + 10 * i, high + 105 + 10 * i, 0});
+            b.intervals.push_back({high + 103 + 10 * i, high + 107 + 10 * i, 0});
+        }
+        for (size_t threads : {2, 3, 8}) {
+            zinc::thread_pool pool(threads);
+            wide_region r = a;
+            zinc::morton::parallel_union(r, b, pool);
+            assert(r == (a | b));
+            r = a;
+            zinc::morton::parallel_intersection(r, b, pool);
+            assert(r == (a & b));
+            r = b;
+            zinc::morton::parallel_difference(r, a, pool);
+            assert(r == (b - a));
+        }
+    }
+
+    {
+        // the generated magic bits steps are the well known ones
+        using zinc::morton::detail::magic_bits;
+        assert((magic_bits<2, 32>::masks == std::array<uint64_t, 6>{
+            0x5555555555555555, 0x3333333333333333, 0x0f0f0f0f0f0f0f0f, 0x00ff00ff00ff00ff, 0x0000ffff0000ffff, 0x00000000ffffffff}));
+        assert((magic_bits<3, 21>::masks == std::array<uint64_t, 6>{
+            0x1249249249249249, 0x10c30c30c30c30c3, 0x100f00f00f00f00f, 0x001f0000ff0000ff, 0x001f00000000ffff, 0x00000000001fffff}));
+        assert((magic_bits<3, 21>::shift(4) == 32 && magic_bits<2, 32>::shift(0) == 1 && magic_bits<1, 64>::steps == 6));
+    }
+
+    {
+        // codes of any shape against a bit by bit interleave
+        using zinc::morton::uint128_t;
+        lcg rng {43};
+        auto check = [&rng](auto code_tag) {
+            using code_type = decltype(code_tag);
+            using coordinate_type = typename code_type::coordinate_type;
+            using word_type = typename code_type::word_type;
+            constexpr uint32_t dims = code_type::dimension, bits = code_type::max_level;
+            const uint64_t top = bits == 64 ? ~uint64_t{0} : (uint64_t{1} << bits) - 1;
+            for (size_t i = 0; i < 200; i++) {
+                std::array<coordinate_type, dims> p, q;
+                for (uint32_t d = 0; d < dims; d++) {
+                    const uint64_t seed = rng();
+                    p[d] = static_cast<coordinate_type>((seed >> (i % 8)) & top);
+                    q[d] = static_cast<coordinate_type>((seed >> 7) & top);
+                }
+                word_type expected = 0;
+                for (uint32_t d = 0; d < dims; d++) {
+                    for (uint32_t bit = 0; bit < bits; bit++) {
+                        expected |= word_type{(uint64_t{p[d]} >> bit) & 1} << (bit * dims + d);
+                    }
+                }
+                auto c = code_type::encode(p);
+                assert(c == expected && code_type::decode(c) == p);
+                for (uint32_t d = 0; d < dims; d++) {
+                    // the magic bits take as many bits of each coordinate as fit in a word
+                    const uint64_t low = p[d] & zinc::morton::compact_bits_magic<dims>(~uint64_t{0});
+                    assert(zinc::morton::compact_bits_magic<dims>(zinc::morton::expand_bits_magic<dims>(p[d])) == low);
+                }
+                auto sum = c;
+                sum += code_type::encode(q);
+                auto s = code_type::decode(sum);
+                for (uint32_t d = 0; d < dims; d++) {
+                    assert(s[d] == ((uint64_t{p[d]} + q[d]) & top));
+                }
+                sum -= code_type::encode(q);
+                assert(sum == c);
+            }
+        };
+        check(morton_code<1, 64>{0});
+        check(morton_code<1, 20>{0});
+        check(morton_code<3, 21>{0});
+        check(morton_code<4, 16>{0});
+        check(morton_code<4, 15>{0});
+        check(morton_code<5, 12>{0});
+        check(morton_code<6, 10>{0});
+        check(morton_code<2, 40>{0});
+        check(morton_code<5, 20>{0});
+        check(morton_code<3, 42>{0});
+        check(morton_code<4, 32>{0});
+    }
+
+    {
+        // 4D and 5D boxes decompose into exactly the codes of the points inside them
+        lcg rng {47};
+        auto next = [&rng](uint32_t n) {
+            const uint64_t seed = rng();
+            return static_cast<uint32_t>((seed >> 33) % n);
+        };
+        auto check = [&next](auto code_tag, uint32_t side) {
+            using code_type = decltype(code_tag);
+            constexpr uint32_t dims = code_type::dimension;
+            using region_type = zinc::morton::region<dims, code_type::max_level>;
+            using aabb_type = zinc::morton::AABB<dims, code_type::max_level>;
+            using coordinate_type = typename code_type::coordinate_type;
+            for (size_t trial = 0; trial < 50; trial++) {
+                std::array<coordinate_type, dims> lo, hi;
+                for (uint32_t d = 0; d < dims; d++) {
+                    uint32_t a = next(side), b = next(side);
+                    lo[d] = std::min(a, b) + 1000;
+                    hi[d] = std::max(a, b) + 1000;
+                }
+                auto codes = codes_in_box<code_type>(lo, hi);
+                region_type expected = region_of_codes<region_type>(codes);
+                aabb_type box = {code_type::encode(lo), code_type::encode(hi)};
+                assert(box.to_intervals() == expected);
+                assert(box.to_cells().area() == codes.size());
+                assert(box.to_cells().cell_histogram() == expected.cell_histogram());
+            }
+        };
+        check(morton_code<4, 16>{0}, 9);
+        check(morton_code<5, 12>{0}, 6);
+        check(morton_code<1, 64>{0}, 100);
+    }
+
+    {
+        // every way of interleaving this machine supports gives the same bits
+        using zinc::cpu::interleave;
+        assert(zinc::cpu::supports(zinc::cpu::best_interleave()));
+        lcg rng {53};
+        for (auto how : {interleave::magic, interleave::lut, interleave::bmi2}) {
+            if (!zinc::cpu::supports(how)) {
+                continue;
+            }
+            zinc::morton::with_interleave(how, [&rng](auto as) {
+                constexpr auto h = decltype(as)::value;
+                using namespace zinc::morton;
+                for (size_t i = 0; i < 1000; i++) {
+                    const uint64_t seed = rng();
+                    assert((expand_bits_as<h, 1, 64>(seed) == expand_bits_magic<1, 64>(seed)));
+                    assert((expand_bits_as<h, 2, 32>(seed) == expand_bits_magic<2, 32>(seed)));
+                    assert((expand_bits_as<h, 3, 21>(seed) == expand_bits_magic<3, 21>(seed)));
+                    assert((expand_bits_as<h, 3, 13>(seed) == expand_bits_magic<3, 13>(seed)));
+                    assert((expand_bits_as<h, 5, 12>(seed) == expand_bits_magic<5, 12>(seed)));
+                    assert((expand_bits_as<h, 9, 7>(seed) == expand_bits_magic<9, 7>(seed)));
+                    assert((compact_bits_as<h, 2, 32>(seed) == compact_bits_magic<2, 32>(seed)));
+                    assert((compact_bits_as<h, 3, 21>(seed) == compact_bits_magic<3, 21>(seed)));
+                    assert((compact_bits_as<h, 7, 9>(seed) == compact_bits_magic<7, 9>(seed)));
+                }
+                return 0;
+            });
+            assert((zinc::morton::expand_bits<2>(0xffffffff, how) == 0x5555555555555555));
+            assert((zinc::morton::compact_bits<3>(0x7fffffffffffffff, how) == 0x1fffff));
+        }
+        for (size_t i = 0; i < 1000; i++) {
+            const uint64_t seed = rng();
+            assert((zinc::morton::compact_bits_lut<2, 32>(seed) == zinc::morton::compact_bits_magic<2, 32>(seed)));
+            assert((zinc::morton::compact_bits_lut<3, 21>(seed) == zinc::morton::compact_bits_magic<3, 21>(seed)));
+            assert((zinc::morton::compact_bits_lut<5, 12>(seed) == zinc::morton::compact_bits_magic<5, 12>(seed)));
+            assert((zinc::morton::compact_bits_lut<8, 8>(seed) == zinc::morton::compact_bits_magic<8, 8>(seed)));
+        }
+    }
+    {
+        // every hilbert code of a small grid is one point, a step away from the one before
+        auto check = [](auto tag) {
+            using code_type = decltype(tag);
+            using coordinate_type = typename code_type::coordinate_type;
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            const uint64_t n = uint64_t{1} << (dimension * bits);
+            std::vector<bool> seen(n);
+            std::array<coordinate_type, dimension> last {};
+            for (uint64_t h = 0; h < n; h++) {
+                auto p = code_type::decode({h});
+                assert(code_type::encode(p).data == h);
+                assert((code_type::from_morton(morton_code<dimension, bits>::encode(p)).data == h));
+                assert((code_type::to_morton({h}).data == morton_code<dimension, bits>::encode(p).data));
+                uint64_t m = morton_code<dimension, bits>::encode(p);
+                assert(!seen[m]);
+                seen[m] = true;
+                uint64_t steps = 0;
+                for (size_t d = 0; d < dimension; d++) {
+                    steps += p[d] > last[d] ? p[d] - last[d] : last[d] - p[d];
+                }
+                assert(steps == (h == 0 ? 0 : 1));
+                last = p;
+            }
+        };
+        check(hilbert_code<2, 1>{0});
+        check(hilbert_code<2, 4>{0});
+        check(hilbert_code<2, 5>{0});
+        check(hilbert_code<3, 3>{0});
+        check(hilbert_code<4, 2>{0});
+        check(hilbert_code<5, 2>{0});
+    }
+
+    {
+        // the table lookups give the same codes as running the machine a level at a time,
+        // and wide codes round trip
+        lcg rng {59};
+        auto check = [&rng](auto tag) {
+            using code_type = decltype(tag);
+            using coordinate_type = typename code_type::coordinate_type;
+            using word_type = typename code_type::word_type;
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            for (size_t i = 0; i < 1000; i++) {
+                std::array<coordinate_type, dimension> p;
+                for (auto& c : p) {
+                    const uint64_t seed = rng();
+                    c = static_cast<coordinate_type>(bits == 64 ? seed : seed & ((uint64_t{1} << bits) - 1));
+                }
+                zinc::morton::detail::hilbert_state s {0, 0};
+                word_type expected = 0;
+                for (uint32_t level = bits; level-- > 0;) {
+                    uint32_t l = 0;
+                    for (uint32_t d = 0; d < dimension; d++) {
+                        l |= static_cast<uint32_t>((p[d] >> level) & 1) << d;
+                    }
+                    expected |= word_type{zinc::morton::detail::hilbert_encode_level<dimension>(s, l)} << (level * dimension);
+                }
+                auto h = code_type::encode(p);
+                assert(h.data == expected);
+                assert(code_type::decode(h) == p);
+            }
+        };
+        check(hilbert_code<2, 32>{0});
+        check(hilbert_code<2, 14>{0});
+        check(hilbert_code<3, 21>{0});
+        check(hilbert_code<4, 16>{0});
+        check(hilbert_code<5, 12>{0});
+        check(hilbert_code<6, 10>{0});
+        check(hilbert_code<3, 42>{0});
+        check(hilbert_code<2, 64>{0});
+    }
+
+    {
+        // AABB::to_hilbert_intervals against the sorted hilbert codes of every point in the box
+        auto check = [](auto tag, uint32_t max_side) {
+            using code_type = decltype(tag);
+            using coordinate_type = typename code_type::coordinate_type;
+            using word_type = typename code_type::word_type;
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            using morton_type = morton_code<dimension, bits>;
+            using region_type = zinc::morton::hilbert_region<dimension, bits>;
+            lcg rng {61};
+            for (size_t i = 0; i < 50; i++) {
+                std::array<coordinate_type, dimension> lo, hi;
+                for (size_t d = 0; d < dimension; d++) {
+                    const uint64_t seed = rng();
+                    lo[d] = static_cast<coordinate_type>((seed >> 33) % ((uint64_t{1} << std::min<uint32_t>(bits, 40)) - max_side));
+                    hi[d] = static_cast<coordinate_type>(lo[d] + (seed >> 13) % max_side);
+                }
+                const std::vector<word_type> codes = codes_in_box<code_type>(lo, hi);
+                region_type expected = region_of_codes<region_type>(codes);
+                zinc::morton::AABB<dimension, bits> box = {morton_type::encode(lo), morton_type::encode(hi)};
+                region_type r = box.to_hilbert_intervals();
+                assert(r == expected);
+                assert(r.area() == codes.size());
+                assert(r.contains(codes.front()) && r.contains(codes.back()));
+                // the set operations only see codes, so they work on hilbert regions as they are
+                region_type half = region_type{{{codes.front(), codes[codes.size() / 2]}}};
+                assert((r & half).area() == codes.size() / 2 + 1);
+                assert((r - half).area() + (r & half).area() == r.area());
+                assert((r | half).area() == r.area() + half.area() - (r & half).area());
+                assert((r ^ half) == ((r - half) | (half - r)));
+                assert(r.to_cells().size() == box.to_cells().intervals.size());
+            }
+        };
+        check(hilbert_code<2, 8>{0}, 40);
+        check(hilbert_code<2, 32>{0}, 40);
+        check(hilbert_code<3, 6>{0}, 12);
+        check(hilbert_code<3, 42>{0}, 12);
+        check(hilbert_code<4, 5>{0}, 6);
+        // boxes that are a single cell
+        zinc::morton::AABB<2, 8> all = {morton_code<2, 8>::encode({0, 0}), morton_code<2, 8>::encode({255, 255})};
+        assert((all.to_hilbert_intervals() == zinc::morton::hilbert_region<2, 8>{{{0, 0xffff}}}));
+        zinc::morton::AABB<2, 32> point = {morton_code<2, 32>::encode({7, 9}), morton_code<2, 32>::encode({7, 9})};
+        const uint64_t h = hilbert_code<2, 32>::encode({7, 9});
+        assert((point.to_hilbert_intervals() == zinc::morton::hilbert_region<2, 32>{{{h, h}}}));
+        // every aligned cell of small grids, which the curve enters at any of its corners
+        auto check_cells = [](auto tag) {
+            using code_type = decltype(tag);
+            using coordinate_type = typename code_type::coordinate_type;
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            using region_type = zinc::morton::hilbert_region<dimension, bits>;
+            for (uint32_t level = 0; level <= bits; level++) {
+                const uint32_t side = 1u << level;
+                std::array<coordinate_type, dimension> lo {}, hi;
+                while (true) {
+                    for (size_t d = 0; d < dimension; d++) {
+                        hi[d] = static_cast<coordinate_type>(lo[d] + side - 1);
+                    }
+                    zinc::morton::AABB<dimension, bits> box = {morton_code<dimension, bits>::encode(lo), morton_code<dimension, bits>::encode(hi)};
+                    assert(box.is_morton_aligned());
+                    assert(box.to_hilbert_intervals() == region_of_codes<region_type>(codes_in_box<code_type>(lo, hi)));
+                    size_t d = 0;
+                    for (; d < dimension && lo[d] + side == (1u << bits); d++) {
+                        lo[d] = 0;
+                    }
+                    if (d == dimension) {
+                        break;
+                    }
+                    lo[d] = static_cast<coordinate_type>(lo[d] + side);
+                }
+            }
+        };
+        check_cells(hilbert_code<2, 3>{0});
+        check_cells(hilbert_code<2, 5>{0});
+        check_cells(hilbert_code<3, 3>{0});
+        check_cells(hilbert_code<4, 2>{0});
+        zinc::morton::AABB<2, 3> reported = {morton_code<2, 3>::encode({0, 2}), morton_code<2, 3>::encode({1, 3})};
+        assert((reported.to_hilbert_intervals() == zinc::morton::hilbert_region<2, 3>{{{12, 15}}}));
+    }
+
+    {
+        // for_each_cell, for_each_interval and append_intervals against the iterators
+        auto check = [](auto tag, uint64_t max_side) {
+            using code_type = decltype(tag);
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            using coordinate_type = typename code_type::coordinate_type;
+            using box_type = zinc::morton::AABB<dimension, bits>;
+            using region_type = zinc::morton::region<dimension, bits>;
+            using interval_type = zinc::morton::detail::interval<dimension, bits>;
+            lcg rng {67};
+            std::vector<box_type> boxes;
+            for (size_t i = 0; i < 40; i++) {
+                std::array<coordinate_type, dimension> lo, hi;
+                for (size_t d = 0; d < dimension; d++) {
+                    const uint64_t seed = rng();
+                    lo[d] = static_cast<coordinate_type>((seed >> 33) % ((uint64_t{1} << std::min<uint32_t>(bits, 40)) - max_side));
+                    hi[d] = static_cast<coordinate_type>(lo[d] + (seed >> 13) % max_side);
+                }
+                boxes.push_back({code_type::encode(lo), code_type::encode(hi)});
+            }
+            // a cell without its outer layer, which is split at every level
+            std::array<coordinate_type, dimension> lo, hi;
+            lo.fill(1);
+            hi.fill(static_cast<coordinate_type>((1u << (16 / dimension)) - 2));
+            boxes.push_back({code_type::encode(lo), code_type::encode(hi)});
+            for (auto& box : boxes) {
+                std::vector<interval_type> cells, intervals;
+                box.for_each_cell([&cells](const interval_type& c) { cells.push_back(c); });
+                box.for_each_interval([&intervals](const interval_type& i) { intervals.push_back(i); });
+                std::vector<interval_type> walked, joined;
+                for (auto& c : box.cells()) {
+                    walked.push_back(c);
+                    if (!joined.empty() && joined.back().end + 1 == c.start) {
+                        joined.back().end = c.end;
+                    } else {
+                        joined.push_back(c);
+                    }
+                }
+                assert(cells == walked);
+                assert(intervals == joined);
+                assert(box.to_cells().intervals == cells);
+                assert(box.to_intervals().intervals == intervals);
+            }
+            // appended in curve order, they are the union of the boxes
+            std::vector<box_type> sorted = boxes;
+            std::sort(sorted.begin(), sorted.end(), [](const box_type& a, const box_type& b) { return a.min < b.min; });
+            std::vector<region_type> regions;
+            region_type in_order, out_of_order;
+            for (size_t k = 0; k < sorted.size(); k++) {
+                regions.push_back(sorted[k].to_intervals());
+                sorted[k].append_intervals(in_order);
+                boxes[k].append_intervals(out_of_order);
+            }
+            region_type expected = region_type::union_all(regions);
+            assert(in_order == expected);
+            assert(out_of_order == expected);
+        };
+        check(morton_code<2, 32>{0}, 40);
+        check(morton_code<3, 21>{0}, 12);
+        check(morton_code<4, 32>{0}, 6);
+
+        // each interval carries the data it was appended with
+        using box_type = zinc::morton::AABB<2, 8>;
+        box_type a = {morton_code<2, 8>::encode({0, 0}), morton_code<2, 8>::encode({3, 3})};
+        box_type b = {morton_code<2, 8>::encode({4, 0}), morton_code<2, 8>::encode({7, 3})};
+        box_type c = {morton_code<2, 8>::encode({2, 2}), morton_code<2, 8>::encode({5, 5})};
+        zinc::morton::region<2, 8, uint32_t> r;
+        a.append_intervals(r, 1u);
+        a.append_intervals(r, 1u);
+        assert((r == zinc::morton::region<2, 8, uint32_t>{{{0, 15, 1}}}));
+        // touching with the same data joins the last interval
+        b.append_intervals(r, 1u);
+        assert((r == zinc::morton::region<2, 8, uint32_t>{{{0, 31, 1}}}));
+        zinc::morton::region<2, 8> plain;
+        b.append_intervals(plain);
+        a.append_intervals(plain);
+        c.append_intervals(plain);
+        assert(plain == ((a.to_intervals() | b.to_intervals()) | c.to_intervals()));
+        zinc::morton::region<2, 8, uint32_t> tagged;
+        a.append_intervals(tagged, 1u);
+        b.append_intervals(tagged, 2u);
+        assert((tagged == zinc::morton::region<2, 8, uint32_t>{{{0, 15, 1}, {16, 31, 2}}}));
+    }
+
+    {
+        // coarsened covers against the cells of the box's points, brute force
+        auto check = [](auto tag, uint64_t max_side) {
+            using code_type = decltype(tag);
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            using coordinate_type = typename code_type::coordinate_type;
+            using word_type = typename code_type::word_type;
+            using region_type = zinc::morton::region<dimension, bits>;
+            lcg rng {71};
+            for (size_t i = 0; i < 30; i++) {
+                std::array<coordinate_type, dimension> lo, hi;
+                for (size_t d = 0; d < dimension; d++) {
+                    const uint64_t seed = rng();
+                    lo[d] = static_cast<coordinate_type>((seed >> 33) % ((uint64_t{1} << std::min<uint32_t>(bits, 40)) - max_side));
+                    hi[d] = static_cast<coordinate_type>(lo[d] + (seed >> 13) % max_side);
+                }
+                zinc::morton::AABB<dimension, bits> box = {code_type::encode(lo), code_type::encode(hi)};
+                assert(box.area() == box.to_intervals().area());
+                const region_type exact = box.to_intervals();
+                for (uint32_t level = 0; level <= 3; level++) {
+                    std::vector<word_type> cells;
+                    std::array<coordinate_type, dimension> p = lo;
+                    while (true) {
+                        cells.push_back(zinc::morton::get_parent_morton_aligned<dimension, word_type>(code_type::encode(p), level));
+                        size_t d = 0;
+                        for (; d < dimension && p[d] == hi[d]; d++) {
+                            p[d] = lo[d];
+                        }
+                        if (d == dimension) {
+                            break;
+                        }
+                        p[d]++;
+                    }
+                    std::sort(cells.begin(), cells.end());
+                    region_type expected;
+                    for (auto c : cells) {
+                        const word_type end = c + zinc::morton::get_morton_code<dimension, word_type>(level);
+                        if (!expected.intervals.empty() && expected.intervals.back().end + 1 >= c) {
+                            expected.intervals.back().end = end;
+                        } else {
+                            expected.intervals.push_back({c, end});
+                        }
+                    }
+                    auto coarse = box.to_cells(level);
+                    for (auto& c : coarse.cover.intervals) {
+                        assert((zinc::morton::AABB<dimension, bits>{c.start, c.end}.is_morton_aligned()));
+                        assert((zinc::morton::get_unifying_level<dimension, word_type>(c.start, c.end) >= level));
+                    }
+                    assert((region_type{} | coarse.cover) == expected);
+                    assert(coarse.over_coverage == expected.area() - box.area());
+                }
+                for (size_t budget : {size_t{1}, size_t{2}, size_t{5}, exact.intervals.size()}) {
+                    auto c = box.to_intervals(budget);
+                    assert(c.cover.intervals.size() <= budget);
+                    assert((exact - c.cover).empty());
+                    assert(c.over_coverage == c.cover.area() - box.area());
+                    if (budget == exact.intervals.size()) {
+                        assert(c.cover == exact && c.over_coverage == 0);
+                    }
+                }
+            }
+        };
+        check(morton_code<2, 32>{0}, 40);
+        check(morton_code<3, 21>{0}, 12);
+        check(morton_code<3, 42>{0}, 12);
+        check(morton_code<4, 32>{0}, 6);
+
+        // a thin box takes many intervals, which the budget brings down to a few cells
+        zinc::morton::AABB<2, 32> thin = {morton_code<2, 32>::encode({1001, 3}), morton_code<2, 32>::encode({5095, 3})};
+        assert(thin.to_intervals().intervals.size() > 1000);
+        auto c = thin.to_intervals(16);
+        assert(c.cover.intervals.size() <= 16);
+        assert(c.cover.area() == thin.area() + c.over_coverage);
+        assert((thin.to_intervals() - c.cover).empty());
+        // the whole space is a single cell at every level
+        zinc::morton::AABB<2, 8> all = {morton_code<2, 8>::encode({0, 0}), morton_code<2, 8>::encode({255, 255})};
+        assert((all.to_cells(8).cover == zinc::morton::region<2, 8>{{{0, 0xffff}}}));
+        assert(all.to_intervals(1).over_coverage == 0);
+    }
+
+    {
+        // regions_from_aabbs, serial and parallel, against folding the boxes' regions
+        auto check = [](auto tag, uint64_t spread, uint64_t max_side) {
+            using code_type = decltype(tag);
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            using coordinate_type = typename code_type::coordinate_type;
+            using box_type = zinc::morton::AABB<dimension, bits>;
+            using region_type = zinc::morton::region<dimension, bits>;
+            lcg rng {73};
+            std::vector<box_type> boxes;
+            std::vector<region_type> regions;
+            for (size_t i = 0; i < 300; i++) {
+                std::array<coordinate_type, dimension> lo, hi;
+                for (size_t d = 0; d < dimension; d++) {
+                    const uint64_t seed = rng();
+                    lo[d] = static_cast<coordinate_type>((seed >> 33) % spread);
+                    hi[d] = static_cast<coordinate_type>(lo[d] + (seed >> 13) % max_side);
+                }
+                boxes.push_back({code_type::encode(lo), code_type::encode(hi)});
+                regions.push_back(boxes.back().to_intervals());
+            }
+            const region_type expected = region_type::union_all(regions);
+            assert((zinc::morton::regions_from_aabbs<dimension, bits>(boxes) == expected));
+            std::vector<box_type> sorted = boxes;
+            std::sort(sorted.begin(), sorted.end(), [](const box_type& a, const box_type& b) { return a.min < b.min; });
+            assert((zinc::morton::regions_from_aabbs<dimension, bits>(sorted) == expected));
+            assert((zinc::morton::regions_from_aabbs<dimension, bits>({boxes.data(), 1}) == regions[0]));
+            assert((zinc::morton::regions_from_aabbs<dimension, bits>({}).empty()));
+            for (size_t threads : {1, 2, 3, 8}) {
+                zinc::thread_pool pool(threads);
+                assert((zinc::morton::parallel_regions_from_aabbs<dimension, bits>(boxes, pool) == expected));
+                assert((zinc::morton::parallel_regions_from_aabbs<dimension, bits>(sorted, pool) == expected));
+                assert((zinc::morton::parallel_regions_from_aabbs<dimension, bits>({boxes.data(), 2}, pool) == (regions[0] | regions[1])));
+                assert((zinc::morton::parallel_regions_from_aabbs<dimension, bits>({}, pool).empty()));
+            }
+        };
+        // boxes overlapping heavily, and spread out
+        check(morton_code<2, 32>{0}, 64, 40);
+        check(morton_code<2, 32>{0}, 1 << 20, 40);
+        check(morton_code<3, 21>{0}, 32, 12);
+        check(morton_code<3, 42>{0}, 1 << 20, 12);
+    }
+
+    {
+        // get_next_morton_inside against every code of small spaces
+        auto check_bigmin = [](auto tag) {
+            using code_type = decltype(tag);
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            using coordinate_type = typename code_type::coordinate_type;
+            using word_type = typename code_type::word_type;
+            const word_type codes = word_type{1} << (dimension * bits);
+            lcg rng {79};
+            for (size_t i = 0; i < 40; i++) {
+                std::array<coordinate_type, dimension> lo, hi;
+                for (size_t d = 0; d < dimension; d++) {
+                    const uint64_t seed = rng();
+                    lo[d] = static_cast<coordinate_type>((seed >> 33) % (1u << bits));
+                    hi[d] = static_cast<coordinate_type>(lo[d] + (seed >> 13) % ((1u << bits) - lo[d]));
+                }
+                zinc::morton::AABB<dimension, bits> box = {code_type::encode(lo), code_type::encode(hi)};
+                auto inside = [&](word_type m) {
+                    auto p = code_type::decode(m);
+                    for (size_t d = 0; d < dimension; d++) {
+                        if (p[d] < lo[d] || p[d] > hi[d]) {
+                            return false;
+                        }
+                    }
+                    return true;
+                };
+                std::optional<word_type> expected;
+                for (word_type m = codes; m-- > 0;) {
+                    if (inside(m)) {
+                        expected = m;
+                    }
+                    assert(box.get_next_morton_inside(m) == expected);
+                    auto cell = box.get_next_cell_inside(m);
+                    assert(cell.has_value() == expected.has_value());
+                    if (cell) {
+                        assert(cell->start == *expected && inside(cell->end));
+                    }
+                }
+            }
+        };
+        check_bigmin(morton_code<2, 5>{0});
+        check_bigmin(morton_code<3, 3>{0});
+        check_bigmin(morton_code<4, 2>{0});
+
+        // query_sorted against checking every code, with repeated codes
+        auto check = [](auto tag, uint64_t spread, uint64_t max_side) {
+            using code_type = decltype(tag);
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            using coordinate_type = typename code_type::coordinate_type;
+            using word_type = typename code_type::word_type;
+            lcg rng {83};
+            auto next = [&rng](uint64_t range) {
+                const uint64_t seed = rng();
+                return (seed >> 20) % range;
+            };
+            std::vector<word_type> codes;
+            for (size_t i = 0; i < 3000; i++) {
+                std::array<coordinate_type, dimension> p;
+                for (size_t d = 0; d < dimension; d++) {
+                    p[d] = static_cast<coordinate_type>(next(spread));
+                }
+                codes.push_back(code_type::encode(p));
+            }
+            std::sort(codes.begin(), codes.end());
+            for (size_t i = 0; i < 100; i++) {
+                std::array<coordinate_type, dimension> lo, hi;
+                for (size_t d = 0; d < dimension; d++) {
+                    lo[d] = static_cast<coordinate_type>(next(spread));
+                    hi[d] = static_cast<coordinate_type>(lo[d] + next(max_side));
+                }
+                zinc::morton::AABB<dimension, bits> box = {code_type::encode(lo), code_type::encode(hi)};
+                std::vector<std::pair<size_t, size_t>> expected;
+                for (size_t k = 0; k < codes.size(); k++) {
+                    auto p = code_type::decode(codes[k]);
+                    bool in = true;
+                    for (size_t d = 0; d < dimension; d++) {
+                        in = in && p[d] >= lo[d] && p[d] <= hi[d];
+                    }
+                    if (!in) {
+                        continue;
+                    }
+                    if (!expected.empty() && expected.back().second == k) {
+                        expected.back().second++;
+                    } else {
+                        expected.push_back({k, k + 1});
+                    }
+                }
+                std::vector<std::pair<size_t, size_t>> ranges;
+                for (auto r : zinc::morton::query_sorted(codes, box)) {
+                    ranges.push_back(r);
+                }
+                assert(ranges == expected);
+            }
+            assert((zinc::morton::query_sorted<dimension, bits>({}, {code_type::encode({}), code_type::encode({})}).begin() ==
+                    zinc::morton::query_sorted<dimension, bits>({}, {code_type::encode({}), code_type::encode({})}).end()));
+        };
+        check(morton_code<2, 32>{0}, 64, 16);
+        check(morton_code<2, 32>{0}, 4096, 1024);
+        check(morton_code<3, 21>{0}, 16, 8);
+        check(morton_code<3, 42>{0}, 64, 24);
+        check(morton_code<4, 32>{0}, 8, 4);
+    }
+
+    {
+        // query_radius and query_nearest against measuring every point
+        auto check = [](auto tag, uint64_t spread, double max_radius) {
+            using code_type = decltype(tag);
+            constexpr uint32_t dimension = code_type::dimension, bits = code_type::max_level;
+            using coordinate_type = typename code_type::coordinate_type;
+            using word_type = typename code_type::word_type;
+            using point = std::array<coordinate_type, dimension>;
+            const coordinate_type last = static_cast<coordinate_type>(~coordinate_type{0} >> (sizeof(coordinate_type) * 8 - bits));
+            lcg rng {89};
+            auto next = [&rng](uint64_t range) {
+                const uint64_t seed = rng();
+                return (seed >> 20) % range;
+            };
+            // points in clumps, with some repeated
+            std::vector<word_type> codes;
+            for (size_t i = 0; i < 2000; i++) {
+                point p;
+                for (size_t d = 0; d < dimension; d++) {
+                    p[d] = static_cast<coordinate_type>(next(4) * spread / 4 + next(spread / 16));
+                }
+                codes.push_back(code_type::encode(p));
+            }
+            std::sort(codes.begin(), codes.end());
+            auto distance = [](const point& a, const point& b) {
+                double d2 = 0;
+                for (size_t d = 0; d < dimension; d++) {
+                    d2 += (static_cast<double>(a[d]) - static_cast<double>(b[d])) * (static_cast<double>(a[d]) - static_cast<double>(b[d]));
+                }
+                return d2;
+            };
+            std::vector<point> centres;
+            for (size_t i = 0; i < 60; i++) {
+                point c;
+                for (size_t d = 0; d < dimension; d++) {
+                    c[d] = static_cast<coordinate_type>(next(spread));
+                }
+                centres.push_back(c);
+            }
+            centres.push_back(code_type::decode(codes[17]));
+            centres.push_back(point{});
+            point far;
+            far.fill(last);
+            centres.push_back(far);
+            for (auto& c : centres) {
+                std::vector<double> d2s;
+                for (auto code : codes) {
+                    d2s.push_back(distance(c, code_type::decode(code)));
+                }
+                const double radius = static_cast<double>(next(static_cast<uint64_t>(max_radius)));
+                std::vector<size_t> expected, found;
+                for (size_t i = 0; i < codes.size(); i++) {
+                    if (d2s[i] <= radius * radius) {
+                        expected.push_back(i);
+                    }
+                }
+                zinc::morton::query_radius<dimension, bits>(codes, c, radius, found);
+                assert(found == expected);
+                std::vector<double> sorted = d2s;
+                std::sort(sorted.begin(), sorted.end());
+                for (size_t k : {size_t{1}, size_t{7}, size_t{100}, codes.size(), codes.size() + 3}) {
+                    zinc::morton::query_nearest<dimension, bits>(codes, c, k, found);
+                    assert(found.size() == std::min(k, codes.size()));
+                    for (size_t j = 0; j < found.size(); j++) {
+                        assert(d2s[found[j]] == sorted[j]);
+                    }
+                }
+            }
+            std::vector<size_t> none {1, 2};
+            zinc::morton::query_nearest<dimension, bits>({}, far, 3, none);
+            assert(none.empty());
+        };
+        check(morton_code<2, 32>{0}, 1 << 12, 300);
+        check(morton_code<2, 32>{0}, uint64_t{1} << 32, 1e8);
+        check(morton_code<3, 21>{0}, 1 << 10, 100);
+        check(morton_code<3, 42>{0}, uint64_t{1} << 30, 1e6);
+        check(morton_code<4, 16>{0}, 1 << 8, 40);
+    }
+
     
     return 0;
 }